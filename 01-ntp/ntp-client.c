@@ -38,6 +38,7 @@
 #include <errno.h>
 #include <math.h>
 #include "ntp-protocol.h"
+#include "nettime.h"
 
 void tests();
 
@@ -145,6 +146,13 @@ int create_udp_socket() {
         return -1;
     }
     
+    // Have the kernel stamp the response when it arrives, that is T4.
+    // Reading the clock after recvfrom() returns would also count however
+    // long it took us to get scheduled again
+    if (nettime_enable_rx(sockfd) < 0) {
+        perror("Warning: no receive timestamps");
+    }
+    
     return sockfd;
 }
 
@@ -164,11 +172,37 @@ int send_ntp_request(int sockfd, const struct sockaddr_in* server_addr,
 
 // Receive NTP response packet over UDP
 int recv_ntp_response(int sockfd, ntp_packet_t* packet) {
+    ntp_timestamp_t recv_time;
+    
+    return recv_ntp_response_at(sockfd, packet, &recv_time);
+}
+
+// Receive NTP response packet over UDP along with when it arrived (T4).
+// That is the kernel's receive timestamp if the socket has them turned
+// on, otherwise the time now
+int recv_ntp_response_at(int sockfd, ntp_packet_t* packet, ntp_timestamp_t* recv_time) {
     struct sockaddr_in from_addr;
-    socklen_t from_len = sizeof(from_addr);
+    struct iovec iov;
+    struct msghdr msg;
+    nettime_cmsg_t control;
+    uint64_t rx_ns;
     
-    ssize_t received = recvfrom(sockfd, packet, sizeof(ntp_packet_t), 0,
-                               (struct sockaddr*)&from_addr, &from_len);
+    iov.iov_base = packet;
+    iov.iov_len = sizeof(ntp_packet_t);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &from_addr;
+    msg.msg_namelen = sizeof(from_addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    
+    ssize_t received = recvmsg(sockfd, &msg, 0);
+    if (received >= 0 && nettime_rx_real_ns(&msg, &rx_ns) == 0) {
+        unix_ns_to_ntp_time(rx_ns, recv_time);
+    } else {
+        get_current_ntp_time(recv_time);
+    }
     
     if (received < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -220,6 +254,10 @@ int query_ntp_server(const char* server_name, const char* ip_str) {
     printf("\nSending NTP request...\n");
     print_ntp_packet_info(&request_packet, "Request", IS_REQUEST);
     
+    // T1 is taken again right before sending, so printing the request is
+    // not counted as network delay
+    get_current_ntp_time(&request_packet.xmit_time);
+    
     // Convert to network byte order first, then send
     ntp_to_net(&request_packet);    
     if (send_ntp_request(sockfd, &server_addr, &request_packet) < 0) {
@@ -228,17 +266,14 @@ int query_ntp_server(const char* server_name, const char* ip_str) {
         return -1;
     }
     
-    // Receive NTP response
+    // Receive NTP response and when it arrived (T4)
     ntp_packet_t response_packet;
-    if (recv_ntp_response(sockfd, &response_packet) < 0) {
+    ntp_timestamp_t recv_time;
+    if (recv_ntp_response_at(sockfd, &response_packet, &recv_time) < 0) {
         fprintf(stderr, "Failed to receive NTP response\n");
         close(sockfd);
         return -1;
     }
-
-    // FIRST thing to do is get receive time (T4) for accurate timing
-    ntp_timestamp_t recv_time;
-    get_current_ntp_time(&recv_time);
     
     // Convert both packets back to host byte order for processing
     ntp_to_host(&request_packet);
@@ -352,6 +387,16 @@ void get_current_ntp_time(ntp_timestamp_t *ntp_ts){
     ntp_ts->fraction = MICROSECONDS_TO_FRACTIONS(tv.tv_usec);
 }
 
+// Same as get_current_ntp_time() but for a time given in nanoseconds
+// since the Unix epoch.  The fraction is (ns * 2^32) / 10^9, which fits in
+// 64 bits since ns is under 10^9
+void unix_ns_to_ntp_time(uint64_t unix_ns, ntp_timestamp_t *ntp_ts){
+    uint64_t ns = unix_ns % 1000000000ULL;
+
+    ntp_ts->seconds = UNIX_TO_NTP_SECONDS(unix_ns / 1000000000ULL);
+    ntp_ts->fraction = (ns << 32) / 1000000000ULL;
+}
+
 void current_timestamp_test(){
    ntp_timestamp_t t;
    get_current_ntp_time(&t);
@@ -323,6 +323,9 @@ typedef struct {
 // Get current system time in NTP timestamp format
 void get_current_ntp_time(ntp_timestamp_t *ntp_ts);
 
+// Convert a Unix time in nanoseconds, like a kernel receive timestamp, to NTP format
+void unix_ns_to_ntp_time(uint64_t unix_ns, ntp_timestamp_t *ntp_ts);
+
 // Convert NTP timestamp to double for mathematical operations
 double ntp_time_to_double(const ntp_timestamp_t* timestamp);
 
@@ -446,6 +449,7 @@ int create_udp_socket();
 int send_ntp_request(int sockfd, const struct sockaddr_in* server_addr, 
                     const ntp_packet_t* packet);
 int recv_ntp_response(int sockfd, ntp_packet_t* packet);
+int recv_ntp_response_at(int sockfd, ntp_packet_t* packet, ntp_timestamp_t* recv_time);
 int query_ntp_server(const char* server_name, const char* ip_str);
 
 #endif
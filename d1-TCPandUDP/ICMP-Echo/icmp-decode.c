@@ -7,6 +7,7 @@
 #include "packet.h"
 #include "nethelper.h"
 #include "icmp-decode.h"
+#include "pdu-view.h"
 
 //This is where you will be putting your captured network frames for testing.
 //Before you do your own, please test with the ones that I provided as samples:
@@ -35,13 +36,13 @@ int main(int argc, char **argv) {
     printf("\n\nDONE\n");
 }
 
-bool decode_raw_packet(uint8_t *packet){
+bool decode_raw_packet(const uint8_t *packet){
 
     //Everything we are doing starts with the ethernet PDU at the
     //front.  The below code projects an ethernet_pdu structure 
     //POINTER onto the front of the buffer so we can decode it.
-    struct ether_pdu *p = (struct ether_pdu *)packet;
-    uint16_t ft = ntohs(p->frame_type);
+    const struct ether_pdu *p = (const struct ether_pdu *)packet;
+    uint16_t ft = eth_frame_type(p);
 
     printf("Detected raw frame type from ethernet header: 0x%04x\n", ft);
 
@@ -54,7 +55,7 @@ bool decode_raw_packet(uint8_t *packet){
     printf("\nFrame type = IPv4, what addresses?\n");
 
     //We know its IP, so lets type the raw packet as an IP packet
-    ip_pdu_t *ip_pdu = (ip_pdu_t *)(packet + sizeof(ether_pdu_t));
+    const ip_pdu_t *ip_pdu = (const ip_pdu_t *)(packet + sizeof(ether_pdu_t));
     char ip_addr_buffer[16]; //ip address string aaa.bbb.ccc.ddd\0 = 16 bytes
 
     ip_toStr(ip_pdu->source_address,ip_addr_buffer,sizeof(ip_addr_buffer));
@@ -76,7 +77,7 @@ bool decode_raw_packet(uint8_t *packet){
     //Echo ICMP type.  Dont fall for this frequent nasty C bug, notice
     //both items below mean the same thing.  
     //icmp_pdu_t *icmp_pdu = (icmp_pdu_t *)(ip_pdu + 1);
-    icmp_pdu_t *icmp_pdu = (icmp_pdu_t *)((uint8_t *)ip_pdu + sizeof(ip_pdu_t));
+    const icmp_pdu_t *icmp_pdu = (const icmp_pdu_t *)((const uint8_t *)ip_pdu + sizeof(ip_pdu_t));
 
     uint8_t icmp_type = icmp_pdu->type;
     printf("ICMP Type %d\n", icmp_type);
@@ -91,31 +92,37 @@ bool decode_raw_packet(uint8_t *packet){
     //ICMP Has many protocol subtypes, so we need to next check if its an
     //Echo ICMP type, note icmp_echo_pdu is just an icmp_pdu with extra stuff
     //at end
-    icmp_echo_pdu_t *icmp_echo_pdu = (icmp_echo_pdu_t *)icmp_pdu;
+    const icmp_echo_pdu_t *icmp_echo_pdu = (const icmp_echo_pdu_t *)icmp_pdu;
 
-    print_icmp_echo(icmp_echo_pdu, ip_pdu);
+    print_icmp_echo(icmp_echo_pdu, ip_pdu, false);
 
     printf("\nOOPS - forgot about endianess...\n\n");
 
-    icmp_echo_pdu->sequence = ntohs(icmp_echo_pdu->sequence);
-    icmp_echo_pdu->id = ntohs(icmp_echo_pdu->id);
-    icmp_echo_pdu->timestamp = ntohl(icmp_echo_pdu->timestamp);
-    icmp_echo_pdu->timestamp_ms = ntohl(icmp_echo_pdu->timestamp_ms);
-    icmp_echo_pdu->icmp_hdr.checksum = ntohs(icmp_echo_pdu->icmp_hdr.checksum);
-    
-
-    print_icmp_echo(icmp_echo_pdu, ip_pdu);
+    //Rather than flipping the fields in the packet, which would leave it
+    //broken for anyone who decodes it after us, the accessors in pdu-view.h
+    //do the ntohs() and ntohl() as each field is read
+    print_icmp_echo(icmp_echo_pdu, ip_pdu, true);
 
     return true;
 }
 
 
-void print_icmp_echo(icmp_echo_pdu_t *icmp_pdu, ip_pdu_t *ip_pdu){
+/*
+ *  Prints the echo PDU.  With host_order false the multi byte fields are
+ *  printed the way they sit in the packet, in network byte order, to show
+ *  what goes wrong when you forget to convert them
+ */
+void print_icmp_echo(const icmp_echo_pdu_t *icmp_pdu, const ip_pdu_t *ip_pdu, bool host_order){
     //Step 1: Figure out ICMP size.  Notice the PDU has an unknown lenght
     //byte array as the last value. AKA uint8_t icmp_payload[];
     //dont forget endianess of total_len
-    uint16_t icmp_len = ntohs(ip_pdu->total_length) - sizeof(ip_pdu_t);
+    uint16_t icmp_len = ip_total_length(ip_pdu) - sizeof(ip_pdu_t);
     uint16_t payload_size = icmp_len - sizeof(icmp_echo_pdu_t);
+    uint16_t checksum = host_order ? icmp_checksum(&icmp_pdu->icmp_hdr) : icmp_pdu->icmp_hdr.checksum;
+    uint16_t id = host_order ? icmp_echo_id(icmp_pdu) : icmp_pdu->id;
+    uint16_t sequence = host_order ? icmp_echo_sequence(icmp_pdu) : icmp_pdu->sequence;
+    uint32_t timestamp = host_order ? icmp_echo_timestamp(icmp_pdu) : icmp_pdu->timestamp;
+    uint32_t timestamp_ms = host_order ? icmp_echo_timestamp_ms(icmp_pdu) : icmp_pdu->timestamp_ms;
 
     printf("ICMP PACKET DETAILS \n \
     type:\t0x%02x \n \
@@ -126,15 +133,14 @@ void print_icmp_echo(icmp_echo_pdu_t *icmp_pdu, ip_pdu_t *ip_pdu){
     payload:\t%d bytes \n \
     ",
     icmp_pdu->icmp_hdr.type,
-    icmp_pdu->icmp_hdr.checksum,
-    icmp_pdu->id,
-    icmp_pdu->sequence,
-    icmp_pdu->timestamp,
-    icmp_pdu->timestamp_ms,
+    checksum,
+    id,
+    sequence,
+    timestamp,
+    timestamp_ms,
     payload_size);
 
-    char *echo_ts = get_ts_formatted(icmp_pdu->timestamp, 
-        icmp_pdu->timestamp_ms);
+    char *echo_ts = get_ts_formatted(timestamp, timestamp_ms);
 
     printf("ECHO Timestamp: %s\n", echo_ts);
 
@@ -172,7 +178,7 @@ void print_icmp_echo(icmp_echo_pdu_t *icmp_pdu, ip_pdu_t *ip_pdu){
  * 0x0020 | 0x28  0x29  0x2a  0x2b  0x2c  0x2d  0x2e  0x2f  
  * 0x0028 | 0x30  0x31  0x32  0x33  0x34  0x35  0x36  0x37  
  */
-void print_icmp_payload(uint8_t *payload, uint16_t payload_size) {
+void print_icmp_payload(const uint8_t *payload, uint16_t payload_size) {
 
     int numElementsPerLine = 8;
 
@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+ *  Read only views of the PDUs in packet.h.
+ *
+ *  Instead of converting the network byte order fields of a frame in
+ *  place, read them through these accessors, which do the ntohs() or
+ *  ntohl() right where the field is used.  The frame is never changed, so
+ *  it can be decoded again, or live in memory we are not allowed to write.
+ *  Single byte fields have no byte order, read those straight out of the
+ *  struct.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "packet.h"
+
+//memcpy() because a frame can start at any address
+static inline uint16_t pdu_get16(const void *field) {
+    uint16_t v;
+    memcpy(&v, field, sizeof(v));
+    return ntohs(v);
+}
+
+static inline uint32_t pdu_get32(const void *field) {
+    uint32_t v;
+    memcpy(&v, field, sizeof(v));
+    return ntohl(v);
+}
+
+static inline uint16_t eth_frame_type(const ether_pdu_t *eth) {
+    return pdu_get16(&eth->frame_type);
+}
+
+static inline uint16_t ip_total_length(const ip_pdu_t *ip) {
+    return pdu_get16(&ip->total_length);
+}
+
+static inline uint16_t icmp_checksum(const icmp_pdu_t *icmp) {
+    return pdu_get16(&icmp->checksum);
+}
+
+static inline uint16_t icmp_echo_id(const icmp_echo_pdu_t *icmp) {
+    return pdu_get16(&icmp->id);
+}
+
+static inline uint16_t icmp_echo_sequence(const icmp_echo_pdu_t *icmp) {
+    return pdu_get16(&icmp->sequence);
+}
+
+static inline uint32_t icmp_echo_timestamp(const icmp_echo_pdu_t *icmp) {
+    return pdu_get32(&icmp->timestamp);
+}
+
+static inline uint32_t icmp_echo_timestamp_ms(const icmp_echo_pdu_t *icmp) {
+    return pdu_get32(&icmp->timestamp_ms);
+}
@@ -0,0 +1,259 @@
+#include "frame-reader.h"
+#include "nettime.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+
+/*
+ *  Sets up a reader for sock.  mode is FRAME_DELIM, FRAME_LEN16 or
+ *  FRAME_LEN32, delim is the byte that ends a frame in FRAME_DELIM mode
+ */
+void frame_reader_init(frame_reader_t *fr, int sock, int mode, uint8_t delim){
+    fr->sock = sock;
+    fr->mode = mode;
+    fr->delim = delim;
+    fr->eof = 0;
+    fr->head = 0;
+    fr->count = 0;
+    fr->scanned = 0;
+    fr->stamp_rx = 0;
+    fr->rx_ns = 0;
+}
+
+/*
+ *  Has the kernel stamp the data as it arrives.  After every read rx_ns
+ *  is when the newest of it got here, on the nettime_now_ns() clock, so a
+ *  frame's round trip can leave out how long it took us to read it.
+ *  Returns 0 on success or -1 if the socket does not support it
+ */
+int frame_reader_stamp_rx(frame_reader_t *fr){
+    if (nettime_enable_rx(fr->sock) < 0)
+        return -1;
+    fr->stamp_rx = 1;
+    return 0;
+}
+
+/*
+ *  Reads whatever the socket has into the free part of the ring.  The
+ *  free space can be split in two by the end of the ring, recvmsg() fills
+ *  both pieces with a single system call.  Returns the number of bytes
+ *  read, 0 if the other side closed the connection or -1 on an error
+ */
+static int frame_fill(frame_reader_t *fr){
+    uint32_t tail = (fr->head + fr->count) % FRAME_RING_SZ;
+    uint32_t space = FRAME_RING_SZ - fr->count;
+    struct iovec iov[2];
+    struct msghdr msg;
+    nettime_cmsg_t control;
+    nettime_ref_t ref;
+    ssize_t ret;
+
+    iov[0].iov_base = fr->ring + tail;
+    iov[0].iov_len = FRAME_RING_SZ - tail < space ? FRAME_RING_SZ - tail : space;
+    if (iov[0].iov_len < space) {
+        iov[1].iov_base = fr->ring;
+        iov[1].iov_len = space - iov[0].iov_len;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov[0].iov_len < space ? 2 : 1;
+    if (fr->stamp_rx) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+    }
+
+    do {
+        ret = recvmsg(fr->sock, &msg, 0);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret > 0) {
+        fr->count += ret;
+        if (fr->stamp_rx) {
+            nettime_ref(&ref);
+            fr->rx_ns = nettime_rx_ns(&ref, &msg);
+        }
+    }
+    return ret;
+}
+
+/*
+ *  Looks for the delimiter in the part of the ring we have not searched
+ *  yet, at most two memchr() calls since the data can wrap.  Returns the
+ *  offset from head of the delimiter, or -1 if it is not there yet
+ */
+static int64_t frame_find_delim(frame_reader_t *fr){
+    while (fr->scanned < fr->count) {
+        uint32_t start = (fr->head + fr->scanned) % FRAME_RING_SZ;
+        uint32_t run = FRAME_RING_SZ - start;
+        if (run > fr->count - fr->scanned)
+            run = fr->count - fr->scanned;
+
+        uint8_t *hit = memchr(fr->ring + start, fr->delim, run);
+        if (hit != NULL)
+            return fr->scanned + (hit - (fr->ring + start));
+        fr->scanned += run;
+    }
+    return -1;
+}
+
+/*
+ *  Returns a pointer to len bytes starting offset bytes after head.  If
+ *  they wrap around the end of the ring they are copied to scratch
+ */
+static uint8_t *frame_linear(frame_reader_t *fr, uint32_t offset, uint32_t len){
+    uint32_t start = (fr->head + offset) % FRAME_RING_SZ;
+    uint32_t first = FRAME_RING_SZ - start;
+
+    if (len <= first)
+        return fr->ring + start;
+
+    memcpy(fr->scratch, fr->ring + start, first);
+    memcpy(fr->scratch + first, fr->ring, len - first);
+    return fr->scratch;
+}
+
+//Drops n bytes from the front of the ring
+static void frame_consume(frame_reader_t *fr, uint32_t n){
+    fr->head = (fr->head + n) % FRAME_RING_SZ;
+    fr->count -= n;
+    fr->scanned = 0;
+    if (fr->count == 0)
+        fr->head = 0;           //keeps the next read in one piece
+}
+
+//Size of the length in front of each frame, 0 in FRAME_DELIM mode
+static uint32_t frame_hdr_len(frame_reader_t *fr){
+    switch (fr->mode) {
+        case FRAME_LEN16: return sizeof(uint16_t);
+        case FRAME_LEN32: return sizeof(uint32_t);
+        default:          return 0;
+    }
+}
+
+/*
+ *  Decodes the length of the frame at head.  Returns 1 and sets *len, or
+ *  0 if the length has not all arrived yet
+ */
+static int frame_parse_len(frame_reader_t *fr, uint32_t *len){
+    uint32_t hdr_len = frame_hdr_len(fr);
+
+    if (fr->count < hdr_len)
+        return 0;
+    uint8_t *hdr = frame_linear(fr, 0, hdr_len);
+    *len = 0;
+    for (uint32_t i = 0; i < hdr_len; i++)
+        *len = *len << 8 | hdr[i];
+    return 1;
+}
+
+/*
+ *  Checks if a whole frame is buffered.  Returns 1 and sets *frame and
+ *  *len if there is one, 0 if more data is needed, or -1 if the frame
+ *  could never fit in the ring
+ */
+static int frame_parse(frame_reader_t *fr, uint8_t **frame, uint32_t *len){
+    if (fr->mode != FRAME_DELIM) {
+        uint32_t hdr_len = frame_hdr_len(fr);
+        uint32_t msg_len;
+        if (!frame_parse_len(fr, &msg_len))
+            return 0;
+        if ((uint64_t)hdr_len + msg_len > FRAME_RING_SZ) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        if (fr->count < hdr_len + msg_len)
+            return 0;
+        *frame = frame_linear(fr, hdr_len, msg_len);
+        *len = msg_len;
+        frame_consume(fr, hdr_len + msg_len);
+        return 1;
+    }
+
+    int64_t pos = frame_find_delim(fr);
+    if (pos == -1 && fr->count == FRAME_RING_SZ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (pos == -1)
+        return 0;
+    *frame = frame_linear(fr, 0, pos);
+    *len = pos;
+    frame_consume(fr, pos + 1);
+    return 1;
+}
+
+/*
+ *  Returns the next complete frame from the socket, reading only when
+ *  the buffered data does not already hold one.  *frame points into the
+ *  reader and stays valid until the next call.
+ *
+ *  In FRAME_DELIM mode, data left over when the other side closes the
+ *  connection is returned as a last frame without a delimiter, a length
+ *  prefixed frame that is cut short is an error.
+ *
+ *  Returns 1 if a frame was returned, 0 if the connection was closed and
+ *  there is nothing left, or -1 on an error or a frame that is too big.
+ *  On a non blocking socket it returns -1 with errno set to EAGAIN when
+ *  there is no complete frame yet, whatever was read stays buffered
+ */
+int frame_reader_next(frame_reader_t *fr, uint8_t **frame, uint32_t *len){
+    int ret;
+
+    while ((ret = frame_parse(fr, frame, len)) == 0) {
+        if (fr->eof) {
+            if (fr->count == 0)
+                return 0;
+            if (fr->mode != FRAME_DELIM) {
+                errno = EPROTO;         //cut off in the middle of a frame
+                return -1;
+            }
+            *frame = frame_linear(fr, 0, fr->count);
+            *len = fr->count;
+            frame_consume(fr, fr->count);
+            return 1;
+        }
+
+        ret = frame_fill(fr);
+        if (ret == -1)
+            return -1;
+        if (ret == 0)
+            fr->eof = 1;
+    }
+    return ret;
+}
+
+/*
+ *  Starts streaming the length prefixed frame at head, after
+ *  frame_reader_next() failed with EMSGSIZE.  The length is consumed and
+ *  returned in *len, the frame's data follows: first whatever
+ *  frame_reader_take() returns, then the rest from the socket.  Returns 0,
+ *  or -1 if the length has not all arrived
+ */
+int frame_reader_start_stream(frame_reader_t *fr, uint32_t *len){
+    if (fr->mode == FRAME_DELIM || !frame_parse_len(fr, len))
+        return -1;
+    frame_consume(fr, frame_hdr_len(fr));
+    return 0;
+}
+
+/*
+ *  Takes up to max bytes that are buffered, as they are, without looking
+ *  for frames.  Returns how many, at most the run up to the end of the
+ *  ring, so keep calling until it returns 0.  *data stays valid until the
+ *  next call
+ */
+uint32_t frame_reader_take(frame_reader_t *fr, uint8_t **data, uint32_t max){
+    uint32_t run = FRAME_RING_SZ - fr->head;
+
+    if (run > fr->count)
+        run = fr->count;
+    if (run > max)
+        run = max;
+    *data = fr->ring + fr->head;
+    if (run > 0)
+        frame_consume(fr, run);
+    return run;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ *  A buffered reader that splits a TCP byte stream into frames.
+ *
+ *  TCP has no message boundaries, so a server that wants whole requests
+ *  has to keep reading until it sees where one ends.  Doing that with
+ *  small recv() calls costs a system call for every few bytes.  This
+ *  reader instead pulls as much as the socket has into a ring buffer with
+ *  one call and hands out complete frames from it, so one read usually
+ *  covers a whole request, or several of them.
+ *
+ *  Two framings are supported:
+ *
+ *      FRAME_DELIM   a frame ends with a delimiter byte, which is found
+ *                    with memchr() and is not part of the frame returned
+ *      FRAME_LEN16   a frame is a 16 bit length in network byte order
+ *                    followed by that many bytes of data, the frame
+ *                    returned is just the data
+ *      FRAME_LEN32   the same with a 32 bit length
+ *
+ *  Frames are normally returned in place in the ring.  A frame that wraps
+ *  around the end of the ring is copied into a scratch buffer so the
+ *  caller always gets one contiguous block.
+ *
+ *  A length prefixed frame too big for the ring makes frame_reader_next()
+ *  fail with EMSGSIZE and leaves it where it is.  The caller can then
+ *  stream it instead: frame_reader_start_stream() takes the length off,
+ *  frame_reader_take() hands out the part already buffered and the rest
+ *  is read straight from the socket.
+ *
+ *  After frame_reader_stamp_rx() every read also notes when the kernel
+ *  got the data, see nettime.h, so a client can time a reply from when it
+ *  arrived rather than from when it got around to reading it.
+ */
+
+#include <stdint.h>
+
+#ifndef FRAME_RING_SZ
+#define FRAME_RING_SZ   4096    //Also the biggest frame we can return
+#endif
+
+#define FRAME_DELIM     0
+#define FRAME_LEN16     1
+#define FRAME_LEN32     2
+
+typedef struct frame_reader_t {
+    int      sock;
+    int      mode;
+    uint8_t  delim;
+    int      eof;               //The other side closed its end
+    uint32_t head;              //Ring offset of the first unread byte
+    uint32_t count;             //Bytes in the ring
+    uint32_t scanned;           //Bytes after head known not to hold the delimiter
+    int      stamp_rx;          //Set by frame_reader_stamp_rx()
+    uint64_t rx_ns;             //When the last data read arrived
+    uint8_t  ring[FRAME_RING_SZ];
+    uint8_t  scratch[FRAME_RING_SZ];
+} frame_reader_t;
+
+void frame_reader_init(frame_reader_t *fr, int sock, int mode, uint8_t delim);
+int  frame_reader_stamp_rx(frame_reader_t *fr);
+int  frame_reader_next(frame_reader_t *fr, uint8_t **frame, uint32_t *len);
+int  frame_reader_start_stream(frame_reader_t *fr, uint32_t *len);
+uint32_t frame_reader_take(frame_reader_t *fr, uint8_t **data, uint32_t max);
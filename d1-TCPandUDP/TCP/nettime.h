@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ *  Timing for network round trips.
+ *
+ *  A round trip timed with two clock reads in user space also counts how
+ *  long the process took to get scheduled and call recv() after the reply
+ *  arrived, which on a busy machine can be more than the round trip.  The
+ *  kernel can stamp each packet as it comes in instead (SO_TIMESTAMPNS),
+ *  that stamp is when the reply really got here.
+ *
+ *  Intervals are measured on CLOCK_MONOTONIC_RAW, which NTP does not speed
+ *  up or slow down.  The kernel stamps are on the wall clock, so
+ *  nettime_rx_ns() moves them onto the raw clock by how long ago they were
+ *  taken, read from both clocks back to back.
+ *
+ *  Round trip times are collected in a histogram with buckets that get
+ *  wider as the values get bigger, HDR style, so it always has about the
+ *  same relative precision (under 1%) and a fixed size however many times
+ *  are recorded.  Recording is lock free, threads can share one.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#define NETTIME_HIST_SUB_BITS   7       //128 buckets per power of two
+#define NETTIME_HIST_SUB        (1 << NETTIME_HIST_SUB_BITS)
+#define NETTIME_HIST_MAX_BITS   40      //Times up to 2^40 ns, about 18 minutes
+#define NETTIME_HIST_BUCKETS    ((NETTIME_HIST_MAX_BITS - NETTIME_HIST_SUB_BITS + 1) * NETTIME_HIST_SUB)
+#define NETTIME_CMSG_SIZE       64      //Room for one timestamp control message
+
+//Control message buffer for recvmsg(), aligned the way cmsg needs
+typedef union nettime_cmsg_t {
+    char            buf[NETTIME_CMSG_SIZE];
+    struct cmsghdr  align;
+} nettime_cmsg_t;
+
+//Both clocks read back to back, to move kernel stamps onto the raw clock
+typedef struct nettime_ref_t {
+    uint64_t raw;
+    uint64_t real;
+} nettime_ref_t;
+
+typedef struct nettime_hist_t {
+    uint64_t counts[NETTIME_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} nettime_hist_t;
+
+uint64_t nettime_now_ns(void);
+void     nettime_ref(nettime_ref_t *ref);
+int      nettime_enable_rx(int sock);
+int      nettime_rx_real_ns(struct msghdr *msg, uint64_t *ns);
+uint64_t nettime_rx_ns(const nettime_ref_t *ref, struct msghdr *msg);
+
+void     nettime_hist_init(nettime_hist_t *h);
+void     nettime_hist_record(nettime_hist_t *h, uint64_t ns);
+void     nettime_hist_merge(nettime_hist_t *dst, const nettime_hist_t *src);
+uint64_t nettime_hist_percentile(const nettime_hist_t *h, double p);
+void     nettime_hist_print(const nettime_hist_t *h, FILE *out);
@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include "tcp-echo.h"
+#include "frame-reader.h"
+#include "nettime.h"
+
+// Everything the benchmark measured, over all connections
+typedef struct {
+    nettime_hist_t rtt;     // Round trip times, from when each reply arrived
+    uint64_t count;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t errors;
+} bench_stats_t;
+
+static bench_stats_t stats;
+
+// Every request's payload is sent from here, so big requests take no
+// more memory than small ones.  All 'x', it can never be "exit server"
+static uint8_t payload[BENCH_PAYLOAD_BUFFER_SIZE];
+
+// Replies that are too big for the reader are thrown away in here
+static uint8_t discard[BENCH_PAYLOAD_BUFFER_SIZE];
+
+// Adds the next request to the connection's output and remembers when it
+// was queued.  Payloads are between min_size and max_size bytes
+static void bench_queue_request(bench_conn_t *bc, const bench_opts_t *opts) {
+    uint32_t size = opts->min_size;
+    int slot = (bc->first_in_flight + bc->in_flight) % opts->depth;
+
+    if (opts->max_size > opts->min_size) {
+        size += rand() % (opts->max_size - opts->min_size + 1);
+    }
+
+    // Replies come back in order, so the requests in flight are a ring
+    bc->sizes[slot] = size;
+    bc->sent_at[slot] = nettime_now_ns();
+    bc->in_flight++;
+    bc->unsent++;
+}
+
+// Sends as much of the requests not sent yet as the socket takes.  They
+// are gathered into one sendmsg(), each a length and a piece of payload
+// Returns 0 on success, -1 on an error
+static int bench_flush(bench_conn_t *bc, const bench_opts_t *opts) {
+    struct iovec iov[BENCH_IOV_MAX];
+    uint8_t hdrs[BENCH_IOV_MAX / 2][sizeof(uint32_t)];
+    struct msghdr msg;
+    ssize_t result;
+
+    while (bc->unsent > 0) {
+        uint64_t offset = bc->send_offset;
+        size_t bytes = 0;
+        int iovcnt = 0;
+
+        // Up to two iovecs per request, one for a zero byte request, so
+        // stopping at the last header also keeps us inside iov
+        for (int i = 0; i < bc->unsent && i < BENCH_IOV_MAX / 2; i++) {
+            int slot = (bc->first_in_flight + bc->in_flight - bc->unsent + i) % opts->depth;
+            size_t hdr_len = pdu_put_len(hdrs[i], bc->sizes[slot]);
+            uint64_t left = hdr_len + bc->sizes[slot] - offset;
+
+            if (offset < hdr_len) {
+                iov[iovcnt].iov_base = hdrs[i] + offset;
+                iov[iovcnt].iov_len = hdr_len - offset;
+                bytes += iov[iovcnt++].iov_len;
+                left -= hdr_len - offset;
+            }
+            if (left > sizeof(payload)) {
+                left = sizeof(payload);
+            }
+            if (left > 0) {
+                iov[iovcnt].iov_base = payload;
+                iov[iovcnt].iov_len = left;
+                bytes += iov[iovcnt++].iov_len;
+            }
+            if (left == sizeof(payload)) {
+                break;          // A big one, the rest of it goes next time
+            }
+            offset = 0;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        result = sendmsg(bc->sockfd, &msg, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        stats.bytes_sent += result;
+        if ((size_t)result < bytes) {
+            bytes = 0;          // The socket is full, EPOLLOUT says when it is not
+        }
+
+        // Move past the requests that are all sent
+        while (result > 0) {
+            int slot = (bc->first_in_flight + bc->in_flight - bc->unsent) % opts->depth;
+            uint64_t left = pdu_hdr_len() + bc->sizes[slot] - bc->send_offset;
+            if ((uint64_t)result < left) {
+                bc->send_offset += result;
+                break;
+            }
+            result -= left;
+            bc->send_offset = 0;
+            bc->unsent--;
+        }
+        if (bytes == 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Times the reply to the oldest request, which arrived at rx_ns, and sends
+// another in its place while the benchmark is running.  Returns 0, or -1
+// if nothing was sent
+static int bench_reply_done(bench_conn_t *bc, const bench_opts_t *opts, int running,
+                            uint64_t rx_ns) {
+    uint64_t sent_at = bc->sent_at[bc->first_in_flight];
+
+    if (bc->in_flight == bc->unsent) {
+        return -1;                  // Not a reply to anything we sent
+    }
+    nettime_hist_record(&stats.rtt, rx_ns > sent_at ? rx_ns - sent_at : 0);
+    stats.count++;
+    bc->first_in_flight = (bc->first_in_flight + 1) % opts->depth;
+    bc->in_flight--;
+
+    if (running) {
+        bench_queue_request(bc, opts);
+    }
+    return 0;
+}
+
+// Takes every reply that has arrived.  With --frame32 a reply can be too
+// big for the reader, it is read and thrown away a piece at a time
+// Returns 0 on success, -1 on an error or if the server hung up
+static int bench_handle_input(bench_conn_t *bc, const bench_opts_t *opts, int running) {
+    const uint8_t *msg;
+    uint8_t *data;
+    uint32_t msg_len;
+    ssize_t result;
+
+    while (1) {
+        if (bc->skip_left > 0) {
+            // What the reader already has first, then the socket
+            result = frame_reader_take(&bc->reader, &data, bc->skip_left);
+            if (result == 0) {
+                size_t len = bc->skip_left < sizeof(discard) ? bc->skip_left : sizeof(discard);
+                result = recv(bc->sockfd, discard, len, 0);
+                if (result < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return 0;
+                }
+                if (result <= 0) {
+                    return -1;
+                }
+            }
+            stats.bytes_received += result;
+            bc->skip_left -= result;
+            // Read around the reader, so no kernel stamp for these
+            if (bc->skip_left == 0 &&
+                bench_reply_done(bc, opts, running, nettime_now_ns()) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        result = recv_pdu_inplace(&bc->reader, &msg, &msg_len);
+        if (result == 1) {
+            if (msg_len < ECHO_PREFIX_LEN || memcmp(msg, ECHO_PREFIX, ECHO_PREFIX_LEN) != 0) {
+                return -1;
+            }
+            stats.bytes_received += pdu_hdr_len() + msg_len;
+            if (bench_reply_done(bc, opts, running, bc->reader.rx_ns) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (result < 0 && errno == EMSGSIZE && bc->reader.mode == FRAME_LEN32) {
+            if (frame_reader_start_stream(&bc->reader, &bc->skip_left) < 0) {
+                return -1;
+            }
+            stats.bytes_received += pdu_hdr_len();
+            continue;
+        }
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+// Opens one non blocking benchmark connection and adds it to epoll
+// Returns 0 on success, -1 on an error
+static int bench_connect(int epfd, bench_conn_t *bc, const struct sockaddr_in *server_addr,
+                         const bench_opts_t *opts) {
+    struct epoll_event ev;
+    int one = 1;
+
+    bc->sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bc->sockfd < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+    if (connect(bc->sockfd, (const struct sockaddr*)server_addr, sizeof(*server_addr)) < 0) {
+        perror("Error connecting to server");
+        close(bc->sockfd);
+        return -1;
+    }
+
+    // Requests are small and latency is what we measure, so no Nagle
+    setsockopt(bc->sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(bc->sockfd, F_SETFL, fcntl(bc->sockfd, F_GETFL) | O_NONBLOCK);
+
+    bc->sent_at = malloc(opts->depth * sizeof(uint64_t));
+    bc->sizes = malloc(opts->depth * sizeof(uint32_t));
+    if (bc->sent_at == NULL || bc->sizes == NULL) {
+        perror("Error allocating connection");
+        close(bc->sockfd);
+        return -1;
+    }
+    bc->first_in_flight = 0;
+    bc->in_flight = 0;
+    bc->unsent = 0;
+    bc->send_offset = 0;
+    bc->skip_left = 0;
+    bc->open = 1;
+    frame_reader_init(&bc->reader, bc->sockfd, frame_mode, 0);
+    frame_reader_stamp_rx(&bc->reader);     // Falls back to the time it is read
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = bc;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, bc->sockfd, &ev) < 0) {
+        perror("Error adding connection to epoll");
+        close(bc->sockfd);
+        return -1;
+    }
+    return 0;
+}
+
+static void bench_close(int epfd, bench_conn_t *bc) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, bc->sockfd, NULL);
+    close(bc->sockfd);
+    bc->open = 0;
+}
+
+// Loads the server with pipelined requests and prints what it managed.
+// Every connection keeps opts->depth requests in flight, each reply is
+// answered with a new request right away, from one thread with epoll so
+// the client is not what limits the server
+void start_bench(const char* addr, int port, const bench_opts_t *opts) {
+    struct epoll_event events[MAX_EVENTS];
+    struct sockaddr_in server_addr;
+    bench_conn_t *conns;
+    uint64_t start, stop, elapsed;
+    uint64_t measured = 0;          // Replies that came in before time was up
+    int open_conns = 0;
+    int running = 1;
+    int epfd;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Error: Invalid address %s\n", addr);
+        exit(EXIT_FAILURE);
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("Error creating epoll instance");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(payload, 'x', sizeof(payload));
+    conns = calloc(opts->conns, sizeof(bench_conn_t));
+    if (conns == NULL) {
+        perror("Error allocating connections");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < opts->conns; i++) {
+        if (bench_connect(epfd, &conns[i], &server_addr, opts) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        open_conns++;
+    }
+
+    printf("Benchmarking %s:%d: %d connections, %d requests in flight each, "
+           "%u-%u byte messages, %d seconds\n", addr, port, opts->conns, opts->depth,
+           opts->min_size, opts->max_size, opts->duration);
+
+    nettime_hist_init(&stats.rtt);
+
+    // Fill every pipeline, from then on each reply brings a new request
+    start = nettime_now_ns();
+    stop = start + (uint64_t)opts->duration * 1000000000;
+    for (int i = 0; i < opts->conns; i++) {
+        while (conns[i].in_flight < opts->depth) {
+            bench_queue_request(&conns[i], opts);
+        }
+        if (bench_flush(&conns[i], opts) < 0) {
+            perror("Error sending request");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Once time is up no new requests go out, the ones in flight still get
+    // their replies, up to a second later
+    while (open_conns > 0) {
+        uint64_t now = nettime_now_ns();
+        if (running && now >= stop) {
+            running = 0;
+            elapsed = now - start;
+            measured = stats.count;
+            stop = now + 1000000000;
+        } else if (!running && now >= stop) {
+            break;
+        }
+
+        int nfds = epoll_wait(epfd, events, MAX_EVENTS, (stop - now) / 1000000 + 1);
+        if (nfds < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error in epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            bench_conn_t *bc = events[i].data.ptr;
+            if (!bc->open) {
+                continue;
+            }
+            if ((events[i].events & EPOLLERR) || bench_handle_input(bc, opts, running) < 0 ||
+                bench_flush(bc, opts) < 0) {
+                stats.errors++;
+                bench_close(epfd, bc);
+                open_conns--;
+                continue;
+            }
+            if (!running && bc->in_flight == 0) {
+                bench_close(epfd, bc);
+                open_conns--;
+            }
+        }
+    }
+    if (running) {
+        elapsed = nettime_now_ns() - start;     // Every connection failed early
+        measured = stats.count;
+    }
+
+    for (int i = 0; i < opts->conns; i++) {
+        if (conns[i].open) {
+            bench_close(epfd, &conns[i]);
+        }
+        free(conns[i].sent_at);
+        free(conns[i].sizes);
+    }
+    free(conns);
+    close(epfd);
+
+    double seconds = elapsed / 1e9;
+    printf("Messages:     %lu in %.2f s, %.0f msg/s\n", (unsigned long)measured, seconds,
+           measured / seconds);
+    printf("Throughput:   %.2f MB/s sent, %.2f MB/s received\n",
+           stats.bytes_sent / seconds / 1e6, stats.bytes_received / seconds / 1e6);
+    printf("Errors:       %lu\n", (unsigned long)stats.errors);
+    nettime_hist_print(&stats.rtt, stdout);
+}
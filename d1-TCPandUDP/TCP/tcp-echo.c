@@ -1,19 +1,53 @@
+#define _GNU_SOURCE     // for accept4()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdint.h>
 
 #include "tcp-echo.h"
+#include "frame-reader.h"
+#include "nettime.h"
 
 
 // Global buffers
 char send_buffer[BUFFER_SIZE];
-char recv_buffer[BUFFER_SIZE];
+
+// Buffered reader for the current connection, recv_pdu() takes PDUs from it
+frame_reader_t pdu_reader;
+
+// Every open server connection, so "exit server" can close them all
+echo_conn_t *server_conns = NULL;
+int server_conn_count = 0;
+
+// Connections with output to send at the end of this event loop pass, each
+// event adds its connection at most once
+echo_conn_t *flush_list[MAX_EVENTS];
+int flush_count = 0;
+
+// Output chunks not in use, kept to save on malloc() and free()
+out_chunk_t *free_chunks = NULL;
+int free_chunk_count = 0;
+
+// Send big batches of replies with MSG_ZEROCOPY (--zerocopy)
+int server_zerocopy = 0;
+
+// Don't log every message, only connections coming and going (--quiet)
+int server_quiet = 0;
+
+// PDUs have a 16 bit length, or a 32 bit one with --frame32
+int frame_mode = FRAME_LEN16;
 
 // Global socket for signal handler
 int server_sockfd = -1;
@@ -25,7 +59,10 @@ volatile int client_exit_requested = 0;
 int main(int argc, char* argv[]) {
     int is_client = 0;
     int is_server = 0;
+    int is_bench = 0;
     int port = DEFAULT_PORT;
+    bench_opts_t bench = {BENCH_DEFAULT_CONNS, BENCH_DEFAULT_DEPTH, BENCH_DEFAULT_SIZE,
+                          BENCH_DEFAULT_SIZE, BENCH_DEFAULT_DURATION};
     char addr[INET_ADDRSTRLEN] = {0};
     
     // Set up signal handler for graceful shutdown
@@ -40,6 +77,41 @@ int main(int argc, char* argv[]) {
         } else if (strcmp(argv[i], "--server") == 0) {
             is_server = 1;
             strcpy(addr, DEFAULT_SERVER_ADDR);
+        } else if (strcmp(argv[i], "--zerocopy") == 0) {
+            server_zerocopy = 1;
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            server_quiet = 1;
+        } else if (strcmp(argv[i], "--frame32") == 0) {
+            frame_mode = FRAME_LEN32;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            is_bench = 1;
+        } else if (strcmp(argv[i], "--conns") == 0 || strcmp(argv[i], "--depth") == 0 ||
+                   strcmp(argv[i], "--duration") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: %s requires a positive value\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            int value = atoi(argv[++i]);
+            if (strcmp(argv[i - 1], "--conns") == 0) {
+                bench.conns = value;
+            } else if (strcmp(argv[i - 1], "--depth") == 0) {
+                bench.depth = value;
+            } else {
+                bench.duration = value;
+            }
+        } else if (strcmp(argv[i], "--size") == 0) {
+            // One size, or a range MIN-MAX with a random size per message
+            unsigned int min_size, max_size;
+            int fields = i + 1 < argc ? sscanf(argv[++i], "%u-%u", &min_size, &max_size) : 0;
+            if (fields == 1) {
+                max_size = min_size;
+            }
+            if (fields < 1 || min_size > max_size) {
+                fprintf(stderr, "Error: --size requires SIZE or MIN-MAX\n");
+                exit(EXIT_FAILURE);
+            }
+            bench.min_size = min_size;
+            bench.max_size = max_size;
         } else if (strcmp(argv[i], "--port") == 0) {
             if (i + 1 < argc) {
                 port = atoi(argv[++i]);
@@ -69,6 +141,19 @@ int main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
     }
     
+    // Only 32 bit framing carries big messages, checked once it is known
+    if (bench.max_size > (frame_mode == FRAME_LEN32 ? MAX_BULK_MSG_SIZE : MAX_MSG_DATA_SIZE)) {
+        fprintf(stderr, "Error: --size is at most %zu, or %u with --frame32\n",
+                MAX_MSG_DATA_SIZE, MAX_BULK_MSG_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    
+    if (is_bench && !is_client) {
+        fprintf(stderr, "Error: --bench is a client mode\n");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    
     if (is_client && is_server) {
         fprintf(stderr, "Error: Cannot specify both --client and --server\n");
         print_usage(argv[0]);
@@ -85,7 +170,9 @@ int main(int argc, char* argv[]) {
     }
     
     // Start client or server
-    if (is_client) {
+    if (is_bench) {
+        start_bench(addr, port, &bench);
+    } else if (is_client) {
         printf("Starting TCP client: connecting to %s:%d\n", addr, port);
         start_client(addr, port);
     } else {
@@ -134,6 +221,8 @@ void start_client(const char* addr, int port) {
     }
     
     printf("Connected to server %s:%d\n", addr, port);
+    frame_reader_init(&pdu_reader, sockfd, frame_mode, 0);
+    frame_reader_stamp_rx(&pdu_reader);     // Round trips end when the reply arrives
     printf("Type messages to send to server.\n");
     printf("Type 'exit' to quit, or 'exit server' to shutdown the server.\n");
     printf("Press Ctrl+C to exit at any time.\n\n");
@@ -167,6 +256,7 @@ void start_client(const char* addr, int port) {
         }
         
         // Send message PDU to server
+        uint64_t sent_at = nettime_now_ns();
         if (send_pdu(sockfd, input_buffer) < 0) {
             printf("Error sending message. Server may have disconnected.\n");
             break;
@@ -182,7 +272,9 @@ void start_client(const char* addr, int port) {
             break;
         }
         
+        uint64_t rx_ns = pdu_reader.rx_ns > sent_at ? pdu_reader.rx_ns : sent_at;
         printf("Server: %s\n", extracted_msg);
+        printf("Round trip: %.1f us\n", (rx_ns - sent_at) / 1000.0);
         
         // Check if server is exiting (response to "exit server" command)
         if (strstr(extracted_msg, "server is exiting") != NULL) {
@@ -196,19 +288,647 @@ void start_client(const char* addr, int port) {
     printf("Client disconnected.\n");
 }
 
-void start_server(const char* addr, int port) {
-    int sockfd, client_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+// Takes an output chunk from the free list, or allocates a new one
+out_chunk_t *chunk_alloc(void) {
+    out_chunk_t *chunk = free_chunks;
+    
+    if (chunk != NULL) {
+        free_chunks = chunk->next;
+        free_chunk_count--;
+    } else {
+        chunk = malloc(sizeof(out_chunk_t));
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->len = 0;
+    chunk->zc_used = 0;
+    chunk->zc_id = 0;
+    return chunk;
+}
+
+// Returns a chunk to the free list, keeping only a limited number around
+void chunk_free(out_chunk_t *chunk) {
+    if (free_chunk_count >= MAX_FREE_CHUNKS) {
+        free(chunk);
+        return;
+    }
+    chunk->next = free_chunks;
+    free_chunks = chunk;
+    free_chunk_count++;
+}
+
+// Sets up the state for a newly accepted client and adds it to epoll.
+// The socket is watched edge triggered for both reading and writing, so
+// epoll only reports changes and the connection never has to be modified
+// between the two.  Returns the connection, or NULL on an error
+echo_conn_t *conn_open(int epfd, int sockfd, const struct sockaddr_in *peer_addr) {
     char client_ip[INET_ADDRSTRLEN];
-    char extracted_msg[BUFFER_SIZE];
-    char response_msg[BUFFER_SIZE];
-    ssize_t pdu_len;
+    struct epoll_event ev;
+    echo_conn_t *conn;
+    int one = 1;
+    
+    conn = malloc(sizeof(echo_conn_t));
+    if (conn == NULL) {
+        perror("Error allocating connection");
+        return NULL;
+    }
+    
+    conn->sockfd = sockfd;
+    conn->state = CONN_READING;
+    conn->out_head = NULL;
+    conn->out_tail = NULL;
+    conn->out_queued = 0;
+    conn->zc_head = NULL;
+    conn->zc_tail = NULL;
+    conn->zc_next_id = 0;
+    conn->zc_done = 0;
+    conn->zerocopy = 0;
+    conn->flush_pending = 0;
+    inet_ntop(AF_INET, &peer_addr->sin_addr, client_ip, INET_ADDRSTRLEN);
+    snprintf(conn->peer, sizeof(conn->peer), "%s:%d", client_ip, ntohs(peer_addr->sin_port));
+    conn->stream_left = 0;
+    conn->pipe_fds[0] = -1;
+    conn->pipe_fds[1] = -1;
+    conn->pipe_len = 0;
+    frame_reader_init(&conn->reader, sockfd, frame_mode, 0);
+    
+    // Zero copy sends have to be allowed on the socket before they are used
+    if (server_zerocopy) {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+            conn->zerocopy = 1;
+        } else {
+            perror("Error enabling MSG_ZEROCOPY, sending with copies");
+        }
+    }
+    
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+        perror("Error adding client to epoll");
+        free(conn);
+        return NULL;
+    }
+    
+    conn->prev = NULL;
+    conn->next = server_conns;
+    if (server_conns != NULL) {
+        server_conns->prev = conn;
+    }
+    server_conns = conn;
+    server_conn_count++;
+    return conn;
+}
+
+// Closes a client connection and frees its state
+void conn_close(int epfd, echo_conn_t *conn) {
+    out_chunk_t *chunk;
+    
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sockfd, NULL);
+    close(conn->sockfd);
+    if (conn->pipe_fds[0] >= 0) {
+        close(conn->pipe_fds[0]);
+        close(conn->pipe_fds[1]);
+    }
+    
+    while ((chunk = conn->out_head) != NULL) {
+        conn->out_head = chunk->next;
+        chunk_free(chunk);
+    }
+    while ((chunk = conn->zc_head) != NULL) {
+        conn->zc_head = chunk->next;
+        chunk_free(chunk);
+    }
+    
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        server_conns = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    server_conn_count--;
+    
+    printf("Client %s connection closed (%d connected).\n", conn->peer, server_conn_count);
+    free(conn);
+}
+
+// Finds room for len bytes at the end of the connection's output.  A reply
+// never straddles two chunks, so when the last chunk is too full a new one
+// is added.  The caller fills the space in and then calls conn_out_commit()
+// Returns a pointer to the space, or NULL if out of memory
+uint8_t *conn_out_reserve(echo_conn_t *conn, size_t len) {
+    out_chunk_t *tail = conn->out_tail;
+    
+    if (len > OUT_CHUNK_SIZE) {
+        return NULL;
+    }
+    if (tail == NULL || OUT_CHUNK_SIZE - tail->len < len) {
+        tail = chunk_alloc();
+        if (tail == NULL) {
+            return NULL;
+        }
+        if (conn->out_tail != NULL) {
+            conn->out_tail->next = tail;
+        } else {
+            conn->out_head = tail;
+        }
+        conn->out_tail = tail;
+    }
+    return tail->data + tail->len;
+}
+
+void conn_out_commit(echo_conn_t *conn, size_t len) {
+    conn->out_tail->len += len;
+    conn->out_queued += len;
+}
+
+// Adds a reply PDU to the connection's output, it goes out on the next flush
+// Returns 0 on success, -1 if there is no room for it
+int conn_queue_pdu(echo_conn_t *conn, const char *message) {
+    size_t msg_len = strlen(message);
+    size_t hdr_len;
+    uint8_t *pdu;
+    
+    pdu = conn_out_reserve(conn, pdu_hdr_len() + msg_len);
+    if (pdu == NULL) {
+        return -1;
+    }
+    
+    hdr_len = pdu_put_len(pdu, msg_len);
+    memcpy(pdu + hdr_len, message, msg_len);
+    conn_out_commit(conn, hdr_len + msg_len);
+    return 0;
+}
+
+// Adds "echo: " and the message as a reply PDU, built straight into the
+// connection's output so the message is copied just once
+// Returns 0 on success, -1 if there is no room for it
+int conn_queue_echo(echo_conn_t *conn, const uint8_t *msg, uint32_t msg_len) {
+    size_t prefix_len = ECHO_PREFIX_LEN;
+    size_t hdr_len;
+    uint8_t *pdu;
+    
+    // The 16 bit protocol only echoes the start, 32 bit framing is for bulk
+    // data so all of it comes back
+    if (frame_mode == FRAME_LEN16 && msg_len > MAX_ECHO_DATA_SIZE) {
+        msg_len = MAX_ECHO_DATA_SIZE;
+    }
+    pdu = conn_out_reserve(conn, pdu_hdr_len() + prefix_len + msg_len);
+    if (pdu == NULL) {
+        return -1;
+    }
+    
+    hdr_len = pdu_put_len(pdu, prefix_len + msg_len);
+    memcpy(pdu + hdr_len, ECHO_PREFIX, prefix_len);
+    memcpy(pdu + hdr_len + prefix_len, msg, msg_len);
+    conn_out_commit(conn, hdr_len + prefix_len + msg_len);
+    return 0;
+}
+
+// Starts echoing a message too big for the connection's reader, which
+// only happens with --frame32.  The reply header and the part of the
+// message already read are queued as usual, the rest is moved from the
+// socket back to the socket by conn_stream() as it arrives, so a message
+// of any size takes no more memory than a small one
+// Returns 0 on success, -1 on an error
+int conn_start_stream(echo_conn_t *conn) {
+    size_t prefix_len = ECHO_PREFIX_LEN;
+    uint32_t msg_len;
+    uint8_t *data;
+    uint8_t *pdu;
+    uint32_t n;
+    
+    if (frame_reader_start_stream(&conn->reader, &msg_len) < 0 || msg_len > MAX_BULK_MSG_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    
+    // splice() can only move data through a pipe, each connection gets one
+    // the first time it needs it
+    if (conn->pipe_fds[0] < 0 && pipe2(conn->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        perror("Error creating pipe");
+        return -1;
+    }
+    
+    pdu = conn_out_reserve(conn, pdu_hdr_len() + prefix_len);
+    if (pdu == NULL) {
+        return -1;
+    }
+    size_t hdr_len = pdu_put_len(pdu, prefix_len + msg_len);
+    memcpy(pdu + hdr_len, ECHO_PREFIX, prefix_len);
+    conn_out_commit(conn, hdr_len + prefix_len);
+    
+    while ((n = frame_reader_take(&conn->reader, &data, msg_len)) > 0) {
+        pdu = conn_out_reserve(conn, n);
+        if (pdu == NULL) {
+            return -1;
+        }
+        memcpy(pdu, data, n);
+        conn_out_commit(conn, n);
+        msg_len -= n;
+    }
+    
+    if (!server_quiet) {
+        printf("Streaming a %u byte message from client %s.\n", msg_len, conn->peer);
+    }
+    conn->stream_left = msg_len;
+    conn->state = CONN_STREAMING;
+    return 0;
+}
+
+// Moves the rest of a streamed message from the socket to the socket with
+// splice(), through the connection's pipe, so it never comes up to user
+// space.  Only a pipe full at a time is read, and only once the last one
+// has been sent, which keeps memory constant and slows a client down
+// when its reader is slow.  Call it when the output queue is empty
+// Returns 1 when the message is done, 0 if the socket has to wait, -1 on
+// an error
+int conn_stream(echo_conn_t *conn) {
+    ssize_t result;
+    
+    while (1) {
+        if (conn->pipe_len > 0) {
+            result = splice(conn->pipe_fds[0], NULL, conn->sockfd, NULL, conn->pipe_len,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return (errno == EAGAIN) ? 0 : -1;
+            }
+            conn->pipe_len -= result;
+            continue;
+        }
+        
+        if (conn->stream_left == 0) {
+            return 1;
+        }
+        
+        size_t len = conn->stream_left < STREAM_PIPE_SIZE ? conn->stream_left : STREAM_PIPE_SIZE;
+        result = splice(conn->sockfd, NULL, conn->pipe_fds[1], NULL, len,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN) ? 0 : -1;
+        }
+        if (result == 0) {
+            printf("Client %s closed the connection in the middle of a message.\n", conn->peer);
+            return -1;
+        }
+        conn->stream_left -= result;
+        conn->pipe_len += result;
+    }
+}
+
+// Moves the output past sent bytes.  Chunks that are done go back to the
+// free list, unless the kernel still reads from them for a zero copy send,
+// then they wait on the zc list for its completion
+void conn_out_consume(echo_conn_t *conn, size_t sent, int zerocopy, uint32_t zc_id) {
+    out_chunk_t *chunk;
+    
+    conn->out_queued -= sent;
+    while ((chunk = conn->out_head) != NULL) {
+        size_t n = chunk->len - chunk->start;
+        if (n > sent) {
+            n = sent;
+        }
+        chunk->start += n;
+        sent -= n;
+        if (zerocopy && n > 0) {
+            chunk->zc_used = 1;
+            chunk->zc_id = zc_id;
+        }
+        if (chunk->start < chunk->len) {
+            break;
+        }
+        
+        // The last chunk is kept for more replies, unless the kernel has it
+        if (chunk == conn->out_tail && !chunk->zc_used) {
+            chunk->start = 0;
+            chunk->len = 0;
+            break;
+        }
+        
+        conn->out_head = chunk->next;
+        if (conn->out_head == NULL) {
+            conn->out_tail = NULL;
+        }
+        chunk->next = NULL;
+        if (chunk->zc_used) {
+            if (conn->zc_tail != NULL) {
+                conn->zc_tail->next = chunk;
+            } else {
+                conn->zc_head = chunk;
+            }
+            conn->zc_tail = chunk;
+        } else {
+            chunk_free(chunk);
+        }
+    }
+}
+
+// Sends as much queued output as the socket takes without blocking.  All of
+// the chunks go out together in one sendmsg(), which is writev() with flags,
+// so many small replies cost a single system call and leave in as few TCP
+// segments as possible.  Big batches are sent with MSG_ZEROCOPY when the
+// server was started with --zerocopy
+// Returns 1 if everything was sent, 0 if some is left, -1 on an error
+int conn_flush(echo_conn_t *conn) {
+    struct iovec iov[FLUSH_IOV_MAX];
+    struct msghdr msg;
+    out_chunk_t *chunk;
+    ssize_t result;
+    
+    while (conn->out_queued > 0) {
+        int iovcnt = 0;
+        size_t bytes = 0;
+        
+        for (chunk = conn->out_head; chunk != NULL && iovcnt < FLUSH_IOV_MAX; chunk = chunk->next) {
+            if (chunk->len > chunk->start) {
+                iov[iovcnt].iov_base = chunk->data + chunk->start;
+                iov[iovcnt].iov_len = chunk->len - chunk->start;
+                bytes += iov[iovcnt].iov_len;
+                iovcnt++;
+            }
+        }
+        
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        
+        int zerocopy = conn->zerocopy && bytes >= ZEROCOPY_MIN_BYTES;
+        result = sendmsg(conn->sockfd, &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (result < 0 && zerocopy && errno == ENOBUFS) {
+            // Too many zero copy sends in flight, this one copies
+            zerocopy = 0;
+            result = sendmsg(conn->sockfd, &msg, MSG_NOSIGNAL);
+        }
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        
+        conn_out_consume(conn, result, zerocopy, conn->zc_next_id);
+        if (zerocopy) {
+            conn->zc_next_id++;     // The kernel numbers zero copy sends the same way
+        }
+        if ((size_t)result < bytes) {
+            return 0;               // The socket is full, EPOLLOUT says when it is not
+        }
+    }
+    return 1;
+}
+
+// Reads zero copy completions off the socket's error queue and frees the
+// chunks the kernel is done with.  If the kernel says it had to copy the
+// data anyway, which it always does over loopback, zero copy only costs
+// extra work, so this connection stops using it
+void conn_zerocopy_done(echo_conn_t *conn) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    out_chunk_t *chunk;
+    
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(conn->sockfd, &msg, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+        
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+            // Sends ee_info to ee_data are done, TCP completes them in order
+            conn->zc_done = serr->ee_data + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                conn->zerocopy = 0;
+            }
+        }
+    }
+    
+    while ((chunk = conn->zc_head) != NULL && (int32_t)(chunk->zc_id - conn->zc_done) < 0) {
+        conn->zc_head = chunk->next;
+        if (conn->zc_head == NULL) {
+            conn->zc_tail = NULL;
+        }
+        chunk_free(chunk);
+    }
+}
+
+// Handles every complete request a client has sent.  With edge triggered
+// epoll we are only told about new data once, so this keeps going until
+// the socket has nothing more, unless too much output piles up first.
+// Replies are only queued here, they are sent once per pass of the event
+// loop by conn_flush().  Returns 0 to keep the connection, -1 to close it
+int conn_handle_input(echo_conn_t *conn, int *server_should_exit) {
+    const uint8_t *msg;
+    uint32_t msg_len;
+    int result;
+    
+    while (conn->state == CONN_READING) {
+        // Stop taking requests until the client reads some replies
+        if (conn->out_queued >= OUT_HIGH_WATER) {
+            conn->state = CONN_WRITING;
+            break;
+        }
+        
+        // The message is used where it sits in the reader, never copied out
+        result = recv_pdu_inplace(&conn->reader, &msg, &msg_len);
+        if (result < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break; // Nothing more for now, epoll tells us when there is
+            }
+            if (errno == EMSGSIZE && frame_mode == FRAME_LEN32) {
+                // Too big to hold, echo it as it streams through instead
+                if (conn_start_stream(conn) < 0) {
+                    printf("Error streaming message from client %s.\n", conn->peer);
+                    return -1;
+                }
+                break;
+            }
+            printf("Error receiving message from client %s.\n", conn->peer);
+            return -1;
+        } else if (result == 0) {
+            printf("Client %s disconnected gracefully.\n", conn->peer);
+            conn->state = CONN_CLOSING; // Still send replies already queued
+            break;
+        }
+        
+        if (!server_quiet) {
+            printf("Received from client %s: \"%.*s\"\n", conn->peer, (int)msg_len, msg);
+        }
+        
+        // Check for exit server command
+        if (msg_len == EXIT_SERVER_CMD_LEN && memcmp(msg, EXIT_SERVER_CMD, msg_len) == 0) {
+            printf("Client %s requested server shutdown.\n", conn->peer);
+            conn_queue_pdu(conn, "echo: exit server - The server is exiting");
+            conn->state = CONN_CLOSING;
+            *server_should_exit = 1;
+            break;
+        }
+        
+        // Create echo response: "echo: original_message"
+        if (conn_queue_echo(conn, msg, msg_len) < 0) {
+            printf("Error queueing response to client %s.\n", conn->peer);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Runs the state machine for one connection when epoll reports it.  Output
+// is not sent here, the connection goes on the flush list instead
+void conn_handle_event(int epfd, echo_conn_t *conn, uint32_t events, int *server_should_exit) {
+    int sock_error = 0;
+    socklen_t len = sizeof(sock_error);
+    
+    // Zero copy completions are reported as errors, a real error is left
+    // in SO_ERROR
+    if (events & EPOLLERR) {
+        if (conn->zc_head != NULL) {
+            conn_zerocopy_done(conn);
+        }
+        if (getsockopt(conn->sockfd, SOL_SOCKET, SO_ERROR, &sock_error, &len) < 0 || sock_error != 0) {
+            printf("Error on connection to client %s.\n", conn->peer);
+            conn_close(epfd, conn);
+            return;
+        }
+    }
+    
+    if (conn->state == CONN_READING && conn_handle_input(conn, server_should_exit) < 0) {
+        conn_close(epfd, conn);
+        return;
+    }
+    
+    if (conn->state == CONN_CLOSING && conn->out_queued == 0) {
+        conn_close(epfd, conn);
+        return;
+    }
+    
+    // Something to send, or EPOLLOUT says there is room for what was left.
+    // A message streaming through needs both, so it always goes on the list
+    if ((conn->out_queued > 0 || conn->state == CONN_STREAMING) && !conn->flush_pending) {
+        conn->flush_pending = 1;
+        flush_list[flush_count++] = conn;
+    }
+}
+
+// Sends the output of every connection on the flush list, once per pass of
+// the event loop, so replies to all the requests read in this pass go out
+// together.  A connection that had stopped reading because its output was
+// full picks up where it left off once the output drains
+void flush_connections(int epfd, int *server_should_exit) {
+    for (int i = 0; i < flush_count; i++) {
+        echo_conn_t *conn = flush_list[i];
+        int result;
+        
+        conn->flush_pending = 0;
+        while (1) {
+            result = conn_flush(conn);
+            if (result < 0) {
+                break;
+            }
+            // Replies before a streamed message are out, it can go on
+            if (result == 1 && conn->state == CONN_STREAMING) {
+                result = conn_stream(conn);
+                if (result != 1) {
+                    break;
+                }
+                conn->state = CONN_READING;
+                if (conn_handle_input(conn, server_should_exit) < 0) {
+                    result = -1;
+                    break;
+                }
+                continue;
+            }
+            // The socket took it all so no EPOLLOUT is coming, read on now
+            if (result == 1 && conn->state == CONN_WRITING) {
+                conn->state = CONN_READING;
+                if (conn_handle_input(conn, server_should_exit) < 0) {
+                    result = -1;
+                    break;
+                }
+                continue;
+            }
+            break;
+        }
+        
+        if (result < 0) {
+            printf("Error sending response to client %s. Client may have disconnected.\n", conn->peer);
+            conn_close(epfd, conn);
+        } else if (conn->state == CONN_CLOSING && conn->out_queued == 0) {
+            conn_close(epfd, conn);
+        }
+    }
+    flush_count = 0;
+}
+
+// Accepts every client that is waiting, edge triggered epoll only tells us
+// once no matter how many there are
+void accept_clients(int epfd, int listen_sockfd) {
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len;
+    int client_sock;
+    
+    while (1) {
+        client_addr_len = sizeof(client_addr);
+        client_sock = accept4(listen_sockfd, (struct sockaddr*)&client_addr, &client_addr_len,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Error accepting connection");
+            }
+            return;
+        }
+        
+        echo_conn_t *conn = conn_open(epfd, client_sock, &client_addr);
+        if (conn == NULL) {
+            close(client_sock);
+            continue;
+        }
+        printf("Client connected from %s (%d connected)\n", conn->peer, server_conn_count);
+    }
+}
+
+void start_server(const char* addr, int port) {
+    int sockfd, epfd;
+    struct sockaddr_in server_addr;
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct rlimit fd_limit;
     int reuse = 1;
     int server_should_exit = 0;
+    int n;
+    
+    // Every client needs a file descriptor, allow as many as we are permitted
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max) {
+        fd_limit.rlim_cur = fd_limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fd_limit);
+    }
     
     // Create TCP socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sockfd < 0) {
         perror("Error creating socket");
         exit(EXIT_FAILURE);
@@ -252,84 +972,59 @@ void start_server(const char* addr, int port) {
         exit(EXIT_FAILURE);
     }
     
+    // One epoll instance watches the listening socket and every client
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("Error creating epoll instance");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; // NULL marks the listening socket
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+        perror("Error adding socket to epoll");
+        close(epfd);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    
     printf("Server listening on %s:%d\n", addr, port);
-    printf("Server will handle multiple clients sequentially.\n");
+    printf("Server will handle many clients at the same time.\n");
     printf("Send 'exit server' from any client to shutdown the server.\n");
     printf("Press Ctrl+C to stop server immediately.\n\n");
     
-    // Main server loop - handle multiple clients
+    // Main server loop - one thread, epoll tells us which clients are ready
     while (!server_should_exit) {
-        printf("Waiting for client connection...\n");
-        
-        // Accept client connection
-        client_sock = accept(sockfd, (struct sockaddr*)&client_addr, &client_addr_len);
-        if (client_sock < 0) {
-            perror("Error accepting connection");
-            continue; // Try to accept next connection
+        n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for events");
+            break;
         }
         
-        client_sockfd = client_sock; // For signal handler
-        
-        // Get client IP address for logging
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        printf("Client connected from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
-        printf("Server ready to process messages from this client...\n");
-        
-        // Client communication loop
-        while (1) {
-            // Receive PDU from client
-            pdu_len = recv_pdu(client_sock, extracted_msg, sizeof(extracted_msg));
-            
-            if (pdu_len < 0) {
-                printf("Error receiving message from client.\n");
-                break; // Close this client, wait for next one
-            } else if (pdu_len == 0) {
-                printf("Client disconnected gracefully.\n");
-                break; // Close this client, wait for next one
-            }
-            
-            printf("Received from client: \"%s\"\n", extracted_msg);
-            
-            // Check for exit server command
-            if (strcmp(extracted_msg, "exit server") == 0) {
-                printf("Client requested server shutdown.\n");
-                
-                // Send shutdown response
-                strcpy(response_msg, "echo: exit server - The server is exiting");
-                if (send_pdu(client_sock, response_msg) < 0) {
-                    perror("Error sending shutdown response");
-                } else {
-                    printf("Sent shutdown message to client: \"%s\"\n", response_msg);
-                }
-                
-                server_should_exit = 1; // Signal to exit main server loop
-                break; // Break out of client loop
-            }
-            
-            // Create echo response: "echo: original_message"
-            snprintf(response_msg, sizeof(response_msg), "echo: %.500s", extracted_msg);
-            
-            // Send response PDU back to client
-            if (send_pdu(client_sock, response_msg) < 0) {
-                printf("Error sending response to client. Client may have disconnected.\n");
-                break; // Close this client, wait for next one
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_clients(epfd, sockfd);
+            } else {
+                conn_handle_event(epfd, events[i].data.ptr, events[i].events, &server_should_exit);
             }
-            
-            printf("Sent to client: \"%s\"\n", response_msg);
-            printf("---\n");
         }
         
-        // Close current client connection
-        close(client_sock);
-        client_sockfd = -1;
-        printf("Client connection closed.\n");
-        
-        if (!server_should_exit) {
-            printf("Ready for next client connection.\n\n");
-        }
+        // Now send everything the events above queued up
+        flush_connections(epfd, &server_should_exit);
+    }
+    
+    // Shutting down, give every client what is already queued for it, then
+    // close them all.  The reply to "exit server" went out with the last flush
+    while (server_conns != NULL) {
+        conn_flush(server_conns);
+        conn_close(epfd, server_conns);
     }
     
     // Clean up server socket
+    close(epfd);
     close(sockfd);
     server_sockfd = -1;
     printf("Server shutdown complete.\n");
@@ -353,7 +1048,16 @@ ssize_t send_all(int sockfd, const char* buffer, size_t length) {
 
 // Send a message as a PDU
 ssize_t send_pdu(int sockfd, const char *message) {
-    int pdu_len = netmsg_from_cstr(message, (uint8_t*)send_buffer, BUFFER_SIZE);
+    size_t msg_len = strlen(message);
+    int pdu_len = -1;
+    
+    if (frame_mode == FRAME_LEN16) {
+        pdu_len = netmsg_from_cstr(message, (uint8_t*)send_buffer, BUFFER_SIZE);
+    } else if (pdu_hdr_len() + msg_len <= BUFFER_SIZE) {
+        size_t hdr_len = pdu_put_len((uint8_t*)send_buffer, msg_len);
+        memcpy(send_buffer + hdr_len, message, msg_len);
+        pdu_len = hdr_len + msg_len;
+    }
     if (pdu_len < 0) {
         fprintf(stderr, "Error: Message too long for buffer\n");
         return -1;
@@ -363,51 +1067,66 @@ ssize_t send_pdu(int sockfd, const char *message) {
 }
 
 // Receive a PDU and extract the message
+// PDUs are read through pdu_reader, which reads as much as the socket has
+// in one call and splits it into PDUs, so a message usually costs a single
+// recv instead of one for the length and more for the data
 ssize_t recv_pdu(int sockfd, char *message, size_t max_length) {
-    // First, receive the length field (2 bytes)
-    uint16_t net_msg_len;
-    size_t bytes_received = 0;
-    ssize_t result;
-    
-    // Receive length field
-    while (bytes_received < sizeof(net_msg_len)) {
-        result = recv(sockfd, ((char*)&net_msg_len) + bytes_received, 
-                     sizeof(net_msg_len) - bytes_received, 0);
-        if (result <= 0) {
-            return result; // Error or connection closed
-        }
-        bytes_received += result;
+    // A reader only ever belongs to one connection
+    if (pdu_reader.sock != sockfd) {
+        frame_reader_init(&pdu_reader, sockfd, frame_mode, 0);
     }
     
-    // Convert length from network byte order
-    uint16_t msg_len = ntohs(net_msg_len);
-    
-    // Validate message length
-    if (msg_len > MAX_MSG_DATA_SIZE) {
-        fprintf(stderr, "Error: Message length %u exceeds maximum %zu\n", 
-                msg_len, (size_t)MAX_MSG_DATA_SIZE);
-        return -1;
-    }
+    return recv_pdu_from(&pdu_reader, message, max_length);
+}
+
+// Receive the next PDU from a connection's reader and extract the message
+// On a non blocking socket this fails with errno EAGAIN when no whole PDU
+// has arrived yet
+ssize_t recv_pdu_from(frame_reader_t *reader, char *message, size_t max_length) {
+    const uint8_t *msg_data;
+    uint32_t msg_len;
+    int result;
     
-    // Receive the message data
-    bytes_received = 0;
-    while (bytes_received < msg_len) {
-        result = recv(sockfd, recv_buffer + bytes_received, 
-                     msg_len - bytes_received, 0);
-        if (result <= 0) {
-            return result; // Error or connection closed
-        }
-        bytes_received += result;
+    result = recv_pdu_inplace(reader, &msg_data, &msg_len);
+    if (result <= 0) {
+        return result; // Error or connection closed
     }
     
     // Extract message and null-terminate
     size_t copy_len = (msg_len < max_length - 1) ? msg_len : max_length - 1;
-    memcpy(message, recv_buffer, copy_len);
+    memcpy(message, msg_data, copy_len);
     message[copy_len] = '\0';
     
     return copy_len;
 }
 
+// Receive the next PDU from a connection's reader without copying it
+// The reader pulls whatever the socket has with one recv, which often holds
+// many PDUs, and each call hands out the next one from its buffer.  *msg
+// points at the message data in the reader and stays valid until the next
+// call.  Returns 1 with *msg and *msg_len set, 0 if the connection closed
+// or -1 on an error, errno is EAGAIN when no whole PDU has arrived yet
+int recv_pdu_inplace(frame_reader_t *reader, const uint8_t **msg, uint32_t *msg_len) {
+    uint8_t *msg_data;
+    int result;
+    
+    result = frame_reader_next(reader, &msg_data, msg_len);
+    if (result <= 0) {
+        return result; // Error or connection closed
+    }
+    
+    // Validate message length, 32 bit framing is only limited by the reader
+    if (reader->mode == FRAME_LEN16 && *msg_len > MAX_MSG_DATA_SIZE) {
+        fprintf(stderr, "Error: Message length %u exceeds maximum %zu\n", 
+                *msg_len, (size_t)MAX_MSG_DATA_SIZE);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    
+    *msg = msg_data;
+    return 1;
+}
+
 void signal_handler(int sig) {
     printf("\nReceived signal %d, shutting down gracefully...\n", sig);
     
@@ -442,6 +1161,18 @@ void print_usage(const char* program_name) {
     printf("  --client              Run in client mode\n");
     printf("  --server              Run in server mode\n");
     printf("  --port <port>         Port number (default: %d)\n", DEFAULT_PORT);
+    printf("  --zerocopy            Server: send large batches of replies with MSG_ZEROCOPY\n");
+    printf("  --quiet               Server: don't log every message\n");
+    printf("  --frame32             Use a 32 bit PDU length, for messages up to %u bytes\n",
+           MAX_BULK_MSG_SIZE);
+    printf("  --bench               Client: measure the server instead of the prompt\n");
+    printf("  --conns <n>           Bench: connections to open (default: %d)\n", BENCH_DEFAULT_CONNS);
+    printf("  --depth <n>           Bench: messages in flight per connection (default: %d)\n",
+           BENCH_DEFAULT_DEPTH);
+    printf("  --size <n|min-max>    Bench: payload bytes, up to %zu (default: %d)\n",
+           MAX_MSG_DATA_SIZE, BENCH_DEFAULT_SIZE);
+    printf("                        or up to %u with --frame32\n", MAX_BULK_MSG_SIZE);
+    printf("  --duration <s>        Bench: seconds to run (default: %d)\n", BENCH_DEFAULT_DURATION);
     printf("  --addr <address>      IP address\n");
     printf("                        Client: server address (default: %s)\n", DEFAULT_CLIENT_ADDR);
     printf("                        Server: bind address (default: %s)\n", DEFAULT_SERVER_ADDR);
@@ -453,9 +1184,11 @@ void print_usage(const char* program_name) {
     printf("    Ctrl+C        - Exit client immediately\n");
     printf("\nNetwork Protocol:\n");
     printf("  Uses PDU format: [2-byte length][message data]\n");
+    printf("  or [4-byte length][message data] with --frame32, both sides must agree\n");
     printf("  Length is in network byte order (big-endian)\n");
     printf("  Same protocol as UDP version for consistency\n");
     printf("\nServer Features:\n");
+    printf("  - Serves many clients at once with epoll\n");
     printf("  - Detects client disconnection automatically\n");
     printf("  - Handles 'exit server' command gracefully\n");
     printf("  - Uses SO_REUSEADDR for development convenience\n");
@@ -464,6 +1197,7 @@ void print_usage(const char* program_name) {
     printf("  %s --server --port 8080 --addr 192.168.1.100\n", program_name);
     printf("  %s --client\n", program_name);
     printf("  %s --client --port 8080 --addr 192.168.1.100\n", program_name);
+    printf("  %s --client --bench --conns 64 --depth 16 --size 16-1000\n", program_name);
 }
 
 // Helper function to create a network message PDU from a C string
@@ -493,6 +1227,25 @@ int netmsg_from_cstr(const char *msg_str, uint8_t *msg_buff, uint16_t msg_buff_s
     return total_len;
 }
 
+// Size of the length at the start of a PDU in the framing in use
+size_t pdu_hdr_len(void) {
+    return (frame_mode == FRAME_LEN32) ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+// Writes the length of a PDU in network byte order at its start, in the
+// framing in use.  Returns how many bytes that took
+size_t pdu_put_len(uint8_t *pdu, uint32_t msg_len) {
+    // Copied since pdu need not be aligned
+    if (frame_mode == FRAME_LEN32) {
+        uint32_t net_len = htonl(msg_len);
+        memcpy(pdu, &net_len, sizeof(net_len));
+        return sizeof(net_len);
+    }
+    uint16_t net_len = htons(msg_len);
+    memcpy(pdu, &net_len, sizeof(net_len));
+    return sizeof(net_len);
+}
+
 // Helper function to extract message data from a received PDU
 // Returns 0 on success, -1 on error
 int extract_msg_data(const uint8_t *pdu_buff, uint16_t pdu_len, char *msg_str, uint16_t max_str_len) {
@@ -3,13 +3,35 @@
 
 #include<stdint.h>          //for uint types
 #include<unistd.h>          //for ssize_t
+#include<netinet/in.h>      //for INET_ADDRSTRLEN
+
+#include "frame-reader.h"
 
 #define BUFFER_SIZE 1024
 #define DEFAULT_PORT 1234
 #define DEFAULT_CLIENT_ADDR "127.0.0.1"
 #define DEFAULT_SERVER_ADDR "0.0.0.0"
-#define BACKLOG 5
+#define BACKLOG 4096        // The kernel caps this at net.core.somaxconn
 #define MAX_MSG_DATA_SIZE (BUFFER_SIZE - sizeof(uint16_t))
+#define OUT_CHUNK_SIZE 16384     // Replies are queued in chunks this big
+#define OUT_HIGH_WATER (4 * OUT_CHUNK_SIZE) // Stop reading with this much queued
+#define MAX_FREE_CHUNKS 256
+#define FLUSH_IOV_MAX 64        // Chunks sent by one sendmsg()
+#define ZEROCOPY_MIN_BYTES 16384 // Zero copy only pays off for big sends
+#define ECHO_PREFIX "echo: "
+#define ECHO_PREFIX_LEN (sizeof(ECHO_PREFIX) - 1)
+#define MAX_ECHO_DATA_SIZE 500  // Longest message echoed back
+#define EXIT_SERVER_CMD "exit server"
+#define EXIT_SERVER_CMD_LEN (sizeof(EXIT_SERVER_CMD) - 1)
+#define MAX_EVENTS 256      // Events taken per epoll_wait() call
+#define MAX_BULK_MSG_SIZE (UINT32_MAX - 64) // --frame32 limit, leaves room for the prefix
+#define STREAM_PIPE_SIZE 65536  // Bytes moved per splice(), the default pipe size
+#define BENCH_DEFAULT_CONNS 16
+#define BENCH_DEFAULT_DEPTH 8
+#define BENCH_DEFAULT_SIZE 64
+#define BENCH_DEFAULT_DURATION 5
+#define BENCH_PAYLOAD_BUFFER_SIZE 65536
+#define BENCH_IOV_MAX 64
 
 // PDU structure for network messages (same as UDP version)
 typedef struct {
@@ -17,17 +39,104 @@ typedef struct {
     uint8_t  msg_data[1]; // Variable length message data (use as flexible array)
 } echo_pdu_t;
 
+// Where a server connection is in its life
+typedef enum {
+    CONN_READING,   // Reading requests and queueing replies
+    CONN_WRITING,   // Output is full, waiting for the client to read it
+    CONN_STREAMING, // Echoing a big message as it arrives
+    CONN_CLOSING    // Sending what is left, then closing
+} conn_state_t;
+
+// A piece of a connection's output queue
+typedef struct out_chunk {
+    struct out_chunk *next;
+    size_t start;                       // First byte not sent yet
+    size_t len;                         // Bytes queued in data
+    int zc_used;                        // Sent with MSG_ZEROCOPY ...
+    uint32_t zc_id;                     // ... by this send, the last one
+    uint8_t data[OUT_CHUNK_SIZE];
+} out_chunk_t;
+
+// Server side state for one client connection
+typedef struct echo_conn {
+    int sockfd;
+    conn_state_t state;
+    char peer[INET_ADDRSTRLEN + 8];     // "ip:port" for logging
+    frame_reader_t reader;              // Requests not handled yet
+    out_chunk_t *out_head;              // Replies not sent yet
+    out_chunk_t *out_tail;
+    size_t out_queued;
+    out_chunk_t *zc_head;               // Sent, waiting for the kernel to
+    out_chunk_t *zc_tail;               // finish a zero copy send
+    uint32_t zc_next_id;                // Number of the next zero copy send
+    uint32_t zc_done;                   // Zero copy sends before this are done
+    int zerocopy;                       // Using MSG_ZEROCOPY
+    int flush_pending;                  // On the flush list
+    uint32_t stream_left;               // Bytes of a streamed message not read yet
+    int pipe_fds[2];                    // For splice(), -1 until first needed
+    size_t pipe_len;                    // Bytes in the pipe not sent yet
+    struct echo_conn *prev;             // All connections, for shutdown
+    struct echo_conn *next;
+} echo_conn_t;
+
+// What --bench does
+typedef struct {
+    int conns;                          // Connections to the server
+    int depth;                          // Requests in flight per connection
+    uint32_t min_size;                  // Payload size range, in bytes
+    uint32_t max_size;
+    int duration;                       // Seconds to run
+} bench_opts_t;
+
+// Client side state for one benchmark connection
+typedef struct {
+    int sockfd;
+    int open;
+    frame_reader_t reader;              // Replies not handled yet
+    uint32_t skip_left;                 // Bytes of a big reply to throw away
+    uint64_t *sent_at;                  // When each request in flight was
+    uint32_t *sizes;                    // queued and its size, a ring of
+    int first_in_flight;                // depth entries
+    int in_flight;
+    int unsent;                         // The last of them not all sent yet
+    uint64_t send_offset;               // Bytes of the first of those sent
+} bench_conn_t;
+
+extern int frame_mode;
+
 // Function prototypes
 void start_client(const char* addr, int port);
 void start_server(const char* addr, int port);
+void start_bench(const char* addr, int port, const bench_opts_t *opts);
 void print_usage(const char* program_name);
 void signal_handler(int sig);
 void client_signal_handler(int sig);
 ssize_t send_all(int sockfd, const char* buffer, size_t length);
+size_t pdu_hdr_len(void);
+size_t pdu_put_len(uint8_t *pdu, uint32_t msg_len);
 int netmsg_from_cstr(const char *msg_str, uint8_t *msg_buff, uint16_t msg_buff_sz);
 int extract_msg_data(const uint8_t *pdu_buff, uint16_t pdu_len, char *msg_str, uint16_t max_str_len);
 ssize_t recv_pdu(int sockfd, char *buffer, size_t max_length);
+ssize_t recv_pdu_from(frame_reader_t *reader, char *message, size_t max_length);
+int recv_pdu_inplace(frame_reader_t *reader, const uint8_t **msg, uint32_t *msg_len);
 ssize_t send_pdu(int sockfd, const char *message);
+out_chunk_t *chunk_alloc(void);
+void chunk_free(out_chunk_t *chunk);
+echo_conn_t *conn_open(int epfd, int sockfd, const struct sockaddr_in *peer_addr);
+void conn_close(int epfd, echo_conn_t *conn);
+uint8_t *conn_out_reserve(echo_conn_t *conn, size_t len);
+void conn_out_commit(echo_conn_t *conn, size_t len);
+int conn_queue_pdu(echo_conn_t *conn, const char *message);
+int conn_queue_echo(echo_conn_t *conn, const uint8_t *msg, uint32_t msg_len);
+int conn_start_stream(echo_conn_t *conn);
+int conn_stream(echo_conn_t *conn);
+void conn_out_consume(echo_conn_t *conn, size_t sent, int zerocopy, uint32_t zc_id);
+int conn_flush(echo_conn_t *conn);
+void conn_zerocopy_done(echo_conn_t *conn);
+int conn_handle_input(echo_conn_t *conn, int *server_should_exit);
+void conn_handle_event(int epfd, echo_conn_t *conn, uint32_t events, int *server_should_exit);
+void flush_connections(int epfd, int *server_should_exit);
+void accept_clients(int epfd, int listen_sockfd);
 
 
 #endif
\ No newline at end of file
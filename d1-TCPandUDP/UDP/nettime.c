@@ -0,0 +1,220 @@
+#define _GNU_SOURCE     //for CLOCK_MONOTONIC_RAW and SO_TIMESTAMPNS
+
+#include "nettime.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t clock_ns(clockid_t clock){
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//Now on the raw monotonic clock, for timing intervals
+uint64_t nettime_now_ns(void){
+    return clock_ns(CLOCK_MONOTONIC_RAW);
+}
+
+void nettime_ref(nettime_ref_t *ref){
+    ref->raw = clock_ns(CLOCK_MONOTONIC_RAW);
+    ref->real = clock_ns(CLOCK_REALTIME);
+}
+
+/*
+ *  Asks the kernel to stamp everything sock receives with when it arrived,
+ *  recvmsg() then returns the stamp as a control message.  Returns 0 on
+ *  success or -1 if the socket does not support it
+ */
+int nettime_enable_rx(int sock){
+    int on = 1;
+
+#ifdef SO_TIMESTAMPNS
+    return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#else
+    return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#endif
+}
+
+/*
+ *  Finds the receive stamp in the control messages recvmsg() filled in.
+ *  Sets *ns to the wall clock time in ns and returns 0, or returns -1 if
+ *  there is no stamp
+ */
+int nettime_rx_real_ns(struct msghdr *msg, uint64_t *ns){
+    struct cmsghdr *cm;
+
+    if (msg->msg_controllen == 0)
+        return -1;
+    for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET)
+            continue;
+#ifdef SCM_TIMESTAMPNS
+        if (cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            *ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            return 0;
+        }
+#endif
+        if (cm->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cm), sizeof(tv));
+            *ns = (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ *  When what recvmsg() returned arrived, on the raw clock.  ref is a clock
+ *  reading taken after recvmsg() returned, the stamp is that much older
+ *  than ref->real.  Without a stamp, or if the wall clock was stepped in
+ *  between, it is ref->raw
+ */
+uint64_t nettime_rx_ns(const nettime_ref_t *ref, struct msghdr *msg){
+    uint64_t rx_real;
+
+    if (nettime_rx_real_ns(msg, &rx_real) < 0 || rx_real > ref->real)
+        return ref->raw;
+    if (ref->real - rx_real > ref->raw)
+        return ref->raw;
+    return ref->raw - (ref->real - rx_real);
+}
+
+/*
+ *  Bucket for a value.  Below NETTIME_HIST_SUB every value has its own,
+ *  above that the top NETTIME_HIST_SUB_BITS + 1 bits pick one of
+ *  NETTIME_HIST_SUB buckets in the value's power of two
+ */
+static int hist_index(uint64_t v){
+    int top, shift;
+
+    if (v < NETTIME_HIST_SUB)
+        return (int)v;
+    top = 63 - __builtin_clzll(v);
+    if (top >= NETTIME_HIST_MAX_BITS)
+        return NETTIME_HIST_BUCKETS - 1;
+    shift = top - NETTIME_HIST_SUB_BITS;
+    return ((shift + 1) << NETTIME_HIST_SUB_BITS) + (int)((v >> shift) - NETTIME_HIST_SUB);
+}
+
+//The biggest value that goes in bucket i
+static uint64_t hist_value(int i){
+    int shift;
+    uint64_t top;
+
+    if (i < NETTIME_HIST_SUB)
+        return i;
+    shift = (i >> NETTIME_HIST_SUB_BITS) - 1;
+    top = (uint64_t)(i & (NETTIME_HIST_SUB - 1)) + NETTIME_HIST_SUB;
+    return ((top + 1) << shift) - 1;
+}
+
+void nettime_hist_init(nettime_hist_t *h){
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+/*
+ *  Counts one value.  Every field is updated with an atomic operation, so
+ *  threads can record into the same histogram without a lock
+ */
+void nettime_hist_record(nettime_hist_t *h, uint64_t ns){
+    uint64_t seen;
+
+    __atomic_fetch_add(&h->counts[hist_index(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+
+    seen = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (ns < seen && !__atomic_compare_exchange_n(&h->min, &seen, ns, 1,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    seen = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ns > seen && !__atomic_compare_exchange_n(&h->max, &seen, ns, 1,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+//Adds src into dst, for histograms kept apart to keep threads off each other's cache lines
+void nettime_hist_merge(nettime_hist_t *dst, const nettime_hist_t *src){
+    for (int i = 0; i < NETTIME_HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/*
+ *  The value p percent of the recorded ones are at or below.  It is the
+ *  top of the bucket that holds it, so never under the real value, and
+ *  never over the biggest value recorded
+ */
+uint64_t nettime_hist_percentile(const nettime_hist_t *h, double p){
+    uint64_t wanted = (uint64_t)(h->total * p / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (h->total == 0)
+        return 0;
+    if (wanted == 0)
+        wanted = 1;
+    for (int i = 0; i < NETTIME_HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= wanted)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+/*
+ *  Prints the round trip summary and a bar for every power of two of
+ *  microseconds that has anything in it
+ */
+void nettime_hist_print(const nettime_hist_t *h, FILE *out){
+    uint64_t rows[NETTIME_HIST_MAX_BITS] = {0};
+    uint64_t most = 0;
+
+    if (h->total == 0)
+        return;
+
+    fprintf(out, "Round trip:   min %.1f us, avg %.1f us, max %.1f us\n", h->min / 1000.0,
+            h->sum / 1000.0 / h->total, h->max / 1000.0);
+    fprintf(out, "              p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+            nettime_hist_percentile(h, 50) / 1000.0, nettime_hist_percentile(h, 90) / 1000.0,
+            nettime_hist_percentile(h, 99) / 1000.0, nettime_hist_percentile(h, 99.9) / 1000.0);
+
+    //Row r holds times from 2^(r-1) up to 2^r microseconds
+    for (int i = 0; i < NETTIME_HIST_BUCKETS; i++) {
+        uint64_t us = hist_value(i) / 1000;
+        int r = 0;
+
+        if (h->counts[i] == 0)
+            continue;
+        while (us > 0 && r < NETTIME_HIST_MAX_BITS - 1) {
+            us >>= 1;
+            r++;
+        }
+        rows[r] += h->counts[i];
+        if (rows[r] > most)
+            most = rows[r];
+    }
+    for (int r = 0; r < NETTIME_HIST_MAX_BITS; r++) {
+        int bar;
+
+        if (rows[r] == 0)
+            continue;
+        bar = (int)(40 * rows[r] / most);
+        fprintf(out, "  %8llu - %8llu us %10llu %.*s\n",
+                r == 0 ? 0ULL : 1ULL << (r - 1), 1ULL << r,
+                (unsigned long long)rows[r], bar > 0 ? bar : 1,
+                "########################################");
+    }
+}
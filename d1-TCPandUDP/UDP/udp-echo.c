@@ -1,11 +1,15 @@
+#define _GNU_SOURCE     // for recvmmsg() and sendmmsg()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <errno.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "udp-echo.h"
 
@@ -15,11 +19,22 @@
 char send_buffer[BUFFER_SIZE];
 char recv_buffer[BUFFER_SIZE];
 
+// Log every datagram the server handles (--verbose)
+int verbose = 0;
+
+// Set by the worker that gets "exit", the others see it within a receive
+// timeout
+int server_exiting = 0;
+
 
 int main(int argc, char* argv[]) {
     int is_client = 0;
     int is_server = 0;
     int port = DEFAULT_PORT;
+    int workers = 0;
+    int is_load = 0;
+    load_opts_t load = {LOAD_DEFAULT_RATE, LOAD_DEFAULT_THREADS, LOAD_DEFAULT_SIZE,
+                        LOAD_DEFAULT_DURATION};
     char addr[INET_ADDRSTRLEN] = {0};
     char message[BUFFER_SIZE] = DEFAULT_CLIENT_MESSAGE;
     char prefix[BUFFER_SIZE] = DEFAULT_SERVER_PREFIX;
@@ -43,6 +58,33 @@ int main(int argc, char* argv[]) {
                 fprintf(stderr, "Error: --port requires a value\n");
                 exit(EXIT_FAILURE);
             }
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+                workers = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: --workers requires a positive value\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--load") == 0) {
+            is_load = 1;
+        } else if (strcmp(argv[i], "--rate") == 0 || strcmp(argv[i], "--threads") == 0 ||
+                   strcmp(argv[i], "--size") == 0 || strcmp(argv[i], "--duration") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+                fprintf(stderr, "Error: %s requires a value\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            int value = atoi(argv[++i]);
+            if (strcmp(argv[i - 1], "--rate") == 0) {
+                load.rate = value;
+            } else if (strcmp(argv[i - 1], "--threads") == 0) {
+                load.threads = value;
+            } else if (strcmp(argv[i - 1], "--size") == 0) {
+                load.size = value;
+            } else {
+                load.duration = value;
+            }
         } else if (strcmp(argv[i], "--addr") == 0) {
             if (i + 1 < argc) {
                 strncpy(addr, argv[++i], sizeof(addr) - 1);
@@ -76,6 +118,20 @@ int main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
     }
     
+    if (is_load && !is_client) {
+        fprintf(stderr, "Error: --load is a client mode\n");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    
+    // The whole message has to come back for its sequence number and time
+    if (load.size < LOAD_FIELDS_LEN || load.size > MAX_ECHO_PART_SIZE ||
+        load.threads < 1 || load.duration < 1) {
+        fprintf(stderr, "Error: --size must be %d to %d, --threads and --duration at least 1\n",
+                LOAD_FIELDS_LEN, MAX_ECHO_PART_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    
     // Set default address if not specified
     if (strlen(addr) == 0) {
         if (is_client) {
@@ -86,14 +142,16 @@ int main(int argc, char* argv[]) {
     }
     
     // Start client or server
-    if (is_client) {
+    if (is_load) {
+        start_load(addr, port, &load);
+    } else if (is_client) {
         printf("Starting UDP client: connecting to %s:%d, message: \"%s\"\n", 
                addr, port, message);
         start_client(addr, port, message);
     } else {
         printf("Starting UDP server: binding to %s:%d, prefix: \"%s\"\n", 
                addr, port, prefix);
-        start_server(addr, port, prefix);
+        start_server(addr, port, prefix, workers);
     }
     
     return 0;
@@ -102,9 +160,14 @@ int main(int argc, char* argv[]) {
 void start_client(const char* addr, int port, const char* message) {
     int sockfd;
     struct sockaddr_in server_addr;
-    socklen_t addr_len = sizeof(server_addr);
     ssize_t bytes_sent, bytes_received;
-    char extracted_msg[BUFFER_SIZE];
+    const uint8_t *reply_msg;
+    uint16_t reply_len;
+    struct msghdr reply;
+    struct iovec reply_iov;
+    nettime_cmsg_t control;
+    nettime_ref_t ref;
+    uint64_t sent_at, rx_ns;
     
     // Create UDP socket
     sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -124,6 +187,12 @@ void start_client(const char* addr, int port, const char* message) {
         exit(EXIT_FAILURE);
     }
     
+    // The kernel stamps the reply as it arrives, so the round trip does
+    // not include how long we took to get scheduled and read it
+    if (nettime_enable_rx(sockfd) < 0) {
+        perror("Warning: no receive timestamps");
+    }
+    
     // Create PDU from message string
     int pdu_len = netmsg_from_cstr(message, (uint8_t*)send_buffer, BUFFER_SIZE);
     if (pdu_len < 0) {
@@ -133,6 +202,7 @@ void start_client(const char* addr, int port, const char* message) {
     }
     
     // Send PDU to server
+    sent_at = nettime_now_ns();
     bytes_sent = sendto(sockfd, send_buffer, pdu_len, 0,
                        (struct sockaddr*)&server_addr, sizeof(server_addr));
     if (bytes_sent < 0) {
@@ -143,35 +213,47 @@ void start_client(const char* addr, int port, const char* message) {
     
     printf("Sent %zd bytes to server (PDU with message: \"%s\")\n", bytes_sent, message);
     
-    // Receive response PDU from server
-    bytes_received = recvfrom(sockfd, recv_buffer, BUFFER_SIZE, 0,
-                             (struct sockaddr*)&server_addr, &addr_len);
+    // Receive response PDU from server, with its receive timestamp
+    reply_iov.iov_base = recv_buffer;
+    reply_iov.iov_len = BUFFER_SIZE;
+    memset(&reply, 0, sizeof(reply));
+    reply.msg_name = &server_addr;
+    reply.msg_namelen = sizeof(server_addr);
+    reply.msg_iov = &reply_iov;
+    reply.msg_iovlen = 1;
+    reply.msg_control = control.buf;
+    reply.msg_controllen = sizeof(control.buf);
+    bytes_received = recvmsg(sockfd, &reply, 0);
     if (bytes_received < 0) {
         perror("Error receiving response");
         close(sockfd);
         exit(EXIT_FAILURE);
     }
+    nettime_ref(&ref);
+    rx_ns = nettime_rx_ns(&ref, &reply);
     
-    // Extract message from received PDU
-    if (extract_msg_data((uint8_t*)recv_buffer, bytes_received, extracted_msg, sizeof(extracted_msg)) < 0) {
+    // Find the message in the received PDU, it is printed from where it is
+    if (pdu_view((uint8_t*)recv_buffer, bytes_received, &reply_msg, &reply_len) < 0) {
         fprintf(stderr, "Error: Invalid PDU received\n");
         close(sockfd);
         exit(EXIT_FAILURE);
     }
     
-    printf("Received %zd bytes from server (message: \"%s\")\n", bytes_received, extracted_msg);
+    printf("Received %zd bytes from server (message: \"%.*s\")\n", bytes_received, reply_len,
+           (const char*)reply_msg);
+    printf("Round trip: %.1f us\n", rx_ns > sent_at ? (rx_ns - sent_at) / 1000.0 : 0.0);
     
     close(sockfd);
 }
 
-void start_server(const char* addr, int port, const char* prefix) {
+// Creates a server socket bound to addr:port.  Every worker has its own,
+// SO_REUSEPORT lets them all bind the same port and the kernel hashes each
+// client to one of them, so the workers never share a socket or a lock.
+// A receive timeout lets a worker notice when another one got "exit"
+int open_server_socket(const char* addr, int port) {
     int sockfd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    ssize_t bytes_received, bytes_sent;
-    char client_ip[INET_ADDRSTRLEN];
-    char extracted_msg[BUFFER_SIZE];
-    char response_msg[BUFFER_SIZE];
+    struct sockaddr_in server_addr;
+    struct timeval timeout = {0, UDP_EXIT_POLL_MS * 1000};
     int reuse = 1;
     
     // Create UDP socket
@@ -186,6 +268,12 @@ void start_server(const char* addr, int port, const char* prefix) {
         perror("Warning: Could not set SO_REUSEADDR");
         // Continue anyway - this is not a fatal error
     }
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        perror("Error setting SO_REUSEPORT");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     
     // Configure server address
     memset(&server_addr, 0, sizeof(server_addr));
@@ -209,81 +297,206 @@ void start_server(const char* addr, int port, const char* prefix) {
         exit(EXIT_FAILURE);
     }
     
-    printf("Server listening on %s:%d\n", addr, port);
-    printf("Waiting for client messages... (Press Ctrl+C to stop)\n");
+    return sockfd;
+}
+
+// Turns a request PDU into its response where it lies.  The request sits
+// UDP_HEADROOM bytes into its buffer, so the prefix, ": " and a new length
+// are written into the space in front of the message and the message
+// itself never moves.  Like the rest of the protocol this works on bytes,
+// a message can hold anything, even '\0'.  Returns the response length and
+// sets *response, or -1 if the request is not a valid PDU
+int build_echo_response(uint8_t *request, size_t request_len, const char *prefix,
+                        size_t prefix_len, uint8_t **response) {
+    const uint8_t *data;
+    uint16_t msg_len;
+    
+    if (pdu_view(request, request_len, &data, &msg_len) < 0) {
+        return -1;
+    }
     
-    // Server loop
-    while (1) {
-        // Receive PDU from client
-        bytes_received = recvfrom(sockfd, recv_buffer, BUFFER_SIZE, 0,
-                                 (struct sockaddr*)&client_addr, &client_addr_len);
-        
-        if (bytes_received < 0) {
-            perror("Error receiving message");
+    // Same limits as "%.500s: %.500s"
+    if (msg_len > MAX_ECHO_PART_SIZE) {
+        msg_len = MAX_ECHO_PART_SIZE;
+    }
+    
+    uint8_t *msg = request + sizeof(uint16_t);
+    uint8_t *pdu = msg - ECHO_SEPARATOR_LEN - prefix_len - sizeof(uint16_t);
+    
+    pdu_put_header(pdu, prefix_len + ECHO_SEPARATOR_LEN + msg_len);
+    memcpy(pdu + sizeof(uint16_t), prefix, prefix_len);
+    memcpy(msg - ECHO_SEPARATOR_LEN, ECHO_SEPARATOR, ECHO_SEPARATOR_LEN);
+    
+    *response = pdu;
+    return sizeof(uint16_t) + prefix_len + ECHO_SEPARATOR_LEN + msg_len;
+}
+
+// Sends the first count messages of batch, retrying the rest if the socket
+// takes only some of them.  A datagram that cannot be sent is dropped,
+// UDP would lose it somewhere else just the same
+void send_batch(int sockfd, struct mmsghdr *batch, int count) {
+    int sent = 0;
+    
+    while (sent < count) {
+        int result = sendmmsg(sockfd, batch + sent, count - sent, 0);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error sending responses");
+            sent++;         // Skip the one that failed
             continue;
         }
+        sent += result;
+    }
+}
+
+// One server worker.  Each loop takes up to UDP_BATCH datagrams with one
+// recvmmsg() call, turns every request into its response in place and
+// sends them all back with one sendmmsg(), so a busy server makes two
+// system calls per batch instead of two per datagram
+void *server_worker(void *arg) {
+    udp_worker_t *worker = arg;
+    udp_batch_t *b;
+    char client_ip[INET_ADDRSTRLEN];
+    
+    b = malloc(sizeof(udp_batch_t));
+    if (b == NULL) {
+        perror("Error allocating buffers");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Requests land UDP_HEADROOM bytes in, leaving room for the prefix
+    for (int i = 0; i < UDP_BATCH; i++) {
+        b->in_iov[i].iov_base = b->buffers[i] + UDP_HEADROOM;
+        b->in_iov[i].iov_len = BUFFER_SIZE;
+    }
+    
+    while (!__atomic_load_n(&server_exiting, __ATOMIC_RELAXED)) {
+        memset(b->in, 0, sizeof(b->in));
+        for (int i = 0; i < UDP_BATCH; i++) {
+            b->in[i].msg_hdr.msg_iov = &b->in_iov[i];
+            b->in[i].msg_hdr.msg_iovlen = 1;
+            b->in[i].msg_hdr.msg_name = &b->clients[i];
+            b->in[i].msg_hdr.msg_namelen = sizeof(b->clients[i]);
+        }
         
-        // Extract message from received PDU
-        if (extract_msg_data((uint8_t*)recv_buffer, bytes_received, extracted_msg, sizeof(extracted_msg)) < 0) {
-            fprintf(stderr, "Error: Invalid PDU received, ignoring\n");
+        // Waits for one datagram, then takes whatever else is already there
+        int received = recvmmsg(worker->sockfd, b->in, UDP_BATCH, MSG_WAITFORONE, NULL);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error receiving message");
+            }
             continue;
         }
         
-        // Get client IP address for logging
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        printf("Received %zd bytes from %s:%d (message: \"%s\")\n", 
-               bytes_received, client_ip, ntohs(client_addr.sin_port), extracted_msg);
-        
-        // Check for exit command
-        if (strcmp(extracted_msg, "exit") == 0) {
-            printf("Client requested server shutdown.\n");
+        int replies = 0;
+        for (int i = 0; i < received; i++) {
+            uint8_t *request = b->in_iov[i].iov_base;
+            size_t request_len = b->in[i].msg_len;
+            uint8_t *response;
+            int response_len;
             
-            // Create shutdown response PDU
-            strcpy(response_msg, "The server is exiting");
-            int pdu_len = netmsg_from_cstr(response_msg, (uint8_t*)send_buffer, BUFFER_SIZE);
-            if (pdu_len < 0) {
-                fprintf(stderr, "Error creating shutdown response PDU\n");
-                break;
-            }
+            worker->packets++;
+            worker->bytes += request_len;
             
-            // Send shutdown message to client
-            bytes_sent = sendto(sockfd, send_buffer, pdu_len, 0,
-                               (struct sockaddr*)&client_addr, client_addr_len);
+            if (verbose) {
+                inet_ntop(AF_INET, &b->clients[i].sin_addr, client_ip, INET_ADDRSTRLEN);
+                int shown = request_len > sizeof(uint16_t) ? request_len - sizeof(uint16_t) : 0;
+                printf("Worker %d received %zu bytes from %s:%d (message: \"%.*s\")\n", worker->id,
+                       request_len, client_ip, ntohs(b->clients[i].sin_port), shown,
+                       (char *)request + sizeof(uint16_t));
+            }
             
-            if (bytes_sent < 0) {
-                perror("Error sending shutdown response");
+            // Check for exit command, compared as bytes, the message is not a string
+            const uint8_t *msg;
+            uint16_t msg_len;
+            if (pdu_view(request, request_len, &msg, &msg_len) == 0 && msg_len == EXIT_CMD_LEN &&
+                memcmp(msg, EXIT_CMD, EXIT_CMD_LEN) == 0) {
+                printf("Client requested server shutdown.\n");
+                pdu_put_header(request, EXIT_REPLY_LEN);
+                memcpy(request + sizeof(uint16_t), EXIT_REPLY, EXIT_REPLY_LEN);
+                response_len = sizeof(uint16_t) + EXIT_REPLY_LEN;
+                response = request;
+                __atomic_store_n(&server_exiting, 1, __ATOMIC_RELAXED);
             } else {
-                printf("Sent shutdown message to client: \"%s\"\n", response_msg);
+                response_len = build_echo_response(request, request_len, worker->prefix,
+                                                   worker->prefix_len, &response);
+                if (response_len < 0) {
+                    if (verbose) {
+                        fprintf(stderr, "Error: Invalid PDU received, ignoring\n");
+                    }
+                    continue;
+                }
             }
             
-            printf("Server shutting down.\n");
-            break;
+            // The response goes back to where the request came from
+            b->out_iov[replies].iov_base = response;
+            b->out_iov[replies].iov_len = response_len;
+            memset(&b->out[replies], 0, sizeof(b->out[replies]));
+            b->out[replies].msg_hdr.msg_iov = &b->out_iov[replies];
+            b->out[replies].msg_hdr.msg_iovlen = 1;
+            b->out[replies].msg_hdr.msg_name = &b->clients[i];
+            b->out[replies].msg_hdr.msg_namelen = b->in[i].msg_hdr.msg_namelen;
+            replies++;
+            
+            if (__atomic_load_n(&server_exiting, __ATOMIC_RELAXED)) {
+                break;
+            }
         }
         
-        // Create response message: "prefix: original_message"
-        snprintf(response_msg, sizeof(response_msg), "%.500s: %.500s", prefix, extracted_msg);
-        
-        // Create response PDU
-        int pdu_len = netmsg_from_cstr(response_msg, (uint8_t*)send_buffer, BUFFER_SIZE);
-        if (pdu_len < 0) {
-            fprintf(stderr, "Error: Response message too long for buffer\n");
-            continue;
+        send_batch(worker->sockfd, b->out, replies);
+        if (verbose && replies > 0) {
+            printf("Worker %d sent %d responses\n---\n", worker->id, replies);
         }
-        
-        // Send response back to client
-        bytes_sent = sendto(sockfd, send_buffer, pdu_len, 0,
-                           (struct sockaddr*)&client_addr, client_addr_len);
-        
-        if (bytes_sent < 0) {
-            perror("Error sending response");
-            continue;
+    }
+    
+    free(b);
+    return NULL;
+}
+
+void start_server(const char* addr, int port, const char* prefix, int workers) {
+    udp_worker_t *pool;
+    uint64_t packets = 0;
+    
+    if (workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cores > 0) ? cores : 1;
+    }
+    
+    pool = calloc(workers, sizeof(udp_worker_t));
+    if (pool == NULL) {
+        perror("Error allocating workers");
+        exit(EXIT_FAILURE);
+    }
+    
+    // All sockets are bound before any worker starts, so a bad address or a
+    // port in use is reported once
+    for (int i = 0; i < workers; i++) {
+        pool[i].id = i;
+        pool[i].sockfd = open_server_socket(addr, port);
+        pool[i].prefix = prefix;
+        // Same limit as "%.500s", and what fits in the headroom
+        pool[i].prefix_len = strnlen(prefix, MAX_ECHO_PART_SIZE);
+    }
+    
+    printf("Server listening on %s:%d with %d workers\n", addr, port, workers);
+    printf("Waiting for client messages... (Press Ctrl+C to stop)\n");
+    
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&pool[i].thread, NULL, server_worker, &pool[i]) != 0) {
+            perror("Error creating worker");
+            exit(EXIT_FAILURE);
         }
-        
-        printf("Sent %zd bytes back to client (message: \"%s\")\n", bytes_sent, response_msg);
-        printf("---\n");
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_join(pool[i].thread, NULL);
+        close(pool[i].sockfd);
+        packets += pool[i].packets;
     }
     
-    close(sockfd);
+    printf("Server shutting down after %llu datagrams.\n", (unsigned long long)packets);
+    free(pool);
 }
 
 void print_usage(const char* program_name) {
@@ -293,6 +506,16 @@ void print_usage(const char* program_name) {
     printf("  --server              Run in server mode\n");
     printf("  --port <port>         Port number (default: %d)\n", DEFAULT_PORT);
     printf("  --addr <address>      IP address\n");
+    printf("  --workers <n>         Server: worker threads, one socket each (default: one per core)\n");
+    printf("  --verbose             Server: log every datagram\n");
+    printf("  --load                Client: generate load and measure loss and round trips\n");
+    printf("  --rate <n>            Load: datagrams per second, 0 for as fast as possible (default: %d)\n",
+           LOAD_DEFAULT_RATE);
+    printf("  --threads <n>         Load: sending threads, one socket each (default: %d)\n",
+           LOAD_DEFAULT_THREADS);
+    printf("  --size <n>            Load: message bytes, %d to %d (default: %d)\n", LOAD_FIELDS_LEN,
+           MAX_ECHO_PART_SIZE, LOAD_DEFAULT_SIZE);
+    printf("  --duration <s>        Load: seconds to send for (default: %d)\n", LOAD_DEFAULT_DURATION);
     printf("                        Client: server address (default: %s)\n", DEFAULT_CLIENT_ADDR);
     printf("                        Server: bind address (default: %s)\n", DEFAULT_SERVER_ADDR);
     printf("  MESSAGE/PREFIX        For client: message to send (default: \"%s\")\n", DEFAULT_CLIENT_MESSAGE);
@@ -308,6 +531,7 @@ void print_usage(const char* program_name) {
     printf("  %s --client\n", program_name);
     printf("  %s --client --port 8080 --addr 192.168.1.100 \"Hello World\"\n", program_name);
     printf("  %s --client --port 8080 --addr 192.168.1.100 \"exit\"\n", program_name);
+    printf("  %s --client --load --rate 100000 --threads 4\n", program_name);
 }
 
 // Helper function to create a network message PDU from a C string
@@ -337,6 +561,31 @@ int netmsg_from_cstr(const char *msg_str, uint8_t *msg_buff, uint16_t msg_buff_s
     return total_len;
 }
 
+// Finds the message in a received PDU without copying it, messages are
+// bytes and can hold anything, unlike extract_msg_data() which makes a C
+// string.  Returns 0 and sets *msg and *msg_len, or -1 if the PDU's length
+// does not match its size
+int pdu_view(const uint8_t *pdu_buff, size_t pdu_len, const uint8_t **msg, uint16_t *msg_len) {
+    uint16_t net_len;
+    
+    if (pdu_len < sizeof(uint16_t)) {
+        return -1;
+    }
+    memcpy(&net_len, pdu_buff, sizeof(net_len));    // pdu_buff need not be aligned
+    *msg_len = ntohs(net_len);
+    if (pdu_len != sizeof(uint16_t) + *msg_len) {
+        return -1;
+    }
+    *msg = pdu_buff + sizeof(uint16_t);
+    return 0;
+}
+
+// Writes a PDU's length in network byte order at its start
+void pdu_put_header(uint8_t *pdu_buff, uint16_t msg_len) {
+    uint16_t net_len = htons(msg_len);
+    memcpy(pdu_buff, &net_len, sizeof(net_len));
+}
+
 // Helper function to extract message data from a received PDU
 // Returns 0 on success, -1 on error
 int extract_msg_data(const uint8_t *pdu_buff, uint16_t pdu_len, char *msg_str, uint16_t max_str_len) {
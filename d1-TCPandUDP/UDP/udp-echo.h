@@ -2,6 +2,13 @@
 #define __UDP_ECHO_H__
 
 #include<stdint.h>
+#include<stddef.h>
+#include<pthread.h>
+#include<netinet/in.h>
+#include<sys/socket.h>
+#include<sys/uio.h>
+
+#include "nettime.h"
 
 #define BUFFER_SIZE 1024
 #define DEFAULT_PORT 1234
@@ -10,6 +17,22 @@
 #define DEFAULT_CLIENT_MESSAGE "hello from client"
 #define DEFAULT_SERVER_PREFIX "echo"
 #define MAX_MSG_DATA_SIZE (BUFFER_SIZE - sizeof(uint16_t))
+#define MAX_ECHO_PART_SIZE 500  // Longest prefix, and longest message echoed
+#define ECHO_SEPARATOR ": "
+#define ECHO_SEPARATOR_LEN 2
+#define EXIT_CMD "exit"
+#define EXIT_CMD_LEN (sizeof(EXIT_CMD) - 1)
+#define EXIT_REPLY "The server is exiting"
+#define EXIT_REPLY_LEN (sizeof(EXIT_REPLY) - 1)
+#define UDP_BATCH 64            // Datagrams per recvmmsg()/sendmmsg()
+#define UDP_HEADROOM 512        // Room in front of a request for the prefix
+#define UDP_EXIT_POLL_MS 100    // How often a worker checks for "exit"
+#define LOAD_DEFAULT_RATE 10000
+#define LOAD_DEFAULT_THREADS 2
+#define LOAD_DEFAULT_SIZE 64
+#define LOAD_DEFAULT_DURATION 5
+#define LOAD_FIELDS_LEN 34      // "seq time " in hex at the start of a load message
+#define LOAD_DRAIN_MS 500       // How long to wait for late replies
 
 // PDU structure for network messages
 typedef struct {
@@ -17,11 +40,75 @@ typedef struct {
     uint8_t  msg_data[]; // Variable length message data (use as flexible array)
 } echo_pdu_t;
 
+// One server thread and its socket
+typedef struct {
+    pthread_t thread;
+    int id;
+    int sockfd;
+    const char *prefix;
+    size_t prefix_len;
+    uint64_t packets;       // Datagrams received
+    uint64_t bytes;
+} udp_worker_t;
+
+// A worker's buffers for one batch, requests are answered in place
+typedef struct {
+    struct mmsghdr in[UDP_BATCH];
+    struct mmsghdr out[UDP_BATCH];
+    struct iovec in_iov[UDP_BATCH];
+    struct iovec out_iov[UDP_BATCH];
+    struct sockaddr_in clients[UDP_BATCH];
+    uint8_t buffers[UDP_BATCH][UDP_HEADROOM + BUFFER_SIZE];
+} udp_batch_t;
+
+// What --load does
+typedef struct {
+    int rate;               // Datagrams per second over all threads, 0 for no limit
+    int threads;
+    int size;               // Message bytes
+    int duration;           // Seconds
+} load_opts_t;
+
+// One load thread, its socket and what it measured
+typedef struct {
+    pthread_t thread;
+    int sockfd;
+    const load_opts_t *opts;
+    uint64_t start_ns;
+    uint64_t sent;          // Requests numbered so far
+    uint64_t send_errors;
+    uint64_t received;      // Distinct replies
+    uint64_t highest_seq;
+    uint64_t reordered;     // Replies behind one sent after them
+    uint64_t duplicates;
+    uint64_t bad;           // Replies that did not parse
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint8_t *seen;          // Bitmap of sequence numbers replied to
+    uint64_t seen_size;
+} load_thread_t;
+
+// A load thread's buffers for one batch of requests or replies
+typedef struct {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    nettime_cmsg_t control[UDP_BATCH];     // Receive timestamps
+    uint8_t buffers[UDP_BATCH][BUFFER_SIZE];
+} load_batch_t;
+
 // Function prototypes
 void start_client(const char* addr, int port, const char* message);
-void start_server(const char* addr, int port, const char* prefix);
+void start_server(const char* addr, int port, const char* prefix, int workers);
+int open_server_socket(const char* addr, int port);
+int build_echo_response(uint8_t *request, size_t request_len, const char *prefix,
+                        size_t prefix_len, uint8_t **response);
+void send_batch(int sockfd, struct mmsghdr *batch, int count);
+void *server_worker(void *arg);
+void start_load(const char* addr, int port, const load_opts_t *opts);
 void print_usage(const char* program_name);
 int netmsg_from_cstr(const char *msg_str, uint8_t *msg_buff, uint16_t msg_buff_sz);
+int pdu_view(const uint8_t *pdu_buff, size_t pdu_len, const uint8_t **msg, uint16_t *msg_len);
+void pdu_put_header(uint8_t *pdu_buff, uint16_t msg_len);
 int extract_msg_data(const uint8_t *pdu_buff, uint16_t pdu_len, char *msg_str, uint16_t max_str_len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE     // for recvmmsg() and sendmmsg()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include "udp-echo.h"
+#include "nettime.h"
+
+// Set once the test is over, the threads stop sending
+static int load_done = 0;
+
+// Round trip times from every thread, recorded without a lock
+static nettime_hist_t load_rtt;
+
+// Writes a request PDU with seq and the send time in its message, in hex
+// so the message stays printable.  The rest of the message is padding
+// Returns the PDU length
+static int build_load_request(uint8_t *pdu, uint64_t seq, uint64_t sent_ns, int size) {
+    char fields[LOAD_FIELDS_LEN + 1];
+
+    pdu_put_header(pdu, size);
+    snprintf(fields, sizeof(fields), "%016llx %016llx ", (unsigned long long)seq,
+             (unsigned long long)sent_ns);
+    memcpy(pdu + sizeof(uint16_t), fields, LOAD_FIELDS_LEN);
+    memset(pdu + sizeof(uint16_t) + LOAD_FIELDS_LEN, 'x', size - LOAD_FIELDS_LEN);
+    return sizeof(uint16_t) + size;
+}
+
+// Finds our message at the end of a response, "prefix: message", and
+// reads the sequence number and send time back out of it
+// Returns 0 on success, -1 if it is not a response to a load request
+static int parse_load_response(const uint8_t *pdu, size_t pdu_len, int size,
+                               uint64_t *seq, uint64_t *sent_ns) {
+    char fields[LOAD_FIELDS_LEN + 1];
+    unsigned long long s, t;
+    const uint8_t *msg;
+    uint16_t msg_len;
+
+    if (pdu_view(pdu, pdu_len, &msg, &msg_len) < 0 || msg_len < size) {
+        return -1;
+    }
+
+    memcpy(fields, msg + msg_len - size, LOAD_FIELDS_LEN);
+    fields[LOAD_FIELDS_LEN] = '\0';
+    if (sscanf(fields, "%16llx %16llx", &s, &t) != 2) {
+        return -1;
+    }
+    *seq = s;
+    *sent_ns = t;
+    return 0;
+}
+
+// Notes a reply to seq, counting replies seen twice and replies that
+// arrive after one sent later than them
+static void record_reply(load_thread_t *lt, uint64_t seq, uint64_t rtt_ns) {
+    if (seq >= lt->sent) {
+        lt->bad++;                  // We never sent that one
+        return;
+    }
+    if (lt->seen[seq / 8] & (1 << (seq % 8))) {
+        lt->duplicates++;
+        return;
+    }
+    lt->seen[seq / 8] |= 1 << (seq % 8);
+    lt->received++;
+
+    if (lt->received > 1 && seq < lt->highest_seq) {
+        lt->reordered++;
+    } else {
+        lt->highest_seq = seq;
+    }
+
+    nettime_hist_record(&load_rtt, rtt_ns);
+}
+
+// Takes every reply waiting on the socket without blocking.  Each reply's
+// round trip ends when the kernel stamped it, not when the batch is read
+static void receive_replies(load_thread_t *lt, load_batch_t *b) {
+    nettime_ref_t ref;
+
+    while (1) {
+        memset(b->msgs, 0, sizeof(b->msgs));
+        for (int i = 0; i < UDP_BATCH; i++) {
+            b->iov[i].iov_base = b->buffers[i];
+            b->iov[i].iov_len = sizeof(b->buffers[i]);
+            b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+            b->msgs[i].msg_hdr.msg_iovlen = 1;
+            b->msgs[i].msg_hdr.msg_control = b->control[i].buf;
+            b->msgs[i].msg_hdr.msg_controllen = sizeof(b->control[i].buf);
+        }
+
+        int received = recvmmsg(lt->sockfd, b->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (received <= 0) {
+            return;
+        }
+
+        nettime_ref(&ref);
+        for (int i = 0; i < received; i++) {
+            uint64_t seq, sent_ns;
+            if (parse_load_response(b->buffers[i], b->msgs[i].msg_len, lt->opts->size,
+                                    &seq, &sent_ns) < 0) {
+                lt->bad++;
+                continue;
+            }
+            lt->bytes_received += b->msgs[i].msg_len;
+
+            uint64_t rx_ns = nettime_rx_ns(&ref, &b->msgs[i].msg_hdr);
+            record_reply(lt, seq, rx_ns > sent_ns ? rx_ns - sent_ns : 0);
+        }
+    }
+}
+
+// Sends count requests with one sendmmsg(), numbered on from lt->sent
+static void send_requests(load_thread_t *lt, load_batch_t *b, int count) {
+    uint64_t now = nettime_now_ns();
+
+    // Make sure the bitmap of replies seen has room for these
+    uint64_t needed = (lt->sent + count + 7) / 8;
+    if (needed > lt->seen_size) {
+        uint64_t new_size = needed * 2 + 4096;
+        uint8_t *grown = realloc(lt->seen, new_size);
+        if (grown == NULL) {
+            perror("Error allocating reply bitmap");
+            exit(EXIT_FAILURE);
+        }
+        memset(grown + lt->seen_size, 0, new_size - lt->seen_size);
+        lt->seen = grown;
+        lt->seen_size = new_size;
+    }
+
+    memset(b->msgs, 0, count * sizeof(b->msgs[0]));
+    for (int i = 0; i < count; i++) {
+        b->iov[i].iov_base = b->buffers[i];
+        b->iov[i].iov_len = build_load_request(b->buffers[i], lt->sent + i, now, lt->opts->size);
+        b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = sendmmsg(lt->sockfd, b->msgs, count, 0);
+    if (sent < 0) {
+        // The socket buffer is full, these count as lost
+        sent = 0;
+    }
+    for (int i = 0; i < sent; i++) {
+        lt->bytes_sent += b->msgs[i].msg_len;
+    }
+    lt->send_errors += count - sent;
+
+    // Numbers that were not sent are still used up, so they show as lost
+    lt->sent += count;
+}
+
+// One load thread.  It sends its share of the rate on its own socket,
+// paced against the clock so a late wakeup is made up with a bigger batch
+// rather than a lower rate, and reads replies in between
+static void *load_thread(void *arg) {
+    load_thread_t *lt = arg;
+    const load_opts_t *opts = lt->opts;
+    double rate = (double)opts->rate / opts->threads;
+    load_batch_t *b;
+    struct pollfd pfd;
+
+    b = malloc(sizeof(load_batch_t));
+    if (b == NULL) {
+        perror("Error allocating buffers");
+        exit(EXIT_FAILURE);
+    }
+    pfd.fd = lt->sockfd;
+    pfd.events = POLLIN;
+
+    while (!__atomic_load_n(&load_done, __ATOMIC_RELAXED)) {
+        uint64_t now = nettime_now_ns();
+        int timeout_ms = 0;
+
+        // How many should have gone out by now, or a full batch when the
+        // rate is unlimited
+        int due = UDP_BATCH;
+        if (opts->rate > 0) {
+            uint64_t target = (uint64_t)((now - lt->start_ns) / 1e9 * rate);
+            due = target > lt->sent ? target - lt->sent : 0;
+            if (due > UDP_BATCH) {
+                due = UDP_BATCH;
+            }
+            if (due == 0) {
+                // Sleep in poll() until the next one is due
+                double next_ns = (lt->sent + 1) / rate * 1e9 + lt->start_ns;
+                timeout_ms = (next_ns - now) / 1e6;
+            }
+        }
+        if (due > 0) {
+            send_requests(lt, b, due);
+        }
+
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            receive_replies(lt, b);
+        }
+    }
+
+    // Replies still on their way get a little longer
+    uint64_t drain_end = nettime_now_ns() + LOAD_DRAIN_MS * 1000000ULL;
+    while (nettime_now_ns() < drain_end) {
+        if (poll(&pfd, 1, LOAD_DRAIN_MS / 10) > 0) {
+            receive_replies(lt, b);
+        }
+    }
+
+    free(b);
+    return NULL;
+}
+
+// Sends sequence numbered, timestamped requests at a steady rate from
+// several threads, each with its own socket, and works out from the
+// replies how many were lost, how many came back out of order and how
+// long the round trips took
+void start_load(const char* addr, int port, const load_opts_t *opts) {
+    struct sockaddr_in server_addr;
+    load_thread_t *threads;
+    load_thread_t total;
+    uint64_t start;
+    double seconds;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Error: Invalid address %s\n", addr);
+        exit(EXIT_FAILURE);
+    }
+
+    threads = calloc(opts->threads, sizeof(load_thread_t));
+    if (threads == NULL) {
+        perror("Error allocating threads");
+        exit(EXIT_FAILURE);
+    }
+
+    // A connected UDP socket only gets datagrams from the server, and the
+    // server's SO_REUSEPORT hash sends each thread's traffic to one worker
+    for (int i = 0; i < opts->threads; i++) {
+        threads[i].opts = opts;
+        threads[i].sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (threads[i].sockfd < 0) {
+            perror("Error creating socket");
+            exit(EXIT_FAILURE);
+        }
+        if (connect(threads[i].sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            perror("Error connecting socket");
+            exit(EXIT_FAILURE);
+        }
+        if (nettime_enable_rx(threads[i].sockfd) < 0) {
+            perror("Warning: no receive timestamps, timing replies when they are read");
+        }
+    }
+    nettime_hist_init(&load_rtt);
+
+    char rate[32] = "as many";
+    if (opts->rate > 0) {
+        snprintf(rate, sizeof(rate), "%d", opts->rate);
+    }
+    printf("Loading %s:%d: %d threads, %d byte messages, %s datagrams/s for %d seconds\n",
+           addr, port, opts->threads, opts->size, rate, opts->duration);
+
+    start = nettime_now_ns();
+    for (int i = 0; i < opts->threads; i++) {
+        threads[i].start_ns = start;
+        if (pthread_create(&threads[i].thread, NULL, load_thread, &threads[i]) != 0) {
+            perror("Error creating thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sleep(opts->duration);
+    __atomic_store_n(&load_done, 1, __ATOMIC_RELAXED);
+    seconds = (nettime_now_ns() - start) / 1e9;
+
+    // Add up what every thread saw
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < opts->threads; i++) {
+        load_thread_t *lt = &threads[i];
+        pthread_join(lt->thread, NULL);
+        close(lt->sockfd);
+        total.sent += lt->sent;
+        total.send_errors += lt->send_errors;
+        total.received += lt->received;
+        total.reordered += lt->reordered;
+        total.duplicates += lt->duplicates;
+        total.bad += lt->bad;
+        total.bytes_sent += lt->bytes_sent;
+        total.bytes_received += lt->bytes_received;
+        free(lt->seen);
+    }
+    free(threads);
+
+    uint64_t lost = total.sent - total.received;
+    printf("Sent:         %llu datagrams, %.0f/s, %.2f MB/s (%llu failed to send)\n",
+           (unsigned long long)total.sent, total.sent / seconds, total.bytes_sent / seconds / 1e6,
+           (unsigned long long)total.send_errors);
+    printf("Received:     %llu replies, %.0f/s, %.2f MB/s\n", (unsigned long long)total.received,
+           total.received / seconds, total.bytes_received / seconds / 1e6);
+    printf("Lost:         %llu (%.3f%%)\n", (unsigned long long)lost,
+           total.sent ? 100.0 * lost / total.sent : 0);
+    printf("Reordered:    %llu (%.3f%%), %llu duplicates, %llu not ours\n",
+           (unsigned long long)total.reordered,
+           total.received ? 100.0 * total.reordered / total.received : 0,
+           (unsigned long long)total.duplicates, (unsigned long long)total.bad);
+    nettime_hist_print(&load_rtt, stdout);
+}
@@ -1,2 +1,2 @@
 #!/bin/bash
-gcc -g -o decoder decoder.c
\ No newline at end of file
+gcc -g -pthread -o decoder *.c
\ No newline at end of file
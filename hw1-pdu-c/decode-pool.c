@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "decode-pool.h"
+
+//The next chunk from w's own queue, oldest first
+static decode_chunk_t *take(decode_worker_t *w) {
+    decode_chunk_t *chunk = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->head != w->tail) {
+        chunk = w->queue[w->head % w->pool->n_chunks];
+        w->head++;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return chunk;
+}
+
+/*
+ *  Takes the newest chunk off the back of some other worker's queue.  The
+ *  owner works from the front, so the two only meet on the last chunk
+ */
+static decode_chunk_t *steal(decode_worker_t *w) {
+    decode_pool_t *pool = w->pool;
+    int self = (int)(w - pool->workers);
+
+    for (int i = 1; i < pool->n_workers; i++) {
+        decode_worker_t *victim = &pool->workers[(self + i) % pool->n_workers];
+        decode_chunk_t *chunk = NULL;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head != victim->tail) {
+            victim->tail--;
+            chunk = victim->queue[victim->tail % pool->n_chunks];
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (chunk != NULL) {
+            w->stolen++;
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+static void decode_chunk(decode_worker_t *w, decode_chunk_t *chunk) {
+    const filter_t *filter = w->pool->filter;
+    size_t n = 0;
+
+    for (size_t i = 0; i < chunk->count; i++) {
+        const pcap_record_t *in = &chunk->in[i];
+        frame_record_t *rec = &chunk->recs[n];
+
+        if (in->linktype != PCAP_LINKTYPE_ETHERNET) {
+            w->skipped++;
+            continue;
+        }
+        if (filter != NULL && !filter_match(filter, in->data, in->caplen)) {
+            w->filtered++;
+            continue;
+        }
+        decode_frame(in->data, in->caplen, rec);
+        rec->frame_no = chunk->first_frame + i;
+        rec->ts_ns = in->ts_ns;
+        n++;
+    }
+    chunk->n_recs = n;
+    decode_stats_add(&w->stats, chunk->recs, n);
+    w->chunks++;
+
+    pthread_mutex_lock(&w->pool->lock);
+    chunk->done = 1;
+    pthread_cond_broadcast(&w->pool->done);
+    pthread_mutex_unlock(&w->pool->lock);
+}
+
+static void *worker_main(void *arg) {
+    decode_worker_t *w = arg;
+    decode_pool_t *pool = w->pool;
+
+    for (;;) {
+        decode_chunk_t *chunk = take(w);
+
+        if (chunk == NULL)
+            chunk = steal(w);
+        if (chunk != NULL) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+            decode_chunk(w, chunk);
+            continue;
+        }
+
+        //Nothing anywhere, sleep until there is
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->queued == 0 && pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+//Hands the oldest chunk to the retire callback, waiting for it if needed
+static void retire_oldest(decode_pool_t *pool) {
+    decode_chunk_t *chunk = &pool->chunks[pool->retired % pool->n_chunks];
+
+    pthread_mutex_lock(&pool->lock);
+    while (!chunk->done)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pool->retire != NULL)
+        pool->retire(chunk, pool->retire_arg);
+    pool->retired++;
+}
+
+//Retires whatever is already done at the front, without waiting
+static void retire_done(decode_pool_t *pool) {
+    while (pool->retired < pool->submitted) {
+        decode_chunk_t *chunk = &pool->chunks[pool->retired % pool->n_chunks];
+        int done;
+
+        pthread_mutex_lock(&pool->lock);
+        done = chunk->done;
+        pthread_mutex_unlock(&pool->lock);
+        if (!done)
+            break;
+        retire_oldest(pool);
+    }
+}
+
+//Stops and waits for the first started threads
+static void stop_workers(decode_pool_t *pool, int started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+}
+
+static void free_pool(decode_pool_t *pool) {
+    for (int i = 0; i < pool->n_workers; i++) {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].queue);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->chunks);
+    pool->workers = NULL;
+    pool->chunks = NULL;
+}
+
+/*
+ *  Starts threads workers.  Only the packets that match filter are decoded,
+ *  every one of them if filter is NULL.  retire is called on the calling
+ *  thread with every chunk once it is decoded, in the order they were
+ *  submitted.  Returns 0, or -1 if the threads or memory could not be had
+ */
+int decode_pool_start(decode_pool_t *pool, int threads, const filter_t *filter,
+                      decode_retire_fn retire, void *arg) {
+    if (threads < 1)
+        threads = 1;
+    if (threads > POOL_MAX_THREADS)
+        threads = POOL_MAX_THREADS;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->filter = filter;
+    pool->retire = retire;
+    pool->retire_arg = arg;
+    pool->n_chunks = (size_t)threads * POOL_CHUNKS_PER_THREAD;
+    pool->chunks = calloc(pool->n_chunks, sizeof(decode_chunk_t));
+    pool->workers = aligned_alloc(64, threads * sizeof(decode_worker_t));
+    if (pool->chunks == NULL || pool->workers == NULL) {
+        perror("decode pool");
+        free(pool->chunks);
+        free(pool->workers);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    //Every worker is set up before any thread starts, a thread may go
+    //looking in the other workers' queues straight away
+    for (int i = 0; i < threads; i++) {
+        decode_worker_t *w = &pool->workers[i];
+
+        memset(w, 0, sizeof(*w));
+        w->pool = pool;
+        pthread_mutex_init(&w->lock, NULL);
+        decode_stats_init(&w->stats);
+        w->queue = calloc(pool->n_chunks, sizeof(decode_chunk_t *));
+        pool->n_workers = i + 1;
+        if (w->queue == NULL) {
+            perror("decode pool");
+            free_pool(pool);
+            return -1;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            perror("decode pool worker");
+            stop_workers(pool, i);
+            free_pool(pool);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ *  The next free chunk to fill in.  When every chunk is in flight this
+ *  waits for the oldest one and retires it first
+ */
+decode_chunk_t *decode_pool_chunk(decode_pool_t *pool) {
+    decode_chunk_t *chunk;
+
+    if (pool->submitted - pool->retired == pool->n_chunks)
+        retire_oldest(pool);
+    chunk = &pool->chunks[pool->submitted % pool->n_chunks];
+    chunk->count = 0;
+    chunk->n_recs = 0;
+    chunk->done = 0;
+    return chunk;
+}
+
+//Queues the chunk decode_pool_chunk() returned, once in[] and count are filled in
+void decode_pool_submit(decode_pool_t *pool, decode_chunk_t *chunk) {
+    decode_worker_t *w = &pool->workers[pool->submitted % pool->n_workers];
+
+    pthread_mutex_lock(&w->lock);
+    w->queue[w->tail % pool->n_chunks] = chunk;
+    w->tail++;
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->submitted++;
+    retire_done(pool);
+}
+
+//The oldest chunk not retired yet, its packets are still being used, or NULL
+const decode_chunk_t *decode_pool_oldest(const decode_pool_t *pool) {
+    if (pool->retired == pool->submitted)
+        return NULL;
+    return &pool->chunks[pool->retired % pool->n_chunks];
+}
+
+/*
+ *  Retires everything still in flight, stops the threads and adds their
+ *  totals into stats and skipped
+ */
+void decode_pool_finish(decode_pool_t *pool, decode_stats_t *stats, uint64_t *skipped) {
+    while (pool->retired < pool->submitted)
+        retire_oldest(pool);
+    stop_workers(pool, pool->n_workers);
+
+    for (int i = 0; i < pool->n_workers; i++) {
+        decode_stats_merge(stats, &pool->workers[i].stats);
+        *skipped += pool->workers[i].skipped;
+        pool->stolen += pool->workers[i].stolen;
+        pool->filtered += pool->workers[i].filtered;
+    }
+    free_pool(pool);
+}
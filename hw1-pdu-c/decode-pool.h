@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+ *  Decodes a capture on several threads at once.
+ *
+ *  The main thread walks the capture and cuts it into chunks of up to
+ *  FRAME_BATCH packets, always on packet boundaries.  Walking only hops
+ *  from one record header to the next, so it goes a lot faster than
+ *  decoding.  Each chunk goes onto the queue of one worker thread, and a
+ *  worker that runs out of work steals from the back of another worker's
+ *  queue, so a slow thread never leaves the others waiting.
+ *
+ *  A worker runs each packet through the filter, if there is one, and
+ *  decodes the ones that match into records, adding them to its own
+ *  totals, which are merged when the pool finishes.  Chunks can finish in
+ *  any order, but the main thread hands them back through the retire
+ *  callback strictly in the order they were cut, so anything printed
+ *  comes out in frame order.  Only POOL_CHUNKS_PER_THREAD chunks per
+ *  thread are in flight at once, which bounds the memory used no matter
+ *  how big the capture is.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "frame-record.h"
+#include "pcap-reader.h"
+#include "filter.h"
+
+#define POOL_MAX_THREADS        64
+#define POOL_CHUNKS_PER_THREAD  4
+
+typedef struct decode_chunk_t {
+    uint64_t first_frame;               //Frame number of in[0]
+    size_t   count;                     //Packets in in[]
+    size_t   n_recs;                    //Records in recs[], the ethernet packets that matched
+    int      done;
+    pcap_record_t  in[FRAME_BATCH];
+    frame_record_t recs[FRAME_BATCH];
+} decode_chunk_t;
+
+//Called on the main thread for every chunk, in the order they were submitted
+typedef void (*decode_retire_fn)(const decode_chunk_t *chunk, void *arg);
+
+typedef struct decode_worker_t {
+    pthread_t thread;
+    struct decode_pool_t *pool;
+    pthread_mutex_t lock;               //Guards the queue
+    decode_chunk_t **queue;             //Ring, the owner takes from head, thieves from tail
+    size_t   head;
+    size_t   tail;
+    decode_stats_t stats;
+    uint64_t skipped;                   //Packets that were not ethernet
+    uint64_t filtered;                  //Packets the filter turned away
+    uint64_t chunks;
+    uint64_t stolen;
+} __attribute__((aligned(64))) decode_worker_t;
+
+typedef struct decode_pool_t {
+    int      n_workers;
+    decode_worker_t *workers;
+    const filter_t *filter;             //NULL to decode every packet
+    decode_chunk_t  *chunks;            //Ring of n_chunks
+    size_t   n_chunks;
+    uint64_t submitted;                 //Chunks handed to the workers
+    uint64_t retired;                   //Chunks handed back to the retire callback
+    decode_retire_fn retire;
+    void     *retire_arg;
+    pthread_mutex_t lock;
+    pthread_cond_t  work;               //Something was queued, or it is time to stop
+    pthread_cond_t  done;               //A chunk was decoded
+    size_t   queued;                    //Chunks sitting in the workers' queues
+    int      stop;
+    uint64_t stolen;                    //Chunks taken from another worker, set by finish
+    uint64_t filtered;                  //Packets the filter turned away, set by finish
+} decode_pool_t;
+
+int  decode_pool_start(decode_pool_t *pool, int threads, const filter_t *filter,
+                       decode_retire_fn retire, void *arg);
+decode_chunk_t *decode_pool_chunk(decode_pool_t *pool);
+void decode_pool_submit(decode_pool_t *pool, decode_chunk_t *chunk);
+const decode_chunk_t *decode_pool_oldest(const decode_pool_t *pool);
+void decode_pool_finish(decode_pool_t *pool, decode_stats_t *stats, uint64_t *skipped);
@@ -3,9 +3,19 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include "packet.h"
 #include "nethelper.h"
 #include "decoder.h"
+#include "pcap-reader.h"
+#include "frame-record.h"
+#include "decode-pool.h"
+#include "flow-table.h"
+#include "pdu-view.h"
+#include "filter.h"
+#include "live-capture.h"
 
 //This is where you will be putting your captured network frames for testing.
 //Before you do your own, please test with the ones that I provided as samples:
@@ -29,7 +39,155 @@ test_packet_t TEST_CASES[] = {
 // you delete the TODO: documentation in your implementation and provide
 // some documentation on what you actually accomplished.
 
+//Reads FIRST or FIRST-LAST, frames are numbered from 1
+static int parse_frame_range(const char *arg, uint64_t *first, uint64_t *last) {
+    char *end;
+
+    *first = strtoull(arg, &end, 10);
+    *last = *first;
+    if (*end == '-') {
+        *last = strtoull(end + 1, &end, 10);
+    }
+    if (*end != '\0' || *first == 0 || *last < *first) {
+        return -1;
+    }
+    return 0;
+}
+
+//Puts the words left on the command line back together into one filter
+static char *join_args(int argc, char **argv) {
+    size_t len = 1;
+    char *expr;
+
+    for (int i = 0; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    expr = malloc(len);
+    if (expr == NULL) {
+        perror("filter");
+        return NULL;
+    }
+    expr[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        if (i > 0) {
+            strcat(expr, " ");
+        }
+        strcat(expr, argv[i]);
+    }
+    return expr;
+}
+
 int main(int argc, char **argv) {
+    //With -r the packets come from a capture file saved by wireshark or
+    //tcpdump, pcap or pcapng, instead of from the test cases.  With -b
+    //they are decoded in batches and only the totals are printed, -p picks
+    //frames to print one line each for and -j says how many threads decode.
+    //-f adds up the frames into conversations, -t and -F set how long a
+    //quiet one is kept and how many are kept at once.  Whatever is left
+    //on the command line is a filter, see filter.h, only frames that match
+    //it are decoded, and -d prints what the filter compiled into.  -i
+    //captures live off a network interface instead, until ^C or until -c
+    //frames were decoded, -j threads share the interface in batch mode
+    static filter_t filter;
+    batch_opts_t batch_opts = {0};
+    bool batch = false;
+    bool dump_filter = false;
+    char *expr;
+    int opt;
+
+    batch_opts.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    batch_opts.flow_max = FLOW_MAX_DEFAULT;
+    batch_opts.flow_idle_ns = FLOW_IDLE_DEFAULT * 1000000000ULL;
+    while ((opt = getopt(argc, argv, "r:bp:j:ft:F:di:c:")) != -1) {
+        switch (opt) {
+            case 'r':
+                batch_opts.path = optarg;
+                break;
+            case 'b':
+                batch = true;
+                break;
+            case 'p':
+                if (parse_frame_range(optarg, &batch_opts.print_first, &batch_opts.print_last) < 0) {
+                    fprintf(stderr, "bad frame range %s, expected FIRST or FIRST-LAST\n", optarg);
+                    return 1;
+                }
+                batch = true;
+                break;
+            case 'j':
+                batch_opts.threads = atoi(optarg);
+                if (batch_opts.threads < 1) {
+                    fprintf(stderr, "bad thread count %s\n", optarg);
+                    return 1;
+                }
+                batch = true;
+                break;
+            case 'f':
+                batch_opts.flows = true;
+                batch = true;
+                break;
+            case 't':
+                batch_opts.flow_idle_ns = (uint64_t)(atof(optarg) * 1e9);
+                break;
+            case 'F':
+                batch_opts.flow_max = strtoul(optarg, NULL, 10);
+                if (batch_opts.flow_max == 0) {
+                    fprintf(stderr, "bad flow count %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                dump_filter = true;
+                break;
+            case 'i':
+                batch_opts.iface = optarg;
+                break;
+            case 'c':
+                batch_opts.count = strtoull(optarg, NULL, 10);
+                if (batch_opts.count == 0) {
+                    fprintf(stderr, "bad frame count %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r capture-file | -i interface [-c count]] [-b] [-p first[-last]]\n"
+                    "       [-j threads] [-f] [-t idle-seconds] [-F max-flows] [-d] [filter]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (batch_opts.iface != NULL && (batch_opts.path != NULL || batch_opts.print_first != 0)) {
+        fprintf(stderr, "-i does not go with -r or -p\n");
+        return 1;
+    }
+
+    expr = join_args(argc - optind, argv + optind);
+    if (expr == NULL || filter_compile(&filter, expr) < 0) {
+        free(expr);
+        return 1;
+    }
+    free(expr);
+    if (dump_filter) {
+        filter_print(&filter, stdout);
+        return 0;
+    }
+    if (filter.n_insns > 0) {
+        batch_opts.filter = &filter;
+    }
+
+    if (batch_opts.iface != NULL) {
+#ifdef __linux__
+        return batch ? decode_live_batch(&batch_opts) : decode_live(&batch_opts);
+#else
+        fprintf(stderr, "live capture with -i needs Linux\n");
+        return 1;
+#endif
+    }
+    if (batch) {
+        return decode_batch(&batch_opts);
+    }
+    if (batch_opts.path != NULL) {
+        return decode_capture_file(batch_opts.path, batch_opts.filter);
+    }
+
     //This code is here as a refresher on how to figure out how
     //many elements are in a statically defined C array. Note
     //that sizeof(TEST_CASES) is not 3, its the total number of 
@@ -46,21 +204,529 @@ int main(int argc, char **argv) {
         printf("--------------------------------------------------\n");
         test_packet_t test_case = TEST_CASES[i];
 
+        if (batch_opts.filter != NULL &&
+            !filter_match(batch_opts.filter, test_case.raw_packet, test_case.packet_len)) {
+            printf("Does not match the filter\n");
+            continue;
+        }
         decode_raw_packet(test_case.raw_packet, test_case.packet_len);
     }
 
     printf("\nDONE\n");
 }
 
-void decode_raw_packet(uint8_t *packet, uint64_t packet_len){
+/*
+ *  Runs every packet in a capture file through decode_raw_packet().  The
+ *  packets are not copied out of the file, each one is decoded right
+ *  where the reader has it mapped.  Only ethernet frames are decoded, a
+ *  capture of another link type (like loopback) is skipped over, and so
+ *  is a frame too short to hold an ethernet header.  With a filter,
+ *  frames that do not match it are skipped before anything about them is
+ *  printed
+ */
+int decode_capture_file(const char *path, const filter_t *filter) {
+    pcap_reader_t reader;
+    pcap_record_t rec;
+    uint64_t count = 0;
+    uint64_t skipped = 0;
+    uint64_t runts = 0;
+    uint64_t filtered = 0;
+    int result;
+
+    if (pcap_reader_open(&reader, path) < 0) {
+        return 1;
+    }
+
+    printf("STARTING %s...", path);
+    while ((result = pcap_reader_next(&reader, &rec)) == 1) {
+        count++;
+        if (rec.linktype != PCAP_LINKTYPE_ETHERNET) {
+            skipped++;
+            continue;
+        }
+        //decode_raw_packet() reads the ethernet header without checking
+        //the length, decode_frame() calls these malformed
+        if (rec.caplen < sizeof(ether_pdu_t)) {
+            runts++;
+            continue;
+        }
+        if (filter != NULL && !filter_match(filter, rec.data, rec.caplen)) {
+            filtered++;
+            continue;
+        }
+        printf("\n--------------------------------------------------\n");
+        printf("PACKET %lu, CAPTURED %s", (unsigned long)count,
+            get_ts_formatted(rec.ts_ns / 1000000000, (rec.ts_ns % 1000000000) / 1000));
+        printf("--------------------------------------------------\n");
+        decode_raw_packet(rec.data, rec.caplen);
+    }
+    pcap_reader_close(&reader);
+
+    printf("\nDONE, %lu packets", (unsigned long)count);
+    if (skipped > 0) {
+        printf(", %lu not ethernet were skipped", (unsigned long)skipped);
+    }
+    if (runts > 0) {
+        printf(", %lu too short for an ethernet header were skipped", (unsigned long)runts);
+    }
+    if (filtered > 0) {
+        printf(", %lu did not match the filter", (unsigned long)filtered);
+    }
+    printf("\n");
+    return result < 0 ? 1 : 0;
+}
+
+//What the pool hands each decoded chunk back to
+typedef struct batch_state_t {
+    const batch_opts_t *opts;
+    flow_table_t *flows;        //NULL without -f
+} batch_state_t;
+
+/*
+ *  Called with each chunk in frame order.  Adds its records to the flow
+ *  table and prints the ones the -p range picked
+ */
+static void retire_chunk(const decode_chunk_t *chunk, void *arg) {
+    const batch_state_t *state = arg;
+    const batch_opts_t *opts = state->opts;
+
+    if (state->flows != NULL) {
+        flow_table_add(state->flows, chunk->recs, chunk->n_recs);
+    }
+    if (opts->print_first == 0) {
+        return;
+    }
+    for (size_t i = 0; i < chunk->n_recs; i++) {
+        const frame_record_t *rec = &chunk->recs[i];
+        if (rec->frame_no >= opts->print_first && rec->frame_no <= opts->print_last) {
+            print_frame_record(rec, stdout);
+        }
+    }
+}
+
+/*
+ *  Cuts the capture file into chunks on packet boundaries and hands them
+ *  to the pool.  Packets the pool is still decoding are held in memory,
+ *  the reader only gives back pages from before the oldest of them
+ */
+static int batch_capture_file(pcap_reader_t *reader, decode_pool_t *pool) {
+    uint64_t frame_no = 0;
+    int result = 1;
+
+    do {
+        decode_chunk_t *chunk = decode_pool_chunk(pool);
+        const decode_chunk_t *oldest = decode_pool_oldest(pool);
+
+        reader->hold = oldest != NULL ? (size_t)(oldest->in[0].data - reader->map) : reader->pos;
+        chunk->first_frame = frame_no + 1;
+        while (chunk->count < FRAME_BATCH &&
+               (result = pcap_reader_next(reader, &chunk->in[chunk->count])) == 1) {
+            chunk->count++;
+        }
+        frame_no += chunk->count;
+        if (chunk->count > 0) {
+            decode_pool_submit(pool, chunk);
+        }
+    } while (result == 1);
+    return result;
+}
+
+//The test cases go through the pool too, as ethernet packets with no time
+static void batch_test_cases(decode_pool_t *pool) {
+    int num_test_cases = sizeof(TEST_CASES) / sizeof(test_packet_t);
+    decode_chunk_t *chunk = NULL;
+
+    for (int i = 0; i < num_test_cases; i++) {
+        pcap_record_t *in;
+
+        if (chunk == NULL) {
+            chunk = decode_pool_chunk(pool);
+            chunk->first_frame = i + 1;
+        }
+        in = &chunk->in[chunk->count++];
+        memset(in, 0, sizeof(*in));
+        in->data = TEST_CASES[i].raw_packet;
+        in->caplen = in->origlen = TEST_CASES[i].packet_len;
+        in->linktype = PCAP_LINKTYPE_ETHERNET;
+        if (chunk->count == FRAME_BATCH) {
+            decode_pool_submit(pool, chunk);
+            chunk = NULL;
+        }
+    }
+    if (chunk != NULL) {
+        decode_pool_submit(pool, chunk);
+    }
+}
+
+//Runs the decode for decode_batch(), returns 0, or -1 if it failed
+static int run_batch(batch_state_t *state) {
+    const batch_opts_t *opts = state->opts;
+    pcap_reader_t reader;
+    decode_pool_t pool;
+    decode_stats_t stats;
+    uint64_t skipped = 0;
+    struct timespec start, end;
+    double secs;
+    int result = 0;
+
+    if (opts->path != NULL && pcap_reader_open(&reader, opts->path) < 0) {
+        return -1;
+    }
+    if (decode_pool_start(&pool, opts->threads, opts->filter, retire_chunk, state) < 0) {
+        if (opts->path != NULL) {
+            pcap_reader_close(&reader);
+        }
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (opts->path != NULL) {
+        result = batch_capture_file(&reader, &pool);
+    } else {
+        batch_test_cases(&pool);
+    }
+    decode_stats_init(&stats);
+    decode_pool_finish(&pool, &stats, &skipped);
+    if (state->flows != NULL) {
+        flow_table_finish(state->flows);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (opts->path != NULL) {
+        pcap_reader_close(&reader);
+    }
+
+    if (opts->print_first != 0) {
+        printf("\n");
+    }
+    decode_stats_print(&stats, stdout);
+    if (skipped > 0) {
+        printf("\n%lu frames that are not ethernet were skipped\n", (unsigned long)skipped);
+    }
+    if (opts->filter != NULL) {
+        printf("\n%lu frames did not match the filter\n", (unsigned long)pool.filtered);
+    }
+    if (state->flows != NULL) {
+        printf("\n");
+        flow_table_print(state->flows, stdout);
+    }
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("\nDecoded %lu frames in %.3f s on %d threads", (unsigned long)stats.frames, secs,
+        pool.n_workers);
+    if (secs > 0) {
+        printf(", %.0f frames/s, %.1f MB/s", stats.frames / secs, stats.bytes / secs / 1e6);
+    }
+    printf("\n");
+    return result < 0 ? -1 : 0;
+}
+
+/*
+ *  Decodes the test cases, or the capture file if opts->path is not NULL,
+ *  into records instead of printing each frame, on opts->threads threads.
+ *  Prints the totals and how fast it went at the end.  Frames
+ *  opts->print_first to opts->print_last (0 for none) are printed one line
+ *  each, in frame order, and with opts->flows the records are added up
+ *  into conversations as well
+ */
+int decode_batch(const batch_opts_t *opts) {
+    flow_table_t flows;
+    batch_state_t state = { opts, NULL };
+    int result;
+
+    if (opts->flows) {
+        if (flow_table_init(&flows, opts->flow_max, opts->flow_idle_ns) < 0) {
+            return 1;
+        }
+        state.flows = &flows;
+    }
+    result = run_batch(&state);
+    if (state.flows != NULL) {
+        flow_table_free(state.flows);
+    }
+    return result < 0 ? 1 : 0;
+}
+
+#ifdef __linux__
+
+#define LIVE_POLL_MS    100         //Check for ^C at least this often
+
+static volatile sig_atomic_t live_stop;
+static uint64_t live_frames;        //Frames decoded by every thread, for -c
+
+static void stop_live(int sig) {
+    (void)sig;
+    __atomic_store_n(&live_stop, 1, __ATOMIC_RELAXED);
+}
+
+//^C ends a live capture cleanly, so the totals still get printed
+static void catch_stop_signals(void) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_live;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+static bool live_stopped(void) {
+    return __atomic_load_n(&live_stop, __ATOMIC_RELAXED) != 0;
+}
+
+//Counts one more frame against -c, returns false once the count is used up
+static bool live_take_frame(const batch_opts_t *opts) {
+    if (opts->count == 0) {
+        return true;
+    }
+    if (__atomic_fetch_add(&live_frames, 1, __ATOMIC_RELAXED) < opts->count) {
+        return true;
+    }
+    __atomic_store_n(&live_stop, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+/*
+ *  Captures live off opts->iface and runs every frame through
+ *  decode_raw_packet(), like decode_capture_file() does for a file.  Each
+ *  frame is decoded right where the kernel put it in the ring, it is not
+ *  copied out first.  A frame too short for an ethernet header is skipped
+ */
+int decode_live(const batch_opts_t *opts) {
+    live_capture_t capture;
+    pcap_record_t rec;
+    uint64_t count = 0;
+    uint64_t runts = 0;
+    uint64_t filtered = 0;
+    uint64_t packets = 0;
+    uint64_t drops = 0;
+    int result = 0;
+
+    if (live_capture_open(&capture, opts->iface, -1) < 0) {
+        return 1;
+    }
+    catch_stop_signals();
+
+    printf("LISTENING on %s...", opts->iface);
+    fflush(stdout);
+    while (!live_stopped()) {
+        result = live_capture_next(&capture, &rec, LIVE_POLL_MS);
+        if (result < 0) {
+            break;
+        }
+        if (result == 0) {
+            fflush(stdout);
+            continue;
+        }
+        if (rec.caplen < sizeof(ether_pdu_t)) {
+            runts++;
+            continue;
+        }
+        if (opts->filter != NULL && !filter_match(opts->filter, rec.data, rec.caplen)) {
+            filtered++;
+            continue;
+        }
+        if (!live_take_frame(opts)) {
+            break;
+        }
+        count++;
+        printf("\n--------------------------------------------------\n");
+        printf("PACKET %lu, CAPTURED %s", (unsigned long)count,
+            get_ts_formatted(rec.ts_ns / 1000000000, (rec.ts_ns % 1000000000) / 1000));
+        printf("--------------------------------------------------\n");
+        decode_raw_packet(rec.data, rec.caplen);
+    }
+    live_capture_stats(&capture, &packets, &drops);
+    live_capture_close(&capture);
+
+    printf("\nDONE, %lu packets", (unsigned long)count);
+    if (runts > 0) {
+        printf(", %lu too short for an ethernet header were skipped", (unsigned long)runts);
+    }
+    if (filtered > 0) {
+        printf(", %lu did not match the filter", (unsigned long)filtered);
+    }
+    if (drops > 0) {
+        printf(", %lu dropped by the kernel", (unsigned long)drops);
+    }
+    printf("\n");
+    return result < 0 ? 1 : 0;
+}
+
+//One thread of decode_live_batch(), with its own socket in the fanout group
+typedef struct live_worker_t {
+    pthread_t thread;
+    const batch_opts_t *opts;
+    live_capture_t capture;
+    decode_stats_t stats;
+    flow_table_t flows;
+    uint64_t filtered;
+    int      result;
+    frame_record_t recs[FRAME_BATCH];
+} live_worker_t;
+
+static void live_add_records(live_worker_t *w, size_t n) {
+    decode_stats_add(&w->stats, w->recs, n);
+    if (w->opts->flows) {
+        flow_table_add(&w->flows, w->recs, n);
+    }
+}
+
+/*
+ *  Decodes this thread's share of the interface into records, adding them
+ *  up FRAME_BATCH at a time, or sooner when the interface goes quiet
+ */
+static void *live_worker_main(void *arg) {
+    live_worker_t *w = arg;
+    const batch_opts_t *opts = w->opts;
+    pcap_record_t in;
+    size_t n = 0;
+
+    while (!live_stopped()) {
+        int got = live_capture_next(&w->capture, &in, LIVE_POLL_MS);
+
+        if (got < 0) {
+            w->result = -1;
+            __atomic_store_n(&live_stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        if (got == 1) {
+            if (opts->filter != NULL && !filter_match(opts->filter, in.data, in.caplen)) {
+                w->filtered++;
+                continue;
+            }
+            if (!live_take_frame(opts)) {
+                break;
+            }
+            decode_frame(in.data, in.caplen, &w->recs[n]);
+            w->recs[n].ts_ns = in.ts_ns;
+            n++;
+        }
+        if (n == FRAME_BATCH || (got == 0 && n > 0)) {
+            live_add_records(w, n);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        live_add_records(w, n);
+    }
+    if (opts->flows) {
+        flow_table_finish(&w->flows);
+    }
+    return NULL;
+}
+
+static void free_live_workers(live_worker_t *workers, int count) {
+    for (int i = 0; i < count; i++) {
+        live_capture_close(&workers[i].capture);
+        if (workers[i].opts->flows) {
+            flow_table_free(&workers[i].flows);
+        }
+    }
+    free(workers);
+}
+
+/*
+ *  Captures live off opts->iface on opts->threads threads and prints the
+ *  totals, like decode_batch() does for a file, once ^C or opts->count
+ *  ends it.  Every thread has its own socket and ring in one fanout group,
+ *  so the kernel splits the traffic between them by conversation and each
+ *  thread can add up conversations on its own
+ */
+int decode_live_batch(const batch_opts_t *opts) {
+    int threads = opts->threads < POOL_MAX_THREADS ? opts->threads : POOL_MAX_THREADS;
+    int fanout = threads > 1 ? (int)(getpid() & 0xffff) : -1;
+    live_worker_t *workers = calloc(threads, sizeof(live_worker_t));
+    decode_stats_t stats;
+    uint64_t filtered = 0, packets = 0, drops = 0;
+    struct timespec start, end;
+    double secs;
+    int opened, started, result = 0;
+
+    if (workers == NULL) {
+        perror("live capture");
+        return 1;
+    }
+    //Every socket joins the group before any thread starts reading
+    for (opened = 0; opened < threads; opened++) {
+        live_worker_t *w = &workers[opened];
+
+        w->opts = opts;
+        decode_stats_init(&w->stats);
+        if (opts->flows && flow_table_init(&w->flows, opts->flow_max, opts->flow_idle_ns) < 0) {
+            break;
+        }
+        if (live_capture_open(&w->capture, opts->iface, fanout) < 0) {
+            if (opts->flows) {
+                flow_table_free(&w->flows);
+            }
+            break;
+        }
+    }
+    if (opened < threads) {
+        free_live_workers(workers, opened);
+        return 1;
+    }
+
+    catch_stop_signals();
+    printf("LISTENING on %s with %d threads, ^C to stop...\n", opts->iface, threads);
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&workers[started].thread, NULL, live_worker_main, &workers[started]) != 0) {
+            perror("live capture worker");
+            __atomic_store_n(&live_stop, 1, __ATOMIC_RELAXED);
+            result = -1;
+            break;
+        }
+    }
+    decode_stats_init(&stats);
+    for (int i = 0; i < started; i++) {
+        live_worker_t *w = &workers[i];
+
+        pthread_join(w->thread, NULL);
+        decode_stats_merge(&stats, &w->stats);
+        filtered += w->filtered;
+        live_capture_stats(&w->capture, &packets, &drops);
+        if (w->result < 0) {
+            result = -1;
+        }
+        if (opts->flows && i > 0) {
+            flow_table_merge(&workers[0].flows, &w->flows);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("\n");
+    decode_stats_print(&stats, stdout);
+    if (opts->filter != NULL) {
+        printf("\n%lu frames did not match the filter\n", (unsigned long)filtered);
+    }
+    if (opts->flows && started == threads) {
+        printf("\n");
+        flow_table_print(&workers[0].flows, stdout);
+    }
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("\nDecoded %lu frames in %.3f s on %d threads", (unsigned long)stats.frames, secs, threads);
+    if (secs > 0) {
+        printf(", %.0f frames/s", stats.frames / secs);
+    }
+    printf(", %lu dropped by the kernel\n", (unsigned long)drops);
+    free_live_workers(workers, threads);
+    return result < 0 ? 1 : 0;
+}
+
+#endif
+
+void decode_raw_packet(const uint8_t *packet, uint64_t packet_len){
 
     printf("Packet length = %ld bytes\n", packet_len);
 
     //Everything we are doing starts with the ethernet PDU at the
     //front.  The below code projects an ethernet_pdu structure 
-    //POINTER onto the front of the buffer so we can decode it.
-    struct ether_pdu *p = (struct ether_pdu *)packet;
-    uint16_t ft = ntohs(p->frame_type);
+    //POINTER onto the front of the buffer so we can decode it.  The
+    //packet is never changed, eth_frame_type() from pdu-view.h reads
+    //the frame type and converts it to host byte order as it goes
+    const struct ether_pdu *p = (const struct ether_pdu *)packet;
+    uint16_t ft = eth_frame_type(p);
 
     printf("Detected raw frame type from ethernet header: 0x%x\n", ft);
 
@@ -68,9 +734,9 @@ void decode_raw_packet(uint8_t *packet, uint64_t packet_len){
         case ARP_PTYPE:
             printf("Packet type = ARP\n");
 
-            //Lets process the ARP packet, convert all of the network byte order
-            //fields to host machine byte order
-            arp_packet_t *arp = process_arp(packet);
+            //Lets process the ARP packet, the fields stay in network byte
+            //order and are read with the accessors in pdu-view.h
+            const arp_packet_t *arp = process_arp(packet);
 
             //Print the arp packet
             print_arp(arp);
@@ -79,7 +745,7 @@ void decode_raw_packet(uint8_t *packet, uint64_t packet_len){
             printf("Frame type = IPv4, now lets check for ICMP...\n");
 
             //We know its IP, so lets type the raw packet as an IP packet
-            ip_packet_t *ip = (ip_packet_t *)packet;
+            const ip_packet_t *ip = (const ip_packet_t *)packet;
 
             //Now check the IP packet to see if its payload is an ICMP packet
             bool isICMP = check_ip_for_icmp(ip);
@@ -88,9 +754,8 @@ void decode_raw_packet(uint8_t *packet, uint64_t packet_len){
                 break;
             }
 
-            //Now lets process the basic icmp packet, convert the network byte order 
-            //fields to host byte order
-            icmp_packet_t *icmp = process_icmp(ip);
+            //Now lets process the basic icmp packet
+            const icmp_packet_t *icmp = process_icmp(ip);
 
             //Now lets look deeper and see if the icmp packet is actually an
             //ICMP ECHO packet?
@@ -100,12 +765,11 @@ void decode_raw_packet(uint8_t *packet, uint64_t packet_len){
                 break;
             }
 
-            //Now lets process the icmp_packet as an icmp_echo_packet, again processing
-            //the network byte order fields
-            icmp_echo_packet_t *icmp_echo_packet = process_icmp_echo(icmp);
+            //Now lets process the icmp_packet as an icmp_echo_packet
+            const icmp_echo_packet_t *icmp_echo_packet = process_icmp_echo(icmp);
 
-            //The ICMP packet now has its network byte order fields
-            //adjusted, lets print it
+            //Lets print it, the accessors convert the network byte order
+            //fields as they are printed
             print_icmp_echo(icmp_echo_packet);
 
             break;
@@ -120,20 +784,22 @@ void decode_raw_packet(uint8_t *packet, uint64_t packet_len){
 
 /*
  *  This function takes a raw_packet that has already been verified to be an ARP
- *  packet.  It typecasts the raw_packet into an arp_packet_t *, and then 
- *  converts all of the network byte order fields into host byte order.
+ *  packet.  It typecasts the raw_packet into an arp_packet_t *.  The packet is
+ *  not changed, the network byte order fields are converted into host byte
+ *  order when they are read, with arp_op() and friends from pdu-view.h.
  */
-arp_packet_t *process_arp(raw_packet_t raw_packet) {
+const arp_packet_t *process_arp(const uint8_t *raw_packet) {
     
     //TODO: Implement this function.  Convert raw_packet via
-    //type conversion to arp_packet_t and then convert the
-    //network byte order fields to host byte order fields using
-    //ntohs() and/or ntohl().  Return a pointer to an arp_packet_t
-    //You do not need to allocate any memory. 
+    //type conversion to arp_packet_t and return a pointer to it.
+    //You do not need to allocate any memory.  Do not convert the
+    //fields in place, the packet might be in a read only capture
+    //file, read them with the accessors in pdu-view.h instead,
+    //they call ntohs() and/or ntohl() for you.
 
     //remove this after you implement the logic, just here to make sure
     //the program compiles
-    return (arp_packet_t *)raw_packet;
+    return (const arp_packet_t *)raw_packet;
 }
 
 /*
@@ -141,9 +807,10 @@ arp_packet_t *process_arp(raw_packet_t raw_packet) {
  *  printf.  It decodes and indicates in the output if the request was an 
  *  ARP_REQUEST or an ARP_RESPONSE
  */
-void print_arp(arp_packet_t *arp){
+void print_arp(const arp_packet_t *arp){
 //TODO:  take the arp parameter, of type arp_packet_t and print it out
-//nicely.  My output looks like below, but you dont have to make it look
+//nicely.  Use arp_htype(), arp_ptype() and arp_op() from pdu-view.h for
+//the fields that are in network byte order.  My output looks like below, but you dont have to make it look
 //exactly like this, just something nice. 
 /*
 Packet length = 60 bytes
@@ -174,7 +841,7 @@ ARP PACKET DETAILS
  *  true, if not return false.  You need to see if the "protocol" field in the
  *  IP PDU is set to ICMP_PTYPE to do this.
  */
-bool check_ip_for_icmp(ip_packet_t *ip){
+bool check_ip_for_icmp(const ip_packet_t *ip){
     //TODO:  This function inspects the provided IP packet and extracts
     //the protocol.  If the protocol is ICMP_PTYPE then we return true
     //otherwise we return false.  The function header gives some more
@@ -189,19 +856,18 @@ bool check_ip_for_icmp(ip_packet_t *ip){
  *  This function takes an IP packet and converts it into an icmp packet. Note
  *  that it is assumed that we already checked if the IP packet is encapsulating
  *  an ICMP packet.  So we need to type convert it from (ip_packet_t *) to
- *  (icmp_packet *).  There are some that need to be converted from
- *  network to host byte order. 
+ *  (icmp_packet *).  The fields in network byte order are left alone, they
+ *  are converted when they are read with icmp_checksum() from pdu-view.h.
  */
-icmp_packet_t *process_icmp(ip_packet_t *ip){
+const icmp_packet_t *process_icmp(const ip_packet_t *ip){
     //TODO: Implement this function.  Convert ip_packet via
-    //type conversion to icmp_packet_t and then convert the
-    //network byte order fields to host byte order fields using
-    //ntohs() and/or ntohl().  Return a pointer to an icmp_packet_t
-    //You do not need to allocate any memory. 
+    //type conversion to icmp_packet_t and return a pointer to
+    //it.  You do not need to allocate any memory, and do not
+    //change the packet.
 
     //remove this after you implement the logic, just here to make sure
     //the program compiles
-    return (icmp_packet_t *)ip;
+    return (const icmp_packet_t *)ip;
 }
 
 /*
@@ -210,7 +876,7 @@ icmp_packet_t *process_icmp(ip_packet_t *ip){
  *  ICMP_ECHO_REQUEST or ICMP_ECHO_RESPONSE.  If true, we return true. If not, its
  *  still ICMP but not of type ICMP_ECHO. 
  */
-bool is_icmp_echo(icmp_packet_t *icmp) {
+bool is_icmp_echo(const icmp_packet_t *icmp) {
     //TODO:  This function inspects the provided ICMP and checks
     //its type.  If the type is ICMP_ECHO_REQUEST or ICMP_ECHO_RESPONSE 
     //then reutrn true otherwise we return false.  The function header 
@@ -225,19 +891,19 @@ bool is_icmp_echo(icmp_packet_t *icmp) {
 /*
  *  This function takes a known ICMP packet, that has already been checked to be
  *  of type ECHO and converts it to an (icmp_echo_packet_t).  Like in the other
- *  cases this is simply a type converstion, but there are also a few fields to
- *  convert from network to host byte order.
+ *  cases this is simply a type converstion, the id, sequence and timestamp are
+ *  converted from network to host byte order when they are read with
+ *  icmp_echo_id() and friends from pdu-view.h.
  */
-icmp_echo_packet_t *process_icmp_echo(icmp_packet_t *icmp){
+const icmp_echo_packet_t *process_icmp_echo(const icmp_packet_t *icmp){
     //TODO: Implement this function.  Convert icmp_packet_t via
-    //type conversion to icmp_echo_packet_t and then convert the
-    //network byte order fields to host byte order fields using
-    //ntohs() and/or ntohl().  Return a pointer to an icmp_echo_packet_t
-    //You do not need to allocate any memory. 
+    //type conversion to icmp_echo_packet_t and return a pointer
+    //to it.  You do not need to allocate any memory, and do not
+    //change the packet.
 
     //remove this after you implement the logic, just here to make sure
     //the program compiles
-    return (icmp_echo_packet_t *)icmp;
+    return (const icmp_echo_packet_t *)icmp;
 }
 
 /*
@@ -250,10 +916,11 @@ icmp_echo_packet_t *process_icmp_echo(icmp_packet_t *icmp){
  * 
  *  gives the size of the payload buffer.
  */
-void print_icmp_echo(icmp_echo_packet_t *icmp_packet){
+void print_icmp_echo(const icmp_echo_packet_t *icmp_packet){
 //TODO:  take the icmp_packet parameter, of type icmp_echo_packet_t 
 //and print it out nicely.  My output looks like below, but you dont 
-//have to make it look exactly like this, just something nice. 
+//have to make it look exactly like this, just something nice.  The
+//accessors in pdu-view.h give you the fields in host byte order. 
 /*
 Packet length = 98 bytes
 Detected raw frame type from ethernet header: 0x800
@@ -274,10 +941,10 @@ ICMP PACKET DETAILS
 
     //after you print the echo header, print the payload.
 
-    //We can calculate the payload size using a macro i provided for you in
-    //packet.h. Check it out, but I am providing you the code to call it here
+    //We can calculate the payload size using a helper i provided for you in
+    //pdu-view.h. Check it out, but I am providing you the code to call it here
     //correctly.  You can thank me later. 
-    uint16_t payload_size = ICMP_Payload_Size(icmp_packet);
+    uint16_t payload_size = icmp_echo_payload_size(icmp_packet);
 
     //Now print the payload data
     print_icmp_payload(icmp_packet->icmp_payload, payload_size);
@@ -313,7 +980,7 @@ ICMP PACKET DETAILS
  * 0x0020 | 0x28  0x29  0x2a  0x2b  0x2c  0x2d  0x2e  0x2f  
  * 0x0028 | 0x30  0x31  0x32  0x33  0x34  0x35  0x36  0x37  
  */
-void print_icmp_payload(uint8_t *payload, uint16_t payload_size) {
+void print_icmp_payload(const uint8_t *payload, uint16_t payload_size) {
 //TODO:  this function takes the payload which is just basically an 
 //array of bytes and prints it out nicely.  My output is shown in the
 //function header, you can alter your output just make sure it looks
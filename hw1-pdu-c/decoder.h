@@ -1,22 +1,43 @@
 #pragma once
 
 #include "packet.h"
+#include "filter.h"
 
 #include<stdbool.h>
 
-//solution
-void decode_raw_packet(uint8_t *packet, uint64_t packet_len);
+//What decoder -b was asked to do
+typedef struct batch_opts_t {
+    const char *path;           //Capture file, NULL for the test cases
+    int threads;
+    uint64_t print_first;       //Frames to print one line each for, 0 for none
+    uint64_t print_last;
+    bool flows;                 //Add up conversations
+    size_t flow_max;            //Conversations kept at once
+    uint64_t flow_idle_ns;      //Quiet this long and a conversation is over, 0 for never
+    const filter_t *filter;     //Only frames that match are decoded, NULL for all of them
+    const char *iface;          //Capture live off this interface instead, Linux only
+    uint64_t count;             //Stop a live capture after this many frames, 0 to run until ^C
+} batch_opts_t;
 
-bool check_ip_for_icmp(ip_packet_t *ip);
-icmp_packet_t *process_icmp(ip_packet_t *ip);
-icmp_echo_packet_t *process_icmp_echo(icmp_packet_t *icmp);
-bool is_icmp_echo(icmp_packet_t *icmp);
-void print_icmp_echo(icmp_echo_packet_t *icmp_packet);
-void print_icmp_payload(uint8_t *payload, uint16_t payload_size);
+//solution
+void decode_raw_packet(const uint8_t *packet, uint64_t packet_len);
+int decode_capture_file(const char *path, const filter_t *filter);
+int decode_batch(const batch_opts_t *opts);
+#ifdef __linux__
+int decode_live(const batch_opts_t *opts);
+int decode_live_batch(const batch_opts_t *opts);
+#endif
+
+bool check_ip_for_icmp(const ip_packet_t *ip);
+const icmp_packet_t *process_icmp(const ip_packet_t *ip);
+const icmp_echo_packet_t *process_icmp_echo(const icmp_packet_t *icmp);
+bool is_icmp_echo(const icmp_packet_t *icmp);
+void print_icmp_echo(const icmp_echo_packet_t *icmp_packet);
+void print_icmp_payload(const uint8_t *payload, uint16_t payload_size);
 
 //void process_arp(arp_packet_t *arp);
-arp_packet_t *process_arp(raw_packet_t raw_packet);
-void print_arp(arp_packet_t *arp);
+const arp_packet_t *process_arp(const uint8_t *raw_packet);
+void print_arp(const arp_packet_t *arp);
 
 
 
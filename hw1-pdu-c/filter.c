@@ -0,0 +1,588 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include "filter.h"
+#include "frame-record.h"
+#include "pdu-view.h"
+
+#define ETH_HDR_LEN     sizeof(ether_pdu_t)
+#define IP_HDR_MIN      sizeof(ip_pdu_t)
+#define MAX_NODES       (FILTER_MAX_INSNS * 2)
+#define MAX_TOKEN       64
+
+//What an instruction reads out of the frame
+enum {
+    F_NONE, F_FRAME_LEN, F_ETH_TYPE, F_ARP_OP,
+    F_IP_PROTO, F_IP_SRC, F_IP_DST, F_IP_TTL, F_IP_LEN,
+    F_ICMP_TYPE, F_ICMP_CODE, F_ICMP_ID, F_ICMP_SEQ,
+    F_L4_SRC, F_L4_DST
+};
+
+enum { CMP_EQ, CMP_NE, CMP_LT, CMP_LE, CMP_GT, CMP_GE };
+
+static const char *CMP_NAMES[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+typedef struct field_name_t {
+    const char *name;
+    uint8_t  field;
+    uint8_t  either;                    //A second field, matching either one is enough
+    uint8_t  guard_field;               //The frame has to have guard_field & guard_mask == guard_k too
+    uint32_t guard_k;
+    uint32_t guard_mask;
+    uint32_t max;                       //Biggest value the field can hold
+} field_name_t;
+
+static const field_name_t FIELDS[] = {
+    { "frame.len",   F_FRAME_LEN, F_NONE,   F_NONE,     0,            0,    0xffffffff },
+    { "eth.type",    F_ETH_TYPE,  F_NONE,   F_NONE,     0,            0,    0xffff },
+    { "arp.op",      F_ARP_OP,    F_NONE,   F_NONE,     0,            0,    0xffff },
+    { "ip.proto",    F_IP_PROTO,  F_NONE,   F_NONE,     0,            0,    0xff },
+    { "ip.src",      F_IP_SRC,    F_NONE,   F_NONE,     0,            0,    0xffffffff },
+    { "ip.dst",      F_IP_DST,    F_NONE,   F_NONE,     0,            0,    0xffffffff },
+    { "ip.addr",     F_IP_SRC,    F_IP_DST, F_IP_SRC,   0,            0,    0xffffffff },
+    { "ip.ttl",      F_IP_TTL,    F_NONE,   F_NONE,     0,            0,    0xff },
+    { "ip.len",      F_IP_LEN,    F_NONE,   F_NONE,     0,            0,    0xffff },
+    { "icmp.type",   F_ICMP_TYPE, F_NONE,   F_NONE,     0,            0,    0xff },
+    { "icmp.code",   F_ICMP_CODE, F_NONE,   F_NONE,     0,            0,    0xff },
+    { "icmp.id",     F_ICMP_ID,   F_NONE,   F_NONE,     0,            0,    0xffff },
+    { "icmp.seq",    F_ICMP_SEQ,  F_NONE,   F_NONE,     0,            0,    0xffff },
+    { "tcp.srcport", F_L4_SRC,    F_NONE,   F_IP_PROTO, IP_PROTO_TCP, 0xff, 0xffff },
+    { "tcp.dstport", F_L4_DST,    F_NONE,   F_IP_PROTO, IP_PROTO_TCP, 0xff, 0xffff },
+    { "tcp.port",    F_L4_SRC,    F_L4_DST, F_IP_PROTO, IP_PROTO_TCP, 0xff, 0xffff },
+    { "udp.srcport", F_L4_SRC,    F_NONE,   F_IP_PROTO, IP_PROTO_UDP, 0xff, 0xffff },
+    { "udp.dstport", F_L4_DST,    F_NONE,   F_IP_PROTO, IP_PROTO_UDP, 0xff, 0xffff },
+    { "udp.port",    F_L4_SRC,    F_L4_DST, F_IP_PROTO, IP_PROTO_UDP, 0xff, 0xffff },
+};
+
+//Protocol names on their own, short for field == guard_k
+static const field_name_t PROTOCOLS[] = {
+    { "arp",  F_ETH_TYPE, F_NONE, F_NONE, ARP_PTYPE,    0, 0 },
+    { "ip",   F_ETH_TYPE, F_NONE, F_NONE, IP4_PTYPE,    0, 0 },
+    { "icmp", F_IP_PROTO, F_NONE, F_NONE, ICMP_PTYPE,   0, 0 },
+    { "tcp",  F_IP_PROTO, F_NONE, F_NONE, IP_PROTO_TCP, 0, 0 },
+    { "udp",  F_IP_PROTO, F_NONE, F_NONE, IP_PROTO_UDP, 0, 0 },
+};
+
+#define N_FIELDS    (sizeof(FIELDS) / sizeof(FIELDS[0]))
+#define N_PROTOCOLS (sizeof(PROTOCOLS) / sizeof(PROTOCOLS[0]))
+
+/********************************************************************************/
+/*                              RUNNING A FILTER                                */
+/********************************************************************************/
+
+//Where the IPv4 header ends, or 0 if the frame is not IPv4 or is cut short
+static inline uint32_t ip_payload(const uint8_t *frame, uint32_t len) {
+    uint32_t hdr;
+
+    if (len < ETH_HDR_LEN + IP_HDR_MIN ||
+        pdu_get16(frame + offsetof(ether_pdu_t, frame_type)) != IP4_PTYPE)
+        return 0;
+    hdr = (frame[ETH_HDR_LEN + offsetof(ip_pdu_t, version_ihl)] & 0x0f) * 4;
+    if (hdr < IP_HDR_MIN || ETH_HDR_LEN + hdr > len)
+        return 0;
+    return ETH_HDR_LEN + hdr;
+}
+
+//Where the ICMP header starts if it has at least need bytes, or 0
+static inline uint32_t icmp_at(const uint8_t *frame, uint32_t len, uint32_t need) {
+    uint32_t at = ip_payload(frame, len);
+
+    if (at == 0 || frame[ETH_HDR_LEN + offsetof(ip_pdu_t, protocol)] != ICMP_PTYPE ||
+        at + need > len)
+        return 0;
+    return at;
+}
+
+//Where the TCP or UDP ports are, or 0.  Only the first fragment has them
+static inline uint32_t ports_at(const uint8_t *frame, uint32_t len) {
+    uint32_t at = ip_payload(frame, len);
+    const uint8_t *ip = frame + ETH_HDR_LEN;
+
+    if (at == 0 || at + 4 > len ||
+        (ip[offsetof(ip_pdu_t, flags)] & 0x1f) != 0 || ip[offsetof(ip_pdu_t, fragment_offset)] != 0)
+        return 0;
+    return at;
+}
+
+//Reads field out of the frame into *value, returns 0 if the frame does not have it
+static inline int load(uint8_t field, const uint8_t *frame, uint32_t len, uint32_t *value) {
+    const uint8_t *ip = frame + ETH_HDR_LEN;
+    uint32_t at;
+
+    switch (field) {
+        case F_FRAME_LEN:
+            *value = len;
+            return 1;
+        case F_ETH_TYPE:
+            if (len < ETH_HDR_LEN)
+                return 0;
+            *value = pdu_get16(frame + offsetof(ether_pdu_t, frame_type));
+            return 1;
+        case F_ARP_OP:
+            if (len < ETH_HDR_LEN + sizeof(arp_pdu_t) ||
+                pdu_get16(frame + offsetof(ether_pdu_t, frame_type)) != ARP_PTYPE)
+                return 0;
+            *value = pdu_get16(ip + offsetof(arp_pdu_t, op));
+            return 1;
+        case F_IP_PROTO:
+        case F_IP_SRC:
+        case F_IP_DST:
+        case F_IP_TTL:
+        case F_IP_LEN:
+            if (ip_payload(frame, len) == 0)
+                return 0;
+            if (field == F_IP_PROTO)
+                *value = ip[offsetof(ip_pdu_t, protocol)];
+            else if (field == F_IP_SRC)
+                *value = pdu_get32(ip + offsetof(ip_pdu_t, source_address));
+            else if (field == F_IP_DST)
+                *value = pdu_get32(ip + offsetof(ip_pdu_t, destination_address));
+            else if (field == F_IP_TTL)
+                *value = ip[offsetof(ip_pdu_t, time_to_live)];
+            else
+                *value = pdu_get16(ip + offsetof(ip_pdu_t, total_length));
+            return 1;
+        case F_ICMP_TYPE:
+        case F_ICMP_CODE:
+            if ((at = icmp_at(frame, len, sizeof(icmp_pdu_t))) == 0)
+                return 0;
+            *value = frame[at + (field == F_ICMP_TYPE ? offsetof(icmp_pdu_t, type) : offsetof(icmp_pdu_t, code))];
+            return 1;
+        case F_ICMP_ID:
+        case F_ICMP_SEQ:
+            //Only echoes have an id and a sequence number
+            if ((at = icmp_at(frame, len, offsetof(icmp_echo_pdu_t, timestamp))) == 0 ||
+                (frame[at] != ICMP_ECHO_REQUEST && frame[at] != ICMP_ECHO_RESPONSE))
+                return 0;
+            *value = pdu_get16(frame + at + (field == F_ICMP_ID ? offsetof(icmp_echo_pdu_t, id)
+                                                               : offsetof(icmp_echo_pdu_t, sequence)));
+            return 1;
+        case F_L4_SRC:
+        case F_L4_DST:
+            if ((at = ports_at(frame, len)) == 0)
+                return 0;
+            *value = pdu_get16(frame + at + (field == F_L4_SRC ? 0 : 2));
+            return 1;
+    }
+    return 0;
+}
+
+static inline int compare(uint8_t cmp, uint32_t value, uint32_t k) {
+    switch (cmp) {
+        case CMP_EQ: return value == k;
+        case CMP_NE: return value != k;
+        case CMP_LT: return value < k;
+        case CMP_LE: return value <= k;
+        case CMP_GT: return value > k;
+        case CMP_GE: return value >= k;
+    }
+    return 0;
+}
+
+/*
+ *  Runs the filter over a frame of len bytes.  Returns 1 if it matches,
+ *  0 if it does not.  The frame is only read, so any number of threads
+ *  can run the same filter at once
+ */
+int filter_match(const filter_t *filter, const uint8_t *frame, uint32_t len) {
+    uint16_t pc = 0;
+
+    if (filter->n_insns == 0)
+        return 1;
+    for (;;) {
+        const filter_insn_t *insn = &filter->insns[pc];
+        uint32_t value;
+
+        if (load(insn->field, frame, len, &value) && compare(insn->cmp, value & insn->mask, insn->k))
+            pc = insn->jt;
+        else
+            pc = insn->jf;
+        if (pc >= FILTER_REJECT)
+            return pc == FILTER_ACCEPT;
+    }
+}
+
+/********************************************************************************/
+/*                             COMPILING A FILTER                               */
+/********************************************************************************/
+
+enum { N_CMP, N_AND, N_OR, N_NOT };
+
+typedef struct node_t {
+    uint8_t  type;
+    uint8_t  field;                     //N_CMP only
+    uint8_t  cmp;
+    uint32_t k;
+    uint32_t mask;
+    int      left;                      //N_AND, N_OR and N_NOT
+    int      right;
+} node_t;
+
+typedef struct parser_t {
+    const char *expr;
+    const char *pos;                    //Just past the current token
+    const char *tok_start;
+    char     tok[MAX_TOKEN];            //The current token, "" at the end
+    int      failed;
+    node_t   nodes[MAX_NODES];
+    int      n_nodes;
+    filter_t *filter;
+} parser_t;
+
+//Reports the first error only, the ones after it are knock on effects
+static void parse_error(parser_t *p, const char *msg) {
+    if (p->failed)
+        return;
+    p->failed = 1;
+    if (p->tok[0] == '\0')
+        fprintf(stderr, "filter: %s at the end of \"%s\"\n", msg, p->expr);
+    else
+        fprintf(stderr, "filter: %s at \"%s\" in \"%s\"\n", msg, p->tok_start, p->expr);
+}
+
+static void next_token(parser_t *p) {
+    static const char *OPS[] = { "==", "!=", "<=", ">=", "&&", "||", "<", ">", "!", "(", ")" };
+    const char *s = p->pos;
+    size_t n = 0;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    p->tok_start = s;
+    for (size_t i = 0; i < sizeof(OPS) / sizeof(OPS[0]) && n == 0; i++) {
+        if (strncmp(s, OPS[i], strlen(OPS[i])) == 0)
+            n = strlen(OPS[i]);
+    }
+    if (n == 0) {
+        while (isalnum((unsigned char)s[n]) || s[n] == '.' || s[n] == '/' || s[n] == '_')
+            n++;
+    }
+    if (n == 0 && *s != '\0')
+        n = 1;                          //Something we do not know, reported by the parser
+    if (n >= MAX_TOKEN)
+        n = MAX_TOKEN - 1;
+    memcpy(p->tok, s, n);
+    p->tok[n] = '\0';
+    p->pos = s + n;
+}
+
+static int accept_token(parser_t *p, const char *a, const char *b) {
+    if (strcmp(p->tok, a) == 0 || (b != NULL && strcmp(p->tok, b) == 0)) {
+        next_token(p);
+        return 1;
+    }
+    return 0;
+}
+
+static int new_node(parser_t *p, uint8_t type, int left, int right) {
+    node_t *node;
+
+    if (p->n_nodes == MAX_NODES) {
+        parse_error(p, "filter is too long");
+        return -1;
+    }
+    node = &p->nodes[p->n_nodes];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    return p->n_nodes++;
+}
+
+static int new_cmp(parser_t *p, uint8_t field, uint8_t cmp, uint32_t k, uint32_t mask) {
+    int n = new_node(p, N_CMP, -1, -1);
+
+    if (n >= 0) {
+        p->nodes[n].field = field;
+        p->nodes[n].cmp = cmp;
+        p->nodes[n].k = k & mask;
+        p->nodes[n].mask = mask;
+    }
+    return n;
+}
+
+//Reads an address with an optional /prefix into k and mask
+static int parse_address(const char *s, uint32_t *k, uint32_t *mask) {
+    char addr[MAX_TOKEN];
+    const char *slash = strchr(s, '/');
+    size_t len = slash != NULL ? (size_t)(slash - s) : strlen(s);
+    struct in_addr in;
+
+    memcpy(addr, s, len);
+    addr[len] = '\0';
+    if (inet_pton(AF_INET, addr, &in) != 1)
+        return -1;
+    *k = ntohl(in.s_addr);
+    *mask = 0xffffffff;
+    if (slash != NULL) {
+        char *end;
+        unsigned long bits = strtoul(slash + 1, &end, 10);
+
+        if (slash[1] == '\0' || *end != '\0' || bits > 32)
+            return -1;
+        *mask = bits == 0 ? 0 : 0xffffffffU << (32 - bits);
+    }
+    return 0;
+}
+
+//A comparison of one field, or of either field and the guard that goes with it
+static int field_test(parser_t *p, const field_name_t *f, uint8_t cmp, uint32_t k, uint32_t mask) {
+    int node, guard;
+
+    if (f->either == F_NONE) {
+        node = new_cmp(p, f->field, cmp, k, mask);
+    } else if (cmp == CMP_NE) {
+        //Neither end is k, rather than one of them is not
+        int a = new_cmp(p, f->field, CMP_EQ, k, mask);
+        int b = new_cmp(p, f->either, CMP_EQ, k, mask);
+        node = new_node(p, N_NOT, new_node(p, N_OR, a, b), -1);
+    } else {
+        int a = new_cmp(p, f->field, cmp, k, mask);
+        int b = new_cmp(p, f->either, cmp, k, mask);
+        node = new_node(p, N_OR, a, b);
+    }
+    //A guard with no mask only checks the frame has the field at all
+    if (f->guard_field == F_NONE)
+        return node;
+    guard = new_cmp(p, f->guard_field, CMP_EQ, f->guard_k, f->guard_mask);
+    return new_node(p, N_AND, guard, node);
+}
+
+static int parse_or(parser_t *p);
+
+//test := protocol | field cmp value | field in address/prefix
+static int parse_test(parser_t *p) {
+    const field_name_t *f = NULL;
+    char value[MAX_TOKEN];
+    uint32_t k, mask = 0xffffffff;
+    uint8_t cmp;
+    int in = 0;
+
+    for (size_t i = 0; i < N_PROTOCOLS; i++) {
+        if (strcmp(p->tok, PROTOCOLS[i].name) == 0) {
+            next_token(p);
+            return new_cmp(p, PROTOCOLS[i].field, CMP_EQ, PROTOCOLS[i].guard_k, 0xffffffff);
+        }
+    }
+    for (size_t i = 0; i < N_FIELDS; i++) {
+        if (strcmp(p->tok, FIELDS[i].name) == 0)
+            f = &FIELDS[i];
+    }
+    if (f == NULL) {
+        parse_error(p, "expected a field or protocol");
+        return -1;
+    }
+    next_token(p);
+
+    for (cmp = CMP_EQ; cmp <= CMP_GE; cmp++) {
+        if (strcmp(p->tok, CMP_NAMES[cmp]) == 0)
+            break;
+    }
+    if (cmp > CMP_GE) {
+        if (strcmp(p->tok, "in") != 0) {
+            parse_error(p, "expected a comparison");
+            return -1;
+        }
+        cmp = CMP_EQ;
+        in = 1;
+    }
+    next_token(p);
+
+    snprintf(value, sizeof(value), "%s", p->tok);
+    if (f->field == F_IP_SRC || f->field == F_IP_DST) {
+        //An address with a /prefix matches the whole network
+        if (parse_address(value, &k, &mask) < 0) {
+            parse_error(p, "expected an address");
+            return -1;
+        }
+        if (mask != 0xffffffff && cmp != CMP_EQ && cmp != CMP_NE) {
+            parse_error(p, "a network only goes with ==, != or in");
+            return -1;
+        }
+    } else {
+        char *end;
+        unsigned long long v = strtoull(value, &end, 0);
+
+        if (in) {
+            parse_error(p, "in only goes with ip.src, ip.dst and ip.addr");
+            return -1;
+        }
+        if (!isdigit((unsigned char)value[0]) || *end != '\0' || v > f->max) {
+            parse_error(p, "expected a number that fits the field");
+            return -1;
+        }
+        k = (uint32_t)v;
+    }
+    next_token(p);
+    return field_test(p, f, cmp, k, mask);
+}
+
+//unary := ('!' | 'not') unary | '(' or ')' | test
+static int parse_unary(parser_t *p) {
+    int node;
+
+    if (accept_token(p, "!", "not"))
+        return new_node(p, N_NOT, parse_unary(p), -1);
+    if (accept_token(p, "(", NULL)) {
+        node = parse_or(p);
+        if (!accept_token(p, ")", NULL))
+            parse_error(p, "expected )");
+        return node;
+    }
+    return parse_test(p);
+}
+
+//and := unary (('&&' | 'and') unary)*
+static int parse_and(parser_t *p) {
+    int node = parse_unary(p);
+
+    while (!p->failed && accept_token(p, "&&", "and"))
+        node = new_node(p, N_AND, node, parse_unary(p));
+    return node;
+}
+
+//or := and (('||' | 'or') and)*
+static int parse_or(parser_t *p) {
+    int node = parse_and(p);
+
+    while (!p->failed && accept_token(p, "||", "or"))
+        node = new_node(p, N_OR, node, parse_and(p));
+    return node;
+}
+
+/*
+ *  Emits the code for node, which goes on to t when node holds and f when
+ *  it does not, and returns where that code starts.  The code is emitted
+ *  back to front: the right hand side of && and || goes first, so the
+ *  left hand side already knows where to jump.  filter_compile() turns
+ *  the program around when it is done, which leaves every jump going
+ *  forward
+ */
+static int emit(parser_t *p, int n, uint16_t t, uint16_t f) {
+    const node_t *node = &p->nodes[n];
+    filter_insn_t *insn;
+    int right;
+
+    switch (node->type) {
+        case N_AND:
+            if ((right = emit(p, node->right, t, f)) < 0)
+                return -1;
+            return emit(p, node->left, (uint16_t)right, f);
+        case N_OR:
+            if ((right = emit(p, node->right, t, f)) < 0)
+                return -1;
+            return emit(p, node->left, t, (uint16_t)right);
+        case N_NOT:
+            return emit(p, node->left, f, t);
+    }
+
+    if (p->filter->n_insns == FILTER_MAX_INSNS) {
+        fprintf(stderr, "filter: \"%s\" needs more than %d instructions\n", p->expr, FILTER_MAX_INSNS);
+        return -1;
+    }
+    insn = &p->filter->insns[p->filter->n_insns];
+    memset(insn, 0, sizeof(*insn));
+    insn->field = node->field;
+    insn->cmp = node->cmp;
+    insn->jt = t;
+    insn->jf = f;
+    insn->k = node->k;
+    insn->mask = node->mask;
+    return (int)p->filter->n_insns++;
+}
+
+/*
+ *  Compiles expr into filter.  An empty expr gives a filter that matches
+ *  every frame.  Returns 0, or -1 after saying what is wrong with expr
+ */
+int filter_compile(filter_t *filter, const char *expr) {
+    parser_t *p = calloc(1, sizeof(parser_t));
+    size_t n;
+    int root;
+
+    if (p == NULL) {
+        perror("filter");
+        return -1;
+    }
+    memset(filter, 0, sizeof(*filter));
+    p->expr = p->pos = expr;
+    p->filter = filter;
+    next_token(p);
+    if (p->tok[0] == '\0') {
+        free(p);
+        return 0;
+    }
+
+    root = parse_or(p);
+    if (!p->failed && p->tok[0] != '\0')
+        parse_error(p, "expected && or ||");
+    if (p->failed || emit(p, root, FILTER_ACCEPT, FILTER_REJECT) < 0) {
+        filter->n_insns = 0;
+        free(p);
+        return -1;
+    }
+    free(p);
+
+    //The entry point was emitted last, turn the program around so it is first
+    n = filter->n_insns;
+    for (size_t i = 0; i < n / 2; i++) {
+        filter_insn_t tmp = filter->insns[i];
+        filter->insns[i] = filter->insns[n - 1 - i];
+        filter->insns[n - 1 - i] = tmp;
+    }
+    for (size_t i = 0; i < n; i++) {
+        filter_insn_t *insn = &filter->insns[i];
+        if (insn->jt < FILTER_REJECT)
+            insn->jt = (uint16_t)(n - 1 - insn->jt);
+        if (insn->jf < FILTER_REJECT)
+            insn->jf = (uint16_t)(n - 1 - insn->jf);
+    }
+    return 0;
+}
+
+static const char *field_name(uint8_t field) {
+    static const char *NAMES[] = {
+        "", "frame.len", "eth.type", "arp.op",
+        "ip.proto", "ip.src", "ip.dst", "ip.ttl", "ip.len",
+        "icmp.type", "icmp.code", "icmp.id", "icmp.seq",
+        "l4.srcport", "l4.dstport"
+    };
+    return field < sizeof(NAMES) / sizeof(NAMES[0]) ? NAMES[field] : "?";
+}
+
+static void format_target(uint16_t target, char *buff, size_t len) {
+    if (target == FILTER_ACCEPT)
+        snprintf(buff, len, "accept");
+    else if (target == FILTER_REJECT)
+        snprintf(buff, len, "reject");
+    else
+        snprintf(buff, len, "%03u", target);
+}
+
+//Prints the compiled program one instruction a line, like tcpdump -d
+void filter_print(const filter_t *filter, FILE *out) {
+    if (filter->n_insns == 0) {
+        fprintf(out, "(000) accept\n");
+        return;
+    }
+    for (size_t i = 0; i < filter->n_insns; i++) {
+        const filter_insn_t *insn = &filter->insns[i];
+        char value[40], jt[8], jf[8];
+
+        if (insn->field == F_IP_SRC || insn->field == F_IP_DST) {
+            int bits = 0;
+            while (bits < 32 && (insn->mask & (0x80000000U >> bits)))
+                bits++;
+            snprintf(value, sizeof(value), "%u.%u.%u.%u/%d", insn->k >> 24, (insn->k >> 16) & 0xff,
+                (insn->k >> 8) & 0xff, insn->k & 0xff, bits);
+        } else {
+            snprintf(value, sizeof(value), "0x%x", insn->k);
+        }
+        format_target(insn->jt, jt, sizeof(jt));
+        format_target(insn->jf, jf, sizeof(jf));
+        fprintf(out, "(%03lu) %-10s %-2s %-18s jt %-6s jf %s\n", (unsigned long)i,
+            field_name(insn->field), CMP_NAMES[insn->cmp], value, jt, jf);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+ *  Packet filters, like the ones tcpdump and wireshark take.
+ *
+ *      ip.proto == 1 && icmp.type == 8 && ip.src in 192.168.0.0/16
+ *      arp or (tcp.port == 80 and not ip.dst in 10.0.0.0/8)
+ *
+ *  A filter is compiled once into a short program.  Every instruction
+ *  reads one field straight out of the raw frame, compares it against a
+ *  constant and jumps to one of two later instructions depending on the
+ *  answer, until it lands on accept or reject.  && and || turn into
+ *  jumps, so a frame only reads the fields it needs to be decided, and a
+ *  frame that does not match is usually thrown out after an instruction
+ *  or two, long before anything is decoded or printed.  Jumps only go
+ *  forward, so every frame is decided in at most as many steps as there
+ *  are instructions.
+ *
+ *  Fields:     frame.len  eth.type  arp.op
+ *              ip.proto  ip.src  ip.dst  ip.addr  ip.ttl  ip.len
+ *              icmp.type  icmp.code  icmp.id  icmp.seq
+ *              tcp.srcport  tcp.dstport  tcp.port  (and the same for udp)
+ *  Protocols:  arp  ip  icmp  tcp  udp
+ *  Operators:  == != < <= > >=  in (an address and /prefix)
+ *              && and  || or  ! not  ( )
+ *
+ *  ip.addr and tcp.port match either end.  A field the frame does not have,
+ *  like icmp.type on an ARP frame, makes its comparison false.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define FILTER_MAX_INSNS    256
+#define FILTER_ACCEPT       0xFFFF      //Jump targets that end the program
+#define FILTER_REJECT       0xFFFE
+
+typedef struct filter_insn_t {
+    uint8_t  field;                     //What to read out of the frame
+    uint8_t  cmp;                       //How to compare it
+    uint16_t jt;                        //Next instruction if the comparison holds
+    uint16_t jf;                        //and if it does not
+    uint16_t pad;
+    uint32_t k;                         //Compare (field & mask) against this
+    uint32_t mask;
+} filter_insn_t;
+
+typedef struct filter_t {
+    size_t n_insns;                     //0 matches everything
+    filter_insn_t insns[FILTER_MAX_INSNS];
+} filter_t;
+
+int  filter_compile(filter_t *filter, const char *expr);
+int  filter_match(const filter_t *filter, const uint8_t *frame, uint32_t len);
+void filter_print(const filter_t *filter, FILE *out);
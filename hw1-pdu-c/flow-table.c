@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flow-table.h"
+
+#define FULL_SWEEP_NS   1000000000ULL   //Sweep a full table end to end at most this often
+
+static uint32_t ip_u32(const uint8_t *ip) {
+    return ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | ip[3];
+}
+
+/*
+ *  The key for an IPv4 record, with the lower address and port first so
+ *  both directions of a conversation get the same key.  Returns 0 if the
+ *  record is not part of a flow
+ */
+static int make_key(const frame_record_t *rec, flow_key_t *key) {
+    uint32_t src, dst;
+    uint16_t sport, dport;
+
+    if (rec->kind != FRAME_IPV4 && rec->kind != FRAME_ICMP && rec->kind != FRAME_ICMP_ECHO)
+        return 0;
+
+    src = ip_u32(rec->src_ip);
+    dst = ip_u32(rec->dst_ip);
+    if (rec->kind == FRAME_ICMP_ECHO) {
+        sport = dport = rec->icmp_id;
+    } else if (rec->kind == FRAME_ICMP) {
+        sport = dport = 0;
+    } else {
+        sport = rec->src_port;
+        dport = rec->dst_port;
+    }
+
+    memset(key, 0, sizeof(*key));
+    if (src < dst || (src == dst && sport <= dport)) {
+        key->addr_a = src;
+        key->addr_b = dst;
+        key->port_a = sport;
+        key->port_b = dport;
+    } else {
+        key->addr_a = dst;
+        key->addr_b = src;
+        key->port_a = dport;
+        key->port_b = sport;
+    }
+    key->proto = rec->ip_proto;
+    key->used = 1;
+    return 1;
+}
+
+static size_t key_hash(const flow_key_t *key) {
+    uint64_t h = ((uint64_t)key->addr_a << 32 | key->addr_b) * 0x9E3779B97F4A7C15ULL;
+
+    h ^= ((uint64_t)key->port_a << 24 | (uint64_t)key->port_b << 8 | key->proto) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (size_t)h;
+}
+
+//The slot that holds key, or the empty slot where it would go
+static size_t find_slot(const flow_table_t *ft, const flow_key_t *key) {
+    size_t mask = ft->capacity - 1;
+    size_t i = key_hash(key) & mask;
+
+    while (ft->keys[i].used && memcmp(&ft->keys[i], key, sizeof(*key)) != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+//Keeps the FLOW_TOP biggest conversations by bytes, biggest first
+static void offer_top(flow_table_t *ft, const flow_summary_t *flow) {
+    int i;
+
+    if (ft->n_top == FLOW_TOP && flow->bytes <= ft->top[FLOW_TOP - 1].bytes)
+        return;
+    if (ft->n_top < FLOW_TOP)
+        ft->n_top++;
+    for (i = ft->n_top - 1; i > 0 && ft->top[i - 1].bytes < flow->bytes; i--)
+        ft->top[i] = ft->top[i - 1];
+    ft->top[i] = *flow;
+}
+
+//Adds the flow in slot i to the totals, it is over
+static void summarize(flow_table_t *ft, size_t i) {
+    flow_summary_t flow;
+    flow_proto_t *proto = &ft->proto[ft->keys[i].proto];
+
+    flow.key = ft->keys[i];
+    flow.packets = ft->packets[i];
+    flow.bytes = ft->bytes[i];
+    flow.first_ns = ft->first_ns[i];
+    flow.last_ns = ft->last_ns[i];
+
+    proto->flows++;
+    proto->packets += flow.packets;
+    proto->bytes += flow.bytes;
+    offer_top(ft, &flow);
+}
+
+static void move_slot(flow_table_t *ft, size_t to, size_t from) {
+    ft->keys[to] = ft->keys[from];
+    ft->packets[to] = ft->packets[from];
+    ft->bytes[to] = ft->bytes[from];
+    ft->first_ns[to] = ft->first_ns[from];
+    ft->last_ns[to] = ft->last_ns[from];
+}
+
+/*
+ *  Empties slot i.  With linear probing a hole would cut off the flows
+ *  after it that were pushed past their home slot, so those are moved
+ *  back into the hole one at a time, which leaves no tombstones behind
+ */
+static void remove_slot(flow_table_t *ft, size_t i) {
+    size_t mask = ft->capacity - 1;
+    size_t j = i;
+
+    for (;;) {
+        size_t home;
+
+        j = (j + 1) & mask;
+        if (!ft->keys[j].used)
+            break;
+        home = key_hash(&ft->keys[j]) & mask;
+        //Leave it if its home is cyclically in (i, j], it is still reachable
+        if (i <= j ? (home > i && home <= j) : (home > i || home <= j))
+            continue;
+        move_slot(ft, i, j);
+        i = j;
+    }
+    ft->keys[i].used = 0;
+    ft->count--;
+}
+
+static int is_idle(const flow_table_t *ft, size_t i) {
+    return ft->idle_ns != 0 && ft->now_ns > ft->last_ns[i] &&
+           ft->now_ns - ft->last_ns[i] > ft->idle_ns;
+}
+
+//Looks at steps slots from where the sweep left off, expiring idle flows
+static void sweep(flow_table_t *ft, size_t steps) {
+    size_t mask = ft->capacity - 1;
+
+    while (steps > 0) {
+        size_t i = ft->sweep;
+
+        if (ft->keys[i].used && is_idle(ft, i)) {
+            summarize(ft, i);
+            remove_slot(ft, i);
+            ft->expired++;
+            continue;           //Another flow may have moved into slot i
+        }
+        ft->sweep = (i + 1) & mask;
+        steps--;
+    }
+}
+
+/*
+ *  Sets up a table for up to max_flows flows at once, expiring any that
+ *  are idle for idle_ns of capture time, 0 to never expire them.
+ *  Returns 0, or -1 if there is not enough memory
+ */
+int flow_table_init(flow_table_t *ft, size_t max_flows, uint64_t idle_ns) {
+    memset(ft, 0, sizeof(*ft));
+    if (max_flows == 0)
+        max_flows = FLOW_MAX_DEFAULT;
+
+    //Keep the table at most 3/4 full, probes get long after that
+    ft->capacity = 16;
+    while (ft->capacity < max_flows + max_flows / 3)
+        ft->capacity <<= 1;
+    ft->max_flows = max_flows;
+    ft->idle_ns = idle_ns;
+
+    ft->keys = calloc(ft->capacity, sizeof(flow_key_t));
+    ft->packets = malloc(ft->capacity * sizeof(uint64_t));
+    ft->bytes = malloc(ft->capacity * sizeof(uint64_t));
+    ft->first_ns = malloc(ft->capacity * sizeof(uint64_t));
+    ft->last_ns = malloc(ft->capacity * sizeof(uint64_t));
+    if (ft->keys == NULL || ft->packets == NULL || ft->bytes == NULL ||
+        ft->first_ns == NULL || ft->last_ns == NULL) {
+        perror("flow table");
+        flow_table_free(ft);
+        return -1;
+    }
+    return 0;
+}
+
+void flow_table_free(flow_table_t *ft) {
+    free(ft->keys);
+    free(ft->packets);
+    free(ft->bytes);
+    free(ft->first_ns);
+    free(ft->last_ns);
+    ft->keys = NULL;
+    ft->packets = ft->bytes = ft->first_ns = ft->last_ns = NULL;
+}
+
+//Adds a batch of records, in capture order
+void flow_table_add(flow_table_t *ft, const frame_record_t *recs, size_t count) {
+    for (size_t n = 0; n < count; n++) {
+        const frame_record_t *rec = &recs[n];
+        flow_key_t key;
+        size_t i;
+
+        if (!make_key(rec, &key)) {
+            ft->no_flow++;
+            continue;
+        }
+        if (rec->ts_ns > ft->now_ns)
+            ft->now_ns = rec->ts_ns;
+        sweep(ft, FLOW_SWEEP_STEP);
+
+        i = find_slot(ft, &key);
+        if (ft->keys[i].used) {
+            ft->packets[i]++;
+            ft->bytes[i] += rec->len;
+            if (rec->ts_ns > ft->last_ns[i])
+                ft->last_ns[i] = rec->ts_ns;
+            continue;
+        }
+
+        //A new flow.  If the table is full, see if a full sweep makes room
+        if (ft->count >= ft->max_flows && ft->idle_ns != 0 &&
+            ft->now_ns - ft->full_sweep_ns >= FULL_SWEEP_NS) {
+            ft->full_sweep_ns = ft->now_ns;
+            sweep(ft, ft->capacity);
+            i = find_slot(ft, &key);
+        }
+        if (ft->count >= ft->max_flows) {
+            ft->dropped++;
+            continue;
+        }
+        ft->keys[i] = key;
+        ft->packets[i] = 1;
+        ft->bytes[i] = rec->len;
+        ft->first_ns[i] = ft->last_ns[i] = rec->ts_ns;
+        ft->count++;
+        ft->flows++;
+        if (ft->count > ft->peak)
+            ft->peak = ft->count;
+    }
+}
+
+//The capture is over, every flow still open goes into the totals
+void flow_table_finish(flow_table_t *ft) {
+    ft->open_at_end = ft->count;
+    for (size_t i = 0; i < ft->capacity; i++) {
+        if (ft->keys[i].used) {
+            summarize(ft, i);
+            ft->keys[i].used = 0;
+        }
+    }
+    ft->count = 0;
+}
+
+/*
+ *  Adds the totals of src into dst, both finished, for tables kept apart
+ *  by several threads that each saw different conversations.  The peaks
+ *  are added up too, which is as many as there could have been at once
+ */
+void flow_table_merge(flow_table_t *dst, const flow_table_t *src) {
+    dst->flows += src->flows;
+    dst->open_at_end += src->open_at_end;
+    dst->peak += src->peak;
+    dst->expired += src->expired;
+    dst->dropped += src->dropped;
+    dst->no_flow += src->no_flow;
+    for (int proto = 0; proto < 256; proto++) {
+        dst->proto[proto].flows += src->proto[proto].flows;
+        dst->proto[proto].packets += src->proto[proto].packets;
+        dst->proto[proto].bytes += src->proto[proto].bytes;
+    }
+    for (int i = 0; i < src->n_top; i++)
+        offer_top(dst, &src->top[i]);
+}
+
+static void format_end(const flow_key_t *key, uint32_t addr, uint16_t port, char *buff, size_t len) {
+    int n = snprintf(buff, len, "%u.%u.%u.%u", addr >> 24, (addr >> 16) & 0xff,
+                     (addr >> 8) & 0xff, addr & 0xff);
+
+    if (key->proto == IP_PROTO_TCP || key->proto == IP_PROTO_UDP)
+        snprintf(buff + n, len - n, ":%u", port);
+}
+
+void flow_table_print(const flow_table_t *ft, FILE *out) {
+    fprintf(out, "Flows:      %lu, %lu still open at the end, %lu at most at once\n",
+        (unsigned long)ft->flows, (unsigned long)ft->open_at_end, (unsigned long)ft->peak);
+    if (ft->idle_ns != 0)
+        fprintf(out, "Expired:    %lu idle for more than %.0f s\n", (unsigned long)ft->expired,
+            ft->idle_ns / 1e9);
+    if (ft->dropped != 0)
+        fprintf(out, "Dropped:    %lu packets, the table was full at %lu flows\n",
+            (unsigned long)ft->dropped, (unsigned long)ft->max_flows);
+    if (ft->no_flow != 0)
+        fprintf(out, "Not IPv4:   %lu frames\n", (unsigned long)ft->no_flow);
+
+    fprintf(out, "\n%-24s %12s %12s %14s\n", "FLOW PROTOCOL", "FLOWS", "PACKETS", "BYTES");
+    for (int proto = 0; proto < 256; proto++) {
+        const flow_proto_t *p = &ft->proto[proto];
+        if (p->flows != 0)
+            fprintf(out, "%3d %-20s %12lu %12lu %14lu\n", proto, ip_proto_name(proto),
+                (unsigned long)p->flows, (unsigned long)p->packets, (unsigned long)p->bytes);
+    }
+
+    fprintf(out, "\n%-6s %-21s %-21s %10s %14s %9s\n", "TOP", "HOST A", "HOST B", "PACKETS",
+        "BYTES", "SECONDS");
+    for (int i = 0; i < ft->n_top; i++) {
+        const flow_summary_t *f = &ft->top[i];
+        char a[32], b[32], proto[8];
+
+        format_end(&f->key, f->key.addr_a, f->key.port_a, a, sizeof(a));
+        format_end(&f->key, f->key.addr_b, f->key.port_b, b, sizeof(b));
+        if (ip_proto_name(f->key.proto)[0] != '\0')
+            snprintf(proto, sizeof(proto), "%s", ip_proto_name(f->key.proto));
+        else
+            snprintf(proto, sizeof(proto), "%u", f->key.proto);
+        fprintf(out, "%-6s %-21s %-21s %10lu %14lu %9.3f", proto, a, b,
+            (unsigned long)f->packets, (unsigned long)f->bytes,
+            (f->last_ns - f->first_ns) / 1e9);
+        if (f->key.proto == ICMP_PTYPE && f->key.port_a != 0)
+            fprintf(out, "  echo id 0x%04x", f->key.port_a);
+        fprintf(out, "\n");
+    }
+}
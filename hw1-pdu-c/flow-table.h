@@ -0,0 +1,90 @@
+#pragma once
+
+/*
+ *  Conversations between hosts, built up from decoded frame records.
+ *
+ *  A flow is keyed by protocol, both addresses and both ports, or the
+ *  echo id for ICMP.  The two ends are put in a fixed order, so a request
+ *  and its reply land on the same flow.  Frames that are not IPv4 (ARP and
+ *  the like) are not part of any flow.
+ *
+ *  The table is a single array with open addressing and linear probing.
+ *  Keys live in one array and each counter in an array of its own, so a
+ *  lookup only walks the keys, which are packed together, and touches the
+ *  counters once it has found its slot.  The table never grows: a flow
+ *  that has seen nothing for idle_ns of capture time is expired by a
+ *  sweep that looks at a few slots for every frame, and when the table
+ *  is full anyway new flows are not tracked and counted as dropped.
+ *
+ *  When a flow expires, and for every flow left at the end, its counters
+ *  go into the per protocol totals and into the list of the FLOW_TOP
+ *  biggest conversations.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "frame-record.h"
+
+#define FLOW_MAX_DEFAULT    (1 << 17)   //Flows tracked at once, about 12MB
+#define FLOW_IDLE_DEFAULT   60          //Seconds of capture time before a flow expires
+#define FLOW_SWEEP_STEP     2           //Slots checked for expiry per frame
+#define FLOW_TOP            10          //Conversations in the report
+
+typedef struct flow_key_t {
+    uint32_t addr_a;                    //The lower end, host byte order
+    uint32_t addr_b;
+    uint16_t port_a;                    //Or the ICMP echo id
+    uint16_t port_b;
+    uint8_t  proto;
+    uint8_t  used;                      //0 for an empty slot
+    uint16_t pad;
+} flow_key_t;
+
+//A conversation that is over, or still going at the end
+typedef struct flow_summary_t {
+    flow_key_t key;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first_ns;
+    uint64_t last_ns;
+} flow_summary_t;
+
+typedef struct flow_proto_t {
+    uint64_t flows;
+    uint64_t packets;
+    uint64_t bytes;
+} flow_proto_t;
+
+typedef struct flow_table_t {
+    size_t   capacity;                  //Slots, a power of two
+    size_t   max_flows;                 //Flows tracked at once, under capacity
+    size_t   count;
+    size_t   peak;
+    size_t   open_at_end;               //Flows still going when the capture ended
+    size_t   sweep;                     //Next slot the expiry sweep looks at
+    uint64_t idle_ns;                   //0 to never expire
+    uint64_t now_ns;                    //Latest capture time seen
+    uint64_t full_sweep_ns;             //When the table was last swept end to end
+
+    flow_key_t *keys;
+    uint64_t *packets;
+    uint64_t *bytes;
+    uint64_t *first_ns;
+    uint64_t *last_ns;
+
+    uint64_t flows;                     //Flows ever created
+    uint64_t expired;
+    uint64_t dropped;                   //Packets for new flows while the table was full
+    uint64_t no_flow;                   //Frames that are not IPv4
+    flow_proto_t proto[256];
+    flow_summary_t top[FLOW_TOP];       //Biggest by bytes, biggest first
+    int      n_top;
+} flow_table_t;
+
+int  flow_table_init(flow_table_t *ft, size_t max_flows, uint64_t idle_ns);
+void flow_table_free(flow_table_t *ft);
+void flow_table_add(flow_table_t *ft, const frame_record_t *recs, size_t count);
+void flow_table_finish(flow_table_t *ft);
+void flow_table_merge(flow_table_t *dst, const flow_table_t *src);
+void flow_table_print(const flow_table_t *ft, FILE *out);
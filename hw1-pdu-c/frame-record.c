@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "frame-record.h"
+#include "pdu-view.h"
+
+//Offsets of the headers that follow the ethernet header
+#define ETH_HDR_LEN     sizeof(ether_pdu_t)
+#define IP_HDR_MIN      sizeof(ip_pdu_t)
+#define ICMP_ECHO_MIN   offsetof(icmp_echo_pdu_t, timestamp)   //Up to the sequence number
+
+static void decode_arp(const uint8_t *arp, uint32_t len, frame_record_t *rec) {
+    if (len < sizeof(arp_pdu_t)) {
+        rec->kind = FRAME_MALFORMED;
+        return;
+    }
+    rec->kind = FRAME_ARP;
+    rec->arp_op = pdu_get16(arp + offsetof(arp_pdu_t, op));
+    memcpy(rec->src_ip, arp + offsetof(arp_pdu_t, spa), IP4_ALEN);
+    memcpy(rec->dst_ip, arp + offsetof(arp_pdu_t, tpa), IP4_ALEN);
+}
+
+static void decode_icmp(const uint8_t *icmp, uint32_t len, frame_record_t *rec) {
+    if (len < sizeof(icmp_pdu_t)) {
+        rec->kind = FRAME_MALFORMED;
+        return;
+    }
+    rec->kind = FRAME_ICMP;
+    rec->icmp_type = icmp[offsetof(icmp_pdu_t, type)];
+    rec->icmp_code = icmp[offsetof(icmp_pdu_t, code)];
+    if (rec->icmp_type != ICMP_ECHO_REQUEST && rec->icmp_type != ICMP_ECHO_RESPONSE)
+        return;
+    if (len < ICMP_ECHO_MIN)
+        return;
+
+    rec->kind = FRAME_ICMP_ECHO;
+    rec->icmp_id = pdu_get16(icmp + offsetof(icmp_echo_pdu_t, id));
+    rec->icmp_seq = pdu_get16(icmp + offsetof(icmp_echo_pdu_t, sequence));
+    //Most pings start the payload with when they were sent
+    if (len >= sizeof(icmp_echo_pdu_t)) {
+        rec->icmp_ts = pdu_get32(icmp + offsetof(icmp_echo_pdu_t, timestamp));
+        rec->icmp_ts_frac = pdu_get32(icmp + offsetof(icmp_echo_pdu_t, timestamp_ms));
+    }
+}
+
+static void decode_ip(const uint8_t *ip, uint32_t len, frame_record_t *rec) {
+    uint32_t hdr_len;
+    uint16_t frag;
+
+    if (len < IP_HDR_MIN) {
+        rec->kind = FRAME_MALFORMED;
+        return;
+    }
+    //The header can be longer than ip_pdu_t when it has options
+    hdr_len = (ip[offsetof(ip_pdu_t, version_ihl)] & 0x0f) * 4;
+    if (hdr_len < IP_HDR_MIN || hdr_len > len) {
+        rec->kind = FRAME_MALFORMED;
+        return;
+    }
+    rec->kind = FRAME_IPV4;
+    rec->ip_proto = ip[offsetof(ip_pdu_t, protocol)];
+    memcpy(rec->src_ip, ip + offsetof(ip_pdu_t, source_address), IP4_ALEN);
+    memcpy(rec->dst_ip, ip + offsetof(ip_pdu_t, destination_address), IP4_ALEN);
+    if (rec->ip_proto == ICMP_PTYPE) {
+        decode_icmp(ip + hdr_len, len - hdr_len, rec);
+        return;
+    }
+
+    //Only the first fragment has the TCP or UDP header
+    frag = ((ip[offsetof(ip_pdu_t, flags)] & 0x1f) << 8) | ip[offsetof(ip_pdu_t, fragment_offset)];
+    if ((rec->ip_proto == IP_PROTO_TCP || rec->ip_proto == IP_PROTO_UDP) &&
+        frag == 0 && len - hdr_len >= 4) {
+        rec->src_port = pdu_get16(ip + hdr_len);
+        rec->dst_port = pdu_get16(ip + hdr_len + 2);
+    }
+}
+
+/*
+ *  Decodes one frame of len bytes into rec, without printing anything or
+ *  changing the frame.  rec->frame_no and rec->ts_ns are left at 0 for
+ *  the caller to fill in
+ */
+void decode_frame(const uint8_t *frame, uint32_t len, frame_record_t *rec) {
+    memset(rec, 0, sizeof(*rec));
+    rec->len = len;
+    if (len < ETH_HDR_LEN) {
+        rec->kind = FRAME_MALFORMED;
+        return;
+    }
+
+    memcpy(rec->dst_mac, frame + offsetof(ether_pdu_t, dest_addr), ETH_ALEN);
+    memcpy(rec->src_mac, frame + offsetof(ether_pdu_t, src_addr), ETH_ALEN);
+    rec->ether_type = pdu_get16(frame + offsetof(ether_pdu_t, frame_type));
+
+    switch (rec->ether_type) {
+        case ARP_PTYPE:
+            decode_arp(frame + ETH_HDR_LEN, len - ETH_HDR_LEN, rec);
+            break;
+        case IP4_PTYPE:
+            decode_ip(frame + ETH_HDR_LEN, len - ETH_HDR_LEN, rec);
+            break;
+        default:
+            rec->kind = FRAME_OTHER;
+    }
+}
+
+void decode_stats_init(decode_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+//Adds a batch of records to the totals
+void decode_stats_add(decode_stats_t *stats, const frame_record_t *recs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const frame_record_t *rec = &recs[i];
+
+        stats->frames++;
+        stats->bytes += rec->len;
+        stats->kind_frames[rec->kind]++;
+        stats->kind_bytes[rec->kind] += rec->len;
+        if (rec->kind == FRAME_IPV4 || rec->kind == FRAME_ICMP || rec->kind == FRAME_ICMP_ECHO)
+            stats->ip_proto[rec->ip_proto]++;
+        if (rec->kind == FRAME_ICMP || rec->kind == FRAME_ICMP_ECHO)
+            stats->icmp_type[rec->icmp_type]++;
+        if (rec->kind == FRAME_ARP) {
+            stats->arp_requests += rec->arp_op == ARP_REQ_OP;
+            stats->arp_replies += rec->arp_op == ARP_RSP_OP;
+        }
+        if (rec->ts_ns != 0) {
+            if (stats->first_ts_ns == 0 || rec->ts_ns < stats->first_ts_ns)
+                stats->first_ts_ns = rec->ts_ns;
+            if (rec->ts_ns > stats->last_ts_ns)
+                stats->last_ts_ns = rec->ts_ns;
+        }
+    }
+}
+
+//Adds the totals in src into dst, for totals kept apart by several threads
+void decode_stats_merge(decode_stats_t *dst, const decode_stats_t *src) {
+    dst->frames += src->frames;
+    dst->bytes += src->bytes;
+    for (int kind = 0; kind < FRAME_KINDS; kind++) {
+        dst->kind_frames[kind] += src->kind_frames[kind];
+        dst->kind_bytes[kind] += src->kind_bytes[kind];
+    }
+    for (int i = 0; i < 256; i++) {
+        dst->ip_proto[i] += src->ip_proto[i];
+        dst->icmp_type[i] += src->icmp_type[i];
+    }
+    dst->arp_requests += src->arp_requests;
+    dst->arp_replies += src->arp_replies;
+    if (src->first_ts_ns != 0 && (dst->first_ts_ns == 0 || src->first_ts_ns < dst->first_ts_ns))
+        dst->first_ts_ns = src->first_ts_ns;
+    if (src->last_ts_ns > dst->last_ts_ns)
+        dst->last_ts_ns = src->last_ts_ns;
+}
+
+static const char *kind_name(int kind) {
+    switch (kind) {
+        case FRAME_ARP:         return "ARP";
+        case FRAME_IPV4:        return "IPv4 not ICMP";
+        case FRAME_ICMP:        return "ICMP not echo";
+        case FRAME_ICMP_ECHO:   return "ICMP echo";
+        case FRAME_MALFORMED:   return "Malformed";
+        default:                return "Other";
+    }
+}
+
+const char *ip_proto_name(int proto) {
+    switch (proto) {
+        case 1:     return "ICMP";
+        case 2:     return "IGMP";
+        case 6:     return "TCP";
+        case 17:    return "UDP";
+        case 47:    return "GRE";
+        case 50:    return "ESP";
+        case 89:    return "OSPF";
+        case 132:   return "SCTP";
+        default:    return "";
+    }
+}
+
+static const char *icmp_type_name(int type) {
+    switch (type) {
+        case ICMP_ECHO_RESPONSE:    return "echo reply";
+        case 3:                     return "destination unreachable";
+        case 5:                     return "redirect";
+        case ICMP_ECHO_REQUEST:     return "echo request";
+        case 11:                    return "time exceeded";
+        default:                    return "";
+    }
+}
+
+//Formats a capture time like get_ts_formatted(), with microseconds
+static void format_ts(uint64_t ts_ns, char *buff, size_t len) {
+    time_t secs = ts_ns / 1000000000;
+    char date[26];
+
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+    snprintf(buff, len, "%s.%06lu", date, (unsigned long)(ts_ns % 1000000000 / 1000));
+}
+
+//Prints the totals as tables, only the rows that have something in them
+void decode_stats_print(const decode_stats_t *stats, FILE *out) {
+    char first[48], last[48];
+
+    fprintf(out, "Frames:     %lu, %lu bytes\n", (unsigned long)stats->frames,
+        (unsigned long)stats->bytes);
+    if (stats->last_ts_ns != 0) {
+        format_ts(stats->first_ts_ns, first, sizeof(first));
+        format_ts(stats->last_ts_ns, last, sizeof(last));
+        fprintf(out, "Captured:   %s to %s, %.3f s\n", first, last,
+            (stats->last_ts_ns - stats->first_ts_ns) / 1e9);
+    }
+
+    fprintf(out, "\n%-24s %12s %14s %7s\n", "FRAME TYPE", "FRAMES", "BYTES", "%");
+    for (int kind = 0; kind < FRAME_KINDS; kind++) {
+        if (stats->kind_frames[kind] == 0)
+            continue;
+        fprintf(out, "%-24s %12lu %14lu %6.2f%%\n", kind_name(kind),
+            (unsigned long)stats->kind_frames[kind], (unsigned long)stats->kind_bytes[kind],
+            100.0 * stats->kind_frames[kind] / stats->frames);
+    }
+    if (stats->kind_frames[FRAME_ARP] != 0) {
+        fprintf(out, "\nARP:        %lu requests, %lu replies\n",
+            (unsigned long)stats->arp_requests, (unsigned long)stats->arp_replies);
+    }
+
+    fprintf(out, "\n%-24s %12s\n", "IP PROTOCOL", "FRAMES");
+    for (int proto = 0; proto < 256; proto++) {
+        if (stats->ip_proto[proto] != 0)
+            fprintf(out, "%3d %-20s %12lu\n", proto, ip_proto_name(proto),
+                (unsigned long)stats->ip_proto[proto]);
+    }
+
+    fprintf(out, "\n%-24s %12s\n", "ICMP TYPE", "FRAMES");
+    for (int type = 0; type < 256; type++) {
+        if (stats->icmp_type[type] != 0)
+            fprintf(out, "%3d %-20s %12lu\n", type, icmp_type_name(type),
+                (unsigned long)stats->icmp_type[type]);
+    }
+}
+
+/*
+ *  Prints one record on one line, for looking at a few frames out of a
+ *  big capture without printing all of them
+ */
+void print_frame_record(const frame_record_t *rec, FILE *out) {
+    const uint8_t *s = rec->src_ip, *d = rec->dst_ip;
+    char ts[48] = "";
+
+    fprintf(out, "#%lu ", (unsigned long)rec->frame_no);
+    if (rec->ts_ns != 0) {
+        format_ts(rec->ts_ns, ts, sizeof(ts));
+        fprintf(out, "%s ", ts);
+    }
+
+    switch (rec->kind) {
+        case FRAME_ARP:
+            if (rec->arp_op == ARP_REQ_OP)
+                fprintf(out, "ARP who has %u.%u.%u.%u tell %u.%u.%u.%u",
+                    d[0], d[1], d[2], d[3], s[0], s[1], s[2], s[3]);
+            else
+                fprintf(out, "ARP op %u %u.%u.%u.%u > %u.%u.%u.%u", rec->arp_op,
+                    s[0], s[1], s[2], s[3], d[0], d[1], d[2], d[3]);
+            break;
+        case FRAME_IPV4:
+        case FRAME_ICMP:
+        case FRAME_ICMP_ECHO:
+            fprintf(out, "IPv4 %u.%u.%u.%u > %u.%u.%u.%u ",
+                s[0], s[1], s[2], s[3], d[0], d[1], d[2], d[3]);
+            if (rec->kind == FRAME_IPV4 && (rec->src_port != 0 || rec->dst_port != 0))
+                fprintf(out, "%s ports %u > %u", ip_proto_name(rec->ip_proto),
+                    rec->src_port, rec->dst_port);
+            else if (rec->kind == FRAME_IPV4)
+                fprintf(out, "proto %u %s", rec->ip_proto, ip_proto_name(rec->ip_proto));
+            else if (rec->kind == FRAME_ICMP)
+                fprintf(out, "ICMP type %u code %u", rec->icmp_type, rec->icmp_code);
+            else
+                fprintf(out, "ICMP %s id 0x%04x seq %u", icmp_type_name(rec->icmp_type),
+                    rec->icmp_id, rec->icmp_seq);
+            break;
+        case FRAME_MALFORMED:
+            fprintf(out, "malformed, type 0x%04x", rec->ether_type);
+            break;
+        default:
+            fprintf(out, "ethernet type 0x%04x", rec->ether_type);
+    }
+    fprintf(out, ", %u bytes\n", rec->len);
+}
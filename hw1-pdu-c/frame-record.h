@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+ *  Batch decoding.  decode_raw_packet() prints several lines for every
+ *  frame, which is fine for a handful of test frames but on a big capture
+ *  the time all goes into printf().  Here each frame is decoded into a
+ *  small fixed size record instead, with the fields we care about already
+ *  in host byte order, and the records are added up into totals that are
+ *  printed once at the end.  The frame itself is only read, never changed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "packet.h"
+
+//What decode_frame() found
+#define FRAME_OTHER         0       //An ethernet type we do not decode
+#define FRAME_ARP           1
+#define FRAME_IPV4          2       //IPv4 carrying something other than ICMP
+#define FRAME_ICMP          3       //ICMP that is not an echo
+#define FRAME_ICMP_ECHO     4
+#define FRAME_MALFORMED     5       //Too short for the headers it claims to have
+#define FRAME_KINDS         6
+
+#define FRAME_BATCH         1024    //Records decoded before they are added up
+
+#define IP_PROTO_TCP        6
+#define IP_PROTO_UDP        17
+
+typedef struct frame_record_t {
+    uint64_t frame_no;              //Position in the input, from 1
+    uint64_t ts_ns;                 //Capture time, 0 if there is none
+    uint32_t len;                   //Bytes captured
+    uint16_t ether_type;
+    uint16_t arp_op;
+    uint8_t  kind;
+    uint8_t  ip_proto;
+    uint8_t  icmp_type;
+    uint8_t  icmp_code;
+    union {
+        struct {
+            uint16_t icmp_id;
+            uint16_t icmp_seq;
+        };
+        struct {
+            uint16_t src_port;      //TCP and UDP, 0 for a fragment after the first
+            uint16_t dst_port;
+        };
+    };
+    uint32_t icmp_ts;               //Echo timestamp, seconds
+    uint32_t icmp_ts_frac;          //and the fraction of a second
+    uint8_t  src_mac[ETH_ALEN];
+    uint8_t  dst_mac[ETH_ALEN];
+    uint8_t  src_ip[IP4_ALEN];      //For ARP the sender and target addresses
+    uint8_t  dst_ip[IP4_ALEN];
+} frame_record_t;
+
+typedef struct decode_stats_t {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t kind_frames[FRAME_KINDS];
+    uint64_t kind_bytes[FRAME_KINDS];
+    uint64_t ip_proto[256];
+    uint64_t icmp_type[256];
+    uint64_t arp_requests;
+    uint64_t arp_replies;
+    uint64_t first_ts_ns;
+    uint64_t last_ts_ns;
+} decode_stats_t;
+
+void decode_frame(const uint8_t *frame, uint32_t len, frame_record_t *rec);
+void decode_stats_init(decode_stats_t *stats);
+void decode_stats_add(decode_stats_t *stats, const frame_record_t *recs, size_t count);
+void decode_stats_merge(decode_stats_t *dst, const decode_stats_t *src);
+void decode_stats_print(const decode_stats_t *stats, FILE *out);
+void print_frame_record(const frame_record_t *rec, FILE *out);
+const char *ip_proto_name(int proto);
@@ -0,0 +1,216 @@
+#ifdef __linux__
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/if_ether.h>
+#include "live-capture.h"
+
+//Finds ifname and checks the decoder can read its frames
+static int find_interface(int fd, const char *ifname, int *ifindex, int *loopback) {
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    if (strlen(ifname) >= sizeof(ifr.ifr_name)) {
+        fprintf(stderr, "%s: interface name too long\n", ifname);
+        return -1;
+    }
+    strcpy(ifr.ifr_name, ifname);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        perror(ifname);
+        return -1;
+    }
+    *ifindex = ifr.ifr_ifindex;
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        perror(ifname);
+        return -1;
+    }
+    if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER && ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK) {
+        fprintf(stderr, "%s: not an ethernet or loopback interface\n", ifname);
+        return -1;
+    }
+    *loopback = ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK;
+    return 0;
+}
+
+/*
+ *  Opens a capture on the interface ifname.  With fanout_group 0 or more
+ *  the socket joins that fanout group and only gets its share of the
+ *  packets.  Needs root, or CAP_NET_RAW.  Returns 0 on success or -1
+ */
+int live_capture_open(live_capture_t *lc, const char *ifname, int fanout_group) {
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    int version = TPACKET_V3;
+    int ifindex;
+
+    memset(lc, 0, sizeof(*lc));
+    lc->ring = MAP_FAILED;
+
+    //Protocol 0 so nothing is queued until the ring is there and we bind
+    lc->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (lc->fd < 0) {
+        perror("AF_PACKET socket");
+        return -1;
+    }
+    if (find_interface(lc->fd, ifname, &ifindex, &lc->loopback) < 0) {
+        live_capture_close(lc);
+        return -1;
+    }
+    if (setsockopt(lc->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("PACKET_VERSION");
+        live_capture_close(lc);
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = LIVE_BLOCK_SIZE;
+    req.tp_block_nr = LIVE_BLOCKS;
+    req.tp_frame_size = LIVE_FRAME_SIZE;
+    req.tp_frame_nr = LIVE_BLOCK_SIZE / LIVE_FRAME_SIZE * LIVE_BLOCKS;
+    req.tp_retire_blk_tov = LIVE_BLOCK_TIMEOUT_MS;
+    if (setsockopt(lc->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        perror("PACKET_RX_RING");
+        live_capture_close(lc);
+        return -1;
+    }
+    lc->ring_size = (size_t)LIVE_BLOCK_SIZE * LIVE_BLOCKS;
+    lc->ring = mmap(NULL, lc->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, lc->fd, 0);
+    if (lc->ring == MAP_FAILED) {
+        perror("mmap");
+        live_capture_close(lc);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(lc->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(ifname);
+        live_capture_close(lc);
+        return -1;
+    }
+
+    //Hash on the flow, with fragments put back together first so they
+    //all hash the same
+    if (fanout_group >= 0) {
+        uint32_t fanout = (fanout_group & 0xffff) |
+                          ((uint32_t)(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+
+        if (setsockopt(lc->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+            perror("PACKET_FANOUT");
+            live_capture_close(lc);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//Gives the block we are done with back to the kernel and moves on
+static void release_block(live_capture_t *lc) {
+    __atomic_store_n(&lc->cur->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    lc->cur = NULL;
+    lc->block = (lc->block + 1) % LIVE_BLOCKS;
+}
+
+//Takes the next block if the kernel has handed it over, returns 0 if not
+static int take_block(live_capture_t *lc) {
+    struct tpacket_block_desc *bd = (struct tpacket_block_desc *)(lc->ring + (size_t)lc->block * LIVE_BLOCK_SIZE);
+
+    if ((__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+        return 0;
+    lc->cur = bd;
+    lc->left = bd->hdr.bh1.num_pkts;
+    lc->pkt = (const uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt;
+    return 1;
+}
+
+/*
+ *  Points rec at the next packet, waiting up to timeout_ms for one.  The
+ *  packet is still in the ring, it is good until the next call.  Returns
+ *  1 if there is a packet, 0 if none came in time (or a signal came in)
+ *  or -1 if the socket failed
+ */
+int live_capture_next(live_capture_t *lc, pcap_record_t *rec, int timeout_ms) {
+    for (;;) {
+        const struct tpacket3_hdr *hdr;
+        const struct sockaddr_ll *sll;
+
+        if (lc->cur != NULL && lc->left == 0)
+            release_block(lc);
+        if (lc->cur == NULL && !take_block(lc)) {
+            struct pollfd pfd = { lc->fd, POLLIN | POLLERR, 0 };
+            int n = poll(&pfd, 1, timeout_ms);
+
+            if (n < 0 && errno != EINTR) {
+                perror("poll");
+                return -1;
+            }
+            //Like the interface going down, poll() would keep saying so
+            if (n > 0 && (pfd.revents & POLLERR)) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+
+                getsockopt(lc->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                fprintf(stderr, "live capture: %s\n", strerror(err != 0 ? err : EIO));
+                return -1;
+            }
+            if (!take_block(lc))
+                return 0;
+        }
+
+        hdr = (const struct tpacket3_hdr *)lc->pkt;
+        sll = (const struct sockaddr_ll *)(lc->pkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        lc->pkt += hdr->tp_next_offset;
+        lc->left--;
+        if (lc->loopback && sll->sll_pkttype == PACKET_OUTGOING)
+            continue;
+
+        memset(rec, 0, sizeof(*rec));
+        rec->data = (const uint8_t *)hdr + hdr->tp_mac;
+        rec->caplen = hdr->tp_snaplen;
+        rec->origlen = hdr->tp_len;
+        rec->ts_ns = hdr->tp_sec * 1000000000ULL + hdr->tp_nsec;
+        rec->linktype = PCAP_LINKTYPE_ETHERNET;
+        return 1;
+    }
+}
+
+/*
+ *  Adds the packets the socket saw and the ones the kernel dropped because
+ *  the ring was full, since the last call, to *packets and *drops
+ */
+int live_capture_stats(live_capture_t *lc, uint64_t *packets, uint64_t *drops) {
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+
+    if (getsockopt(lc->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+        perror("PACKET_STATISTICS");
+        return -1;
+    }
+    *packets += st.tp_packets;
+    *drops += st.tp_drops;
+    return 0;
+}
+
+void live_capture_close(live_capture_t *lc) {
+    if (lc->ring != NULL && lc->ring != MAP_FAILED)
+        munmap(lc->ring, lc->ring_size);
+    if (lc->fd >= 0)
+        close(lc->fd);
+    lc->ring = NULL;
+    lc->cur = NULL;
+    lc->fd = -1;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ *  Captures packets live off a network interface, Linux only.
+ *
+ *  An AF_PACKET socket with a TPACKET_V3 receive ring is shared with the
+ *  kernel through mmap().  The kernel fills the ring a block at a time,
+ *  many packets to a block, and hands a block over when it is full or
+ *  LIVE_BLOCK_TIMEOUT_MS after its first packet, whichever comes first.
+ *  We walk the packets right where the kernel put them, nothing is copied,
+ *  and give the block back once we are past its last packet.  So one
+ *  wakeup covers a whole block of packets instead of one each.
+ *
+ *  Several sockets can join the same fanout group, then the kernel splits
+ *  the interface's packets between them, hashed so both directions of a
+ *  conversation always go to the same socket.  Each decoder thread opens
+ *  its own socket in the group.
+ *
+ *  The loopback interface works too, its frames carry an ethernet header
+ *  with zero addresses.  The kernel shows each loopback packet both going
+ *  out and coming in, only the copy coming in is handed out.
+ */
+
+#ifdef __linux__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/if_packet.h>
+#include "pcap-reader.h"
+
+#define LIVE_BLOCK_SIZE         (1 << 20)   //Big enough for any loopback packet
+#define LIVE_BLOCKS             32
+#define LIVE_FRAME_SIZE         2048        //Only used to size the ring, V3 packs packets tight
+#define LIVE_BLOCK_TIMEOUT_MS   100
+
+typedef struct live_capture_t {
+    int      fd;
+    uint8_t  *ring;
+    size_t   ring_size;
+    int      loopback;
+    unsigned block;                     //Block we are reading, or waiting for
+    struct tpacket_block_desc *cur;     //That block once the kernel has handed it over
+    const uint8_t *pkt;                 //Next packet in cur
+    uint32_t left;                      //Packets left in cur
+} live_capture_t;
+
+int  live_capture_open(live_capture_t *lc, const char *ifname, int fanout_group);
+int  live_capture_next(live_capture_t *lc, pcap_record_t *rec, int timeout_ms);
+int  live_capture_stats(live_capture_t *lc, uint64_t *packets, uint64_t *drops);
+void live_capture_close(live_capture_t *lc);
+
+#endif
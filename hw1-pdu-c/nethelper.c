@@ -21,7 +21,7 @@
  * 
  * This returns 1 for success and -1 for an error
  */
-uint16_t ip_toStr(uint8_t *ip, char *dst, int len) {
+uint16_t ip_toStr(const uint8_t *ip, char *dst, int len) {
     //note max len is 15 plus add null byte 255.255.255.255\0
     if( len < 16) return -1;
 
@@ -61,7 +61,7 @@ uint16_t str_toMAC(const char *src, uint8_t *dst, int len) {
  * buffer.  Notice the check for 18 - thats because MAC strings are 17 characters and in
  * C you need an extra byte for the null
  */
-int16_t mac_toStr(uint8_t *mac, char *dst, int len){
+int16_t mac_toStr(const uint8_t *mac, char *dst, int len){
     //note max len is 17 plus add null byte 00-00-00-00-00-00\0
     if( len < 18) return -1;
 
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pcap-reader.h"
+
+//Classic pcap magic numbers, the second is for nanosecond timestamps
+#define PCAP_MAGIC_US       0xa1b2c3d4
+#define PCAP_MAGIC_NS       0xa1b23c4d
+#define PCAP_FILE_HDR_LEN   24
+#define PCAP_REC_HDR_LEN    16
+
+//pcapng block types
+#define PCAPNG_SHB          0x0A0D0D0A  //Section header, the same in either byte order
+#define PCAPNG_BOM          0x1A2B3C4D  //Byte order magic in the section header
+#define PCAPNG_IDB          0x00000001  //Interface description
+#define PCAPNG_PB           0x00000002  //Packet, obsolete but still around
+#define PCAPNG_SPB          0x00000003  //Simple packet
+#define PCAPNG_EPB          0x00000006  //Enhanced packet
+#define PCAPNG_BLOCK_MIN    12          //Type, length and the length again
+
+//pcapng interface options we use
+#define PCAPNG_OPT_END      0
+#define PCAPNG_OPT_TSRESOL  9
+#define PCAPNG_OPT_TSOFFSET 14
+
+#define PAD4(n) (((n) + 3) & ~(size_t)3)
+
+//Reads fields the way the file was written, swapping if it was written on
+//a machine with the other byte order
+static uint16_t rd16(const pcap_reader_t *r, const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(const pcap_reader_t *r, const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? __builtin_bswap32(v) : v;
+}
+
+static uint64_t rd64(const pcap_reader_t *r, const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? __builtin_bswap64(v) : v;
+}
+
+//Converts ts ticks of units per second to nanoseconds without overflowing
+static uint64_t ticks_to_ns(uint64_t ts, uint64_t units) {
+    uint64_t ns = ts / units * 1000000000ULL;
+    return ns + (uint64_t)((unsigned __int128)(ts % units) * 1000000000ULL / units);
+}
+
+/*
+ *  Gives the pages before offset keep back to the kernel once there are
+ *  enough of them.  The mapping is read only, so this just unmaps them
+ *  from us and a later touch would read them from the file again.
+ *  Without it every page we went through would count against us until
+ *  the end
+ */
+static void release_behind(pcap_reader_t *r, size_t keep) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end;
+
+    //Someone else may still be decoding packets we already handed out
+    if (r->hold != 0 && r->hold < keep)
+        keep = r->hold;
+    end = keep & ~(page - 1);
+
+    if (end < r->released + PCAP_RELEASE_BYTES)
+        return;
+    madvise((void *)(r->map + r->released), end - r->released, MADV_DONTNEED);
+    r->released = end;
+}
+
+static int open_pcap(pcap_reader_t *r, uint32_t magic) {
+    if (r->size < PCAP_FILE_HDR_LEN) {
+        fprintf(stderr, "pcap: file header cut short\n");
+        return -1;
+    }
+    r->format = PCAP_FMT_PCAP;
+    r->swapped = (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS);
+    magic = rd32(r, r->map);
+    r->ts_units = magic == PCAP_MAGIC_NS ? 1000000000ULL : 1000000ULL;
+    r->snaplen = rd32(r, r->map + 16);
+    r->linktype = rd32(r, r->map + 20) & 0xFFFF;    //The top bits can hold FCS info
+    r->pos = PCAP_FILE_HDR_LEN;
+    return 0;
+}
+
+/*
+ *  Maps the capture file at path and works out which format it is.
+ *  Returns 0 on success or -1 if it cannot be read or is not a capture
+ */
+int pcap_reader_open(pcap_reader_t *r, const char *path) {
+    struct stat st;
+    uint32_t magic;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(r->fd, &st) < 0) {
+        perror(path);
+        close(r->fd);
+        return -1;
+    }
+    r->size = st.st_size;
+    if (r->size < sizeof(magic)) {
+        fprintf(stderr, "%s: too short to be a capture file\n", path);
+        close(r->fd);
+        return -1;
+    }
+
+    //Read only, the decoder never changes a packet
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        perror("mmap");
+        close(r->fd);
+        return -1;
+    }
+    madvise((void *)r->map, r->size, MADV_SEQUENTIAL);
+
+    memcpy(&magic, r->map, sizeof(magic));
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS ||
+        magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+        if (open_pcap(r, magic) == 0)
+            return 0;
+    } else if (magic == PCAPNG_SHB) {
+        r->format = PCAP_FMT_PCAPNG;
+        r->pos = 0;                     //The section header is read like any block
+        return 0;
+    } else {
+        fprintf(stderr, "%s: not a pcap or pcapng file\n", path);
+    }
+    pcap_reader_close(r);
+    return -1;
+}
+
+void pcap_reader_close(pcap_reader_t *r) {
+    if (r->map != NULL && r->map != MAP_FAILED)
+        munmap((void *)r->map, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+    r->map = NULL;
+    r->fd = -1;
+}
+
+static int next_pcap(pcap_reader_t *r, pcap_record_t *rec) {
+    const uint8_t *hdr = r->map + r->pos;
+
+    if (r->pos == r->size)
+        return 0;
+    if (r->size - r->pos < PCAP_REC_HDR_LEN) {
+        fprintf(stderr, "pcap: record header cut short at offset %zu\n", r->pos);
+        return -1;
+    }
+    rec->caplen = rd32(r, hdr + 8);
+    rec->origlen = rd32(r, hdr + 12);
+    if (rec->caplen > r->size - r->pos - PCAP_REC_HDR_LEN) {
+        fprintf(stderr, "pcap: packet cut short at offset %zu\n", r->pos);
+        return -1;
+    }
+    rec->ts_ns = (uint64_t)rd32(r, hdr) * 1000000000ULL +
+                 ticks_to_ns(rd32(r, hdr + 4), r->ts_units);
+    rec->data = hdr + PCAP_REC_HDR_LEN;
+    rec->linktype = r->linktype;
+    rec->iface = 0;
+
+    release_behind(r, r->pos);
+    r->pos += PCAP_REC_HDR_LEN + rec->caplen;
+    return 1;
+}
+
+//Starts a new section, which has its own byte order and interfaces
+static int pcapng_section(pcap_reader_t *r, const uint8_t *block, size_t avail) {
+    uint32_t bom;
+
+    if (avail < PCAPNG_BLOCK_MIN + 16) {
+        fprintf(stderr, "pcapng: section header cut short at offset %zu\n", r->pos);
+        return -1;
+    }
+    memcpy(&bom, block + 8, sizeof(bom));
+    if (bom != PCAPNG_BOM && bom != __builtin_bswap32(PCAPNG_BOM)) {
+        fprintf(stderr, "pcapng: bad byte order magic at offset %zu\n", r->pos);
+        return -1;
+    }
+    r->swapped = (bom != PCAPNG_BOM);
+    r->n_ifaces = 0;
+    return 0;
+}
+
+//Adds the interface an interface description block describes
+static int pcapng_iface(pcap_reader_t *r, const uint8_t *body, size_t body_len) {
+    pcap_iface_t *iface;
+    size_t off = 8;
+
+    if (body_len < 8) {
+        fprintf(stderr, "pcapng: interface block cut short at offset %zu\n", r->pos);
+        return -1;
+    }
+    if (r->n_ifaces == PCAP_MAX_IFACES) {
+        fprintf(stderr, "pcapng: more than %d interfaces\n", PCAP_MAX_IFACES);
+        return -1;
+    }
+    iface = &r->ifaces[r->n_ifaces++];
+    iface->linktype = rd16(r, body);
+    iface->snaplen = rd32(r, body + 4);
+    iface->ts_units = 1000000;          //Microseconds unless it says otherwise
+    iface->ts_offset = 0;
+
+    while (off + 4 <= body_len) {
+        uint16_t code = rd16(r, body + off);
+        uint16_t len = rd16(r, body + off + 2);
+        const uint8_t *val = body + off + 4;
+
+        if (code == PCAPNG_OPT_END || off + 4 + len > body_len)
+            break;
+        if (code == PCAPNG_OPT_TSRESOL && len >= 1) {
+            //Top bit set is a power of two, clear a power of ten
+            uint8_t res = val[0];
+            if (res & 0x80) {
+                iface->ts_units = 1ULL << ((res & 0x7f) < 63 ? (res & 0x7f) : 63);
+            } else {
+                iface->ts_units = 1;
+                for (int i = 0; i < res && i < 19; i++)
+                    iface->ts_units *= 10;
+            }
+        } else if (code == PCAPNG_OPT_TSOFFSET && len >= 8) {
+            iface->ts_offset = (int64_t)rd64(r, val);
+        }
+        off += 4 + PAD4(len);
+    }
+    return 0;
+}
+
+static pcap_iface_t *pcapng_find_iface(pcap_reader_t *r, uint32_t id) {
+    if (id >= r->n_ifaces) {
+        fprintf(stderr, "pcapng: packet for unknown interface %u at offset %zu\n", id, r->pos);
+        return NULL;
+    }
+    return &r->ifaces[id];
+}
+
+/*
+ *  Walks blocks until one holds a packet.  Blocks we do not need, like
+ *  name resolution and statistics, are skipped over by their length
+ */
+static int next_pcapng(pcap_reader_t *r, pcap_record_t *rec) {
+    while (r->pos < r->size) {
+        const uint8_t *block = r->map + r->pos;
+        size_t avail = r->size - r->pos;
+        uint32_t type, block_len;
+        const uint8_t *body;
+        size_t body_len;
+        pcap_iface_t *iface;
+        uint64_t ts;
+
+        if (avail < PCAPNG_BLOCK_MIN) {
+            fprintf(stderr, "pcapng: block header cut short at offset %zu\n", r->pos);
+            return -1;
+        }
+        memcpy(&type, block, sizeof(type));
+        if (type == PCAPNG_SHB && pcapng_section(r, block, avail) < 0)
+            return -1;
+        type = rd32(r, block);
+        block_len = rd32(r, block + 4);
+        if (block_len < PCAPNG_BLOCK_MIN || block_len % 4 != 0 || block_len > avail) {
+            fprintf(stderr, "pcapng: bad block length %u at offset %zu\n", block_len, r->pos);
+            return -1;
+        }
+        body = block + 8;
+        body_len = block_len - PCAPNG_BLOCK_MIN;
+
+        switch (type) {
+        case PCAPNG_IDB:
+            if (pcapng_iface(r, body, body_len) < 0)
+                return -1;
+            break;
+        case PCAPNG_EPB:
+        case PCAPNG_PB:
+            if (body_len < 20) {
+                fprintf(stderr, "pcapng: packet block cut short at offset %zu\n", r->pos);
+                return -1;
+            }
+            rec->iface = type == PCAPNG_EPB ? rd32(r, body) : rd16(r, body);
+            iface = pcapng_find_iface(r, rec->iface);
+            if (iface == NULL)
+                return -1;
+            ts = (uint64_t)rd32(r, body + 4) << 32 | rd32(r, body + 8);
+            rec->caplen = rd32(r, body + 12);
+            rec->origlen = rd32(r, body + 16);
+            if (rec->caplen > body_len - 20) {
+                fprintf(stderr, "pcapng: packet cut short at offset %zu\n", r->pos);
+                return -1;
+            }
+            rec->data = body + 20;
+            rec->ts_ns = ticks_to_ns(ts, iface->ts_units) + iface->ts_offset * 1000000000LL;
+            rec->linktype = iface->linktype;
+            release_behind(r, r->pos);
+            r->pos += block_len;
+            return 1;
+        case PCAPNG_SPB:
+            //No timestamp, and only as much data as the first interface snaps
+            if (body_len < 4 || (iface = pcapng_find_iface(r, 0)) == NULL)
+                return -1;
+            rec->iface = 0;
+            rec->origlen = rd32(r, body);
+            rec->caplen = rec->origlen;
+            if (iface->snaplen != 0 && rec->caplen > iface->snaplen)
+                rec->caplen = iface->snaplen;
+            if (rec->caplen > body_len - 4)
+                rec->caplen = body_len - 4;
+            rec->data = body + 4;
+            rec->ts_ns = 0;
+            rec->linktype = iface->linktype;
+            release_behind(r, r->pos);
+            r->pos += block_len;
+            return 1;
+        default:
+            break;
+        }
+        r->pos += block_len;
+    }
+    return 0;
+}
+
+/*
+ *  Hands out the next packet in the file.  rec->data points into the
+ *  mapping, it is good until pcap_reader_close().  Returns 1 if there is a
+ *  packet, 0 at the end of the file or -1 if the file is damaged
+ */
+int pcap_reader_next(pcap_reader_t *r, pcap_record_t *rec) {
+    if (r->format == PCAP_FMT_PCAP)
+        return next_pcap(r, rec);
+    return next_pcapng(r, rec);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+ *  Reads packets out of capture files saved by wireshark or tcpdump, both
+ *  the classic pcap format and pcapng.
+ *
+ *  The file is mapped into memory with mmap() instead of being read into a
+ *  buffer, and each packet handed out is a pointer straight into the
+ *  mapping, so nothing is copied.  The kernel pages the file in ahead of
+ *  us as we walk it, and pages we are done with are given back as we go,
+ *  so a capture of many GB takes no more memory than a small one.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCAP_FMT_PCAP       1
+#define PCAP_FMT_PCAPNG     2
+
+#define PCAP_LINKTYPE_ETHERNET  1
+#define PCAP_MAX_IFACES     64          //pcapng interfaces per section
+#define PCAP_RELEASE_BYTES  (32 << 20)  //Give back pages we are done with this often
+
+//A pcapng interface, every packet block says which one it came in on
+typedef struct pcap_iface_t {
+    uint32_t linktype;
+    uint32_t snaplen;
+    uint64_t ts_units;          //Timestamp ticks per second
+    int64_t  ts_offset;         //Seconds to add to every timestamp
+} pcap_iface_t;
+
+//One packet, data points into the read only mapping and is good until close
+typedef struct pcap_record_t {
+    const uint8_t *data;
+    uint32_t caplen;            //Bytes in data
+    uint32_t origlen;           //Bytes on the wire, more if the capture cut it short
+    uint64_t ts_ns;             //Nanoseconds since the Unix epoch
+    uint32_t linktype;          //PCAP_LINKTYPE_ETHERNET is what the decoder knows
+    uint32_t iface;
+} pcap_record_t;
+
+typedef struct pcap_reader_t {
+    int      fd;
+    const uint8_t *map;
+    size_t   size;
+    size_t   pos;               //Offset of the next record or block
+    size_t   released;          //Everything before this went back to the kernel
+    size_t   hold;              //Packets from here on are still in use, 0 if none are
+    int      format;
+    int      swapped;           //Written on a machine of the other byte order
+    uint64_t ts_units;          //pcap: timestamp ticks per second
+    uint32_t linktype;          //pcap: one link type for the whole file
+    uint32_t snaplen;
+    uint32_t n_ifaces;          //pcapng: interfaces in this section
+    pcap_iface_t ifaces[PCAP_MAX_IFACES];
+} pcap_reader_t;
+
+int  pcap_reader_open(pcap_reader_t *r, const char *path);
+int  pcap_reader_next(pcap_reader_t *r, pcap_record_t *rec);
+void pcap_reader_close(pcap_reader_t *r);
@@ -0,0 +1,106 @@
+#pragma once
+
+/*
+ *  Read only views of the PDUs in packet.h.
+ *
+ *  A frame is never changed while it is decoded.  Instead of converting the
+ *  network byte order fields in place, every multi byte field is read
+ *  through one of the accessors below, which does the ntohs() or ntohl()
+ *  right where the field is used.  That way the same frame can be decoded
+ *  more than once, straight out of a read only mapping of a capture file,
+ *  or by more than one thread at the same time.
+ *
+ *  The accessors take the packet types from packet.h, so they are used
+ *  like this:
+ *
+ *      const arp_packet_t *arp = (const arp_packet_t *)frame;
+ *      if (arp_op(arp) == ARP_REQ_OP) ...
+ *
+ *  Single byte fields have no byte order, read those straight out of the
+ *  struct (arp->arp_hdr.hlen, ip->ip_hdr.protocol, and so on).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "packet.h"
+
+/*
+ *  Reads a 16 or 32 bit network byte order field.  A frame in a capture
+ *  file can start at any address, so the field is copied out with memcpy()
+ *  rather than read through a pointer that might not be aligned
+ */
+static inline uint16_t pdu_get16(const void *field) {
+    uint16_t v;
+    memcpy(&v, field, sizeof(v));
+    return ntohs(v);
+}
+
+static inline uint32_t pdu_get32(const void *field) {
+    uint32_t v;
+    memcpy(&v, field, sizeof(v));
+    return ntohl(v);
+}
+
+//                                  ETHERNET
+static inline uint16_t eth_frame_type(const ether_pdu_t *eth) {
+    return pdu_get16(&eth->frame_type);
+}
+
+//                                    ARP
+static inline uint16_t arp_htype(const arp_packet_t *arp) {
+    return pdu_get16(&arp->arp_hdr.htype);
+}
+
+static inline uint16_t arp_ptype(const arp_packet_t *arp) {
+    return pdu_get16(&arp->arp_hdr.ptype);
+}
+
+static inline uint16_t arp_op(const arp_packet_t *arp) {
+    return pdu_get16(&arp->arp_hdr.op);
+}
+
+//                                    IP
+static inline uint16_t ip_total_length(const ip_packet_t *ip) {
+    return pdu_get16(&ip->ip_hdr.total_length);
+}
+
+static inline uint16_t ip_identification(const ip_packet_t *ip) {
+    return pdu_get16(&ip->ip_hdr.identification);
+}
+
+static inline uint16_t ip_header_checksum(const ip_packet_t *ip) {
+    return pdu_get16(&ip->ip_hdr.header_checksum);
+}
+
+//Header length in bytes, more than sizeof(ip_pdu_t) when there are options
+static inline uint16_t ip_header_length(const ip_packet_t *ip) {
+    return (ip->ip_hdr.version_ihl & 0x0f) * 4;
+}
+
+//                                   ICMP
+static inline uint16_t icmp_checksum(const icmp_packet_t *icmp) {
+    return pdu_get16(&icmp->icmp_hdr.checksum);
+}
+
+//                                ICMP ECHO
+static inline uint16_t icmp_echo_id(const icmp_echo_packet_t *icmp) {
+    return pdu_get16(&icmp->icmp_echo_hdr.id);
+}
+
+static inline uint16_t icmp_echo_sequence(const icmp_echo_packet_t *icmp) {
+    return pdu_get16(&icmp->icmp_echo_hdr.sequence);
+}
+
+static inline uint32_t icmp_echo_timestamp(const icmp_echo_packet_t *icmp) {
+    return pdu_get32(&icmp->icmp_echo_hdr.timestamp);
+}
+
+static inline uint32_t icmp_echo_timestamp_ms(const icmp_echo_packet_t *icmp) {
+    return pdu_get32(&icmp->icmp_echo_hdr.timestamp_ms);
+}
+
+//Same as ICMP_Payload_Size() in packet.h
+static inline uint16_t icmp_echo_payload_size(const icmp_echo_packet_t *icmp) {
+    return pdu_get16(&icmp->ip.ip_hdr.total_length) - sizeof(ip_pdu_t) - sizeof(icmp_echo_pdu_t);
+}
@@ -0,0 +1,120 @@
+/*
+ *  bench-codec.c
+ *
+ *  Micro benchmark for the header codec in cs472-proto.h.  It encodes and
+ *  decodes a table of different headers many times and reports the cost
+ *  per header, next to a plain memcpy of the struct which is what the
+ *  code used to put on the wire.  Every decoded header is also checked
+ *  against the one that was encoded, so this doubles as a sanity check.
+ *
+ *  Build and run with: make bench
+ */
+#include "cs472-proto.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_HDRS    1024                //Distinct headers, keeps them in L1
+#define ITERATIONS  20000               //Passes over the table
+
+static cs472_proto_header_t hdrs[NUM_HDRS];
+static cs472_proto_header_t decoded[NUM_HDRS];
+static uint8_t wire[NUM_HDRS][CS472_HDR_WIRE_SZ];
+
+static double now_ns(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//Fills the table with headers that use every field, so a mistake in
+//any shift or mask shows up in the check
+static void init_headers(){
+    static const char *courses[] = {"cs472", "cs281", "cs575", "cs577", "NONE", "cs610ab"};
+    int num_courses = sizeof(courses) / sizeof(courses[0]);
+
+    srand(472);
+    for (int i = 0; i < NUM_HDRS; i++) {
+        memset(&hdrs[i], 0, sizeof(cs472_proto_header_t));
+        hdrs[i].proto = rand() & CS472_PROTO_MASK;
+        hdrs[i].ver = rand() & CS472_VER_MASK;
+        hdrs[i].cmd = rand() & CS472_CMD_MASK;
+        hdrs[i].dir = rand() & CS472_DIR_MASK;
+        hdrs[i].atm = rand() & CS472_ATM_MASK;
+        hdrs[i].ay = rand() & CS472_AY_MASK;
+        strncpy(hdrs[i].course, courses[i % num_courses], sizeof(hdrs[i].course));
+        hdrs[i].len = rand() & 0xFF;
+    }
+}
+
+static int same_header(cs472_proto_header_t *a, cs472_proto_header_t *b){
+    return a->proto == b->proto && a->ver == b->ver && a->cmd == b->cmd &&
+           a->dir == b->dir && a->atm == b->atm && a->ay == b->ay &&
+           memcmp(a->course, b->course, sizeof(a->course)) == 0 && a->len == b->len;
+}
+
+static void report(const char *name, double start, double end){
+    double per_hdr = (end - start) / ((double)NUM_HDRS * ITERATIONS);
+
+    printf("  %-22s %6.2f ns/hdr  %8.1f M hdrs/s\n", name, per_hdr, 1e3 / per_hdr);
+}
+
+int main(int argc, char *argv[]){
+    volatile uint32_t sink = 0;
+    double start;
+
+    init_headers();
+
+    //the first byte on the wire must be PROTO and VER, whatever machine
+    //we run on
+    hdrs[0].proto = PROTO_CS_FUN;
+    hdrs[0].ver = PROTO_VER_1;
+    hdrs[0].ay = CURRENT_AY;
+    cs472_hdr_encode(&hdrs[0], wire[0]);
+    if (wire[0][0] != (PROTO_CS_FUN << 4 | PROTO_VER_1) ||
+        wire[0][2] != (CURRENT_AY >> 8) || wire[0][3] != (CURRENT_AY & 0xFF)) {
+        fprintf(stderr, "header is not in network byte order\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < NUM_HDRS; i++) {
+        cs472_hdr_encode(&hdrs[i], wire[i]);
+        cs472_hdr_decode(wire[i], &decoded[i]);
+        if (!same_header(&hdrs[i], &decoded[i])) {
+            fprintf(stderr, "header %d did not survive a round trip\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("%d headers x %d passes\n", NUM_HDRS, ITERATIONS);
+
+    start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        for (int i = 0; i < NUM_HDRS; i++)
+            cs472_hdr_encode(&hdrs[i], wire[i]);
+        sink += wire[n % NUM_HDRS][0];
+    }
+    report("encode", start, now_ns());
+
+    start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        for (int i = 0; i < NUM_HDRS; i++)
+            cs472_hdr_decode(wire[i], &decoded[i]);
+        sink += decoded[n % NUM_HDRS].ay;
+    }
+    report("decode", start, now_ns());
+
+    //the old way, copy the struct as it sits in memory
+    start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        for (int i = 0; i < NUM_HDRS; i++)
+            memcpy(wire[i], &hdrs[i], CS472_HDR_WIRE_SZ);
+        sink += wire[n % NUM_HDRS][0];
+    }
+    report("raw struct memcpy", start, now_ns());
+
+    return 0;
+}
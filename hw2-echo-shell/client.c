@@ -1,6 +1,7 @@
 
 #include "client.h"
 #include "cs472-proto.h"
+#include "cs472-conn.h"
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -12,38 +13,51 @@
 #include <getopt.h>
 
 #define BUFF_SZ 512
-static uint8_t send_buffer[BUFF_SZ];
-static uint8_t recv_buffer[BUFF_SZ];
+#define SERVER_ADDR     "127.0.0.1"
+#define MAX_COURSE_ID   7       //Fits in the header course field
+#define MAX_BATCH       256
+
+//Not a protocol command, the client uses this to pick batch mode
+#define CMD_BATCH_INFO  0x10
 
 /*
  *  Helper function that processes the command line arguements.  Highlights
  *  how to use a very useful utility called getopt, where you pass it a
  *  format string and it does all of the hard work for you.  The arg
- *  string basically states this program accepts a -p or -c flag, the
+ *  string basically states this program accepts a -p, -c or -b flag, the
  *  -p flag is for a "pong message", in other words the server echos
  *  back what the client sends, and a -c message, the -c option takes
  *  a course id, and the server looks up the course id and responds
- *  with an appropriate message. 
+ *  with an appropriate message.  The -b option takes a comma separated
+ *  list of course ids that are all looked up over a single connection.
  */
 static int initParams(int argc, char *argv[], char **p){
     int option;
 
     //setup defaults if no arguements are passed
-    static char cmdBuffer[16] = "CS472"; 
+    static char cmdBuffer[BUFF_SZ] = "CS472"; 
     int         cmdType = CMD_CLASS_INFO;
+    char        *cmdData = cmdBuffer;
 
     //
-    // usage client [-p "ping pong message"] | [-c COURSEID]
+    // usage client [-p "ping pong message"] | [-c COURSEID] | [-b ID1,ID2,...]
     //
-    while ((option = getopt(argc, argv, ":p:c:")) != -1){
+    while ((option = getopt(argc, argv, ":p:c:b:")) != -1){
         switch(option) {
             case 'p':
-                strncpy(cmdBuffer, optarg, sizeof(cmdBuffer));
+                //version 2 allows big messages, so use it in place
                 cmdType = CMD_PING_PONG;
+                cmdData = optarg;
                 break;
             case 'c':
-                strncpy(cmdBuffer, optarg, sizeof(cmdBuffer));
+                strncpy(cmdBuffer, optarg, MAX_COURSE_ID);
                 cmdType = CMD_CLASS_INFO;
+                cmdData = cmdBuffer;
+                break;
+            case 'b':
+                //the list can be long, so use it in place
+                cmdType = CMD_BATCH_INFO;
+                cmdData = optarg;
                 break;
             case ':':
                 perror ("Option missing value");
@@ -54,135 +68,135 @@ static int initParams(int argc, char *argv[], char **p){
                 exit(-1);
         }
     }
-    *p = cmdBuffer;
+    *p = cmdData;
     return cmdType;
 }
 
 /*
- *  This function helps to initialize the packet header we will be sending
- *  to the server from the client.  It takes a pointer to a header structure
- *  that gets initiized as part of this function call.  The other args are:
- * 
- *      req_cmd:  The command we are doing - CMD_CLASS_INFO or CMD_PING_PONG
- *      req_data: This is the ping message in the case of CMD_PING_PONG, and
- *                is the courseID (e.g., cs472) in the case of CMD_CLASS_INFO
+ *  This function "starts the client".  It sends a single request to the
+ *  server and prints the reply.  The request is either CMD_CLASS_INFO
+ *  where req_data is the course id, or CMD_PING_PONG where req_data is
+ *  the message to echo.  The header and packet are built by the
+ *  connection library in cs472-conn.c.  We always try to negotiate
+ *  protocol version 2, if the server agrees long messages and course
+ *  descriptions come back in one piece.  A request that fits in a version
+ *  1 packet asks for version 2 itself, only longer pings wait for the
+ *  server to agree before they are sent.
  */
-static void init_header(cs472_proto_header_t *header, int req_cmd, char *reqData){
-    memset(header, 0, sizeof(cs472_proto_header_t));
+static void start_client(int req_cmd, char *req_data){
+    cs472_conn_t conn;
+    cs472_reply_t reply;
 
-    header->proto = PROTO_CS_FUN;
-    header->cmd = req_cmd;
+    if (cs472_conn_open(&conn, SERVER_ADDR, PORT_NUM) == -1) {
+        fprintf(stderr, "The server is down.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    //TODO: Setup other header fields, eg., header->ver, header->dir, header->atm, header->ay
+    //the pong adds PONG_PREFIX, it has to fit in a version 2 packet too
+    if (req_cmd == CMD_PING_PONG && strlen(req_data) > MAX_PING_MSG_V2) {
+        fprintf(stderr, "Ping message is too long, the max is %d bytes\n", 
+            (int)MAX_PING_MSG_V2);
+        exit(EXIT_FAILURE);
+    }
 
-    //switch based on the command
-    switch(req_cmd){
-        case CMD_PING_PONG:
-            strncpy(header->course, "NONE", sizeof(header->course));
-            //length will be the header plus the size of the message
-            //adding one more to get the null set to the server
-            header->len = sizeof(cs472_proto_header_t) + strlen(reqData) + 1; 
-            break;
-        case CMD_CLASS_INFO:
-            strncpy(header->course, reqData, sizeof(header->course));
-            header->len = sizeof(cs472_proto_header_t);
-            break;
+    if (req_cmd == CMD_PING_PONG &&
+            CS472_HDR_WIRE_SZ + strlen(req_data) + 1 > UINT8_MAX) {
+        if (cs472_conn_negotiate(&conn) != PROTO_VER_2) {
+            fprintf(stderr, "Server does not speak protocol version 2, "
+                "the max ping is %d bytes\n", UINT8_MAX - CS472_HDR_WIRE_SZ - 1);
+            exit(EXIT_FAILURE);
+        }
+    } else
+        cs472_conn_probe(&conn);
+
+    //big pings are streamed out and the reply is streamed back to stdout
+    if (req_cmd == CMD_PING_PONG && strlen(req_data) > CS472_MAX_QUEUED_MSG) {
+        printf("RECV FROM SERVER -> ");
+        if (cs472_conn_ping_stream(&conn, req_data, stdout, &reply) != 1) {
+            fprintf(stderr, "\nDid not get a reply from the server\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("\n");
+        print_proto_header(&reply.header, reply.pkt_len);
+        cs472_conn_close(&conn);
+        return;
+    }
+
+    if (cs472_conn_queue(&conn, req_cmd, req_data) == -1) {
+        fprintf(stderr, "Could not build the request\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (cs472_conn_recv(&conn, &reply) != 1) {
+        fprintf(stderr, "Did not get a reply from the server\n");
+        exit(EXIT_FAILURE);
     }
+
+    print_proto_header(&reply.header, reply.pkt_len);
+    printf("RECV FROM SERVER -> %.*s\n", reply.msg_len, reply.msg);
+
+    cs472_conn_close(&conn);
+}
+
+//Prints one reply of the batch, arg is the list of course ids
+static void print_batch_reply(int index, const cs472_reply_t *reply, void *arg){
+    char **course_ids = arg;
+
+    printf("%-8s -> %.*s\n", course_ids[index], (int)reply->msg_len, reply->msg);
 }
 
 /*
- *  This function "starts the client".  It takes a header structure
- *  and a properly formed packet.  The packet is basically the
- *  header with a message at the end of it in the case of the
- *  command being CMD_PING_PONG.  The length in the header field
- *  indicates the total size to send to the server, thus it will
- *  be sizeof(cs472_proto_header_t) in the case that the cmd is
- *  CMD_COURSE_INFO, or it will be 
- *  sizeof(cs472_proto_header_t) + strlen(MESSAGE) + 1 in the case
- *  we are doing a ping to the server.  We add the extra 1 to send
- *  over the null terminator for the string
+ *  Looks up every course in a comma separated list.  All of the lookups
+ *  share one connection and are pipelined, so the whole list costs one
+ *  handshake and (for up to CS472_PIPELINE_DEPTH courses) one round trip,
+ *  the version is negotiated by the lookups themselves
  */
-static void start_client(cs472_proto_header_t *header, uint8_t *packet){
-    struct sockaddr_in addr;
-    int data_socket;
-    int ret;
+static void start_batch_client(char *course_list){
+    static char *course_ids[MAX_BATCH];
+    cs472_conn_t conn;
+    int count = 0;
 
-    /* Create local socket. */
+    for (char *id = strtok(course_list, ","); id != NULL && count < MAX_BATCH;
+            id = strtok(NULL, ","))
+        course_ids[count++] = id;
 
-    data_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (data_socket == -1) {
-        perror("socket");
+    if (cs472_conn_open(&conn, SERVER_ADDR, PORT_NUM) == -1) {
+        fprintf(stderr, "The server is down.\n");
         exit(EXIT_FAILURE);
     }
+    cs472_conn_probe(&conn);
+
+    int received = cs472_class_info_batch(&conn, course_ids, count,
+        print_batch_reply, course_ids);
 
-    /*
-     * For portability clear the whole structure, since some
-     * implementations have additional (nonstandard) fields in
-     * the structure.
-     */
-
-    memset(&addr, 0, sizeof(struct sockaddr_in));
-
-    /* Connect socket to socket address */
-    /* note that i am sending to localhost, you will need a server IP 
-     * if you are sending over a real network - try it out
-     */
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-    addr.sin_port = htons(PORT_NUM);
-
-    /*
-     * TODO:  The next things you need to do is to handle the cleint
-     * socket to send things to the server, basically make the following
-     * calls:
-     * 
-     *      connect()
-     *      send() - recall that the formatted packet is passed in
-     *      recv() - get the response back from the server
-     */
-
-    //Now process what the server sent, here is some helper code
-    cs472_proto_header_t *pcktPointer =  (cs472_proto_header_t *)recv_buffer;
-    uint8_t *msgPointer = NULL;
-    uint8_t msgLen = 0;
-
-    process_recv_packet(pcktPointer, recv_buffer, &msgPointer, &msgLen);
-    
-    print_proto_header(pcktPointer);
-    printf("RECV FROM SERVER -> %s\n",msgPointer);
-
-    close(data_socket);
+    cs472_conn_close(&conn);
 
+    if (received != count) {
+        fprintf(stderr, "Only received %d of %d replies\n", received, count);
+        exit(EXIT_FAILURE);
+    }
 }
 
 
 int main(int argc, char *argv[])
 {
-    cs472_proto_header_t header;
     int  cmd = 0;
     char *cmdData = NULL;
 
-    //Process the parameters and init the header - look at the helpers
-    //in the cs472-pproto.c file
+    //Process the parameters, the connection library takes care of
+    //building the header and packet for us
     cmd = initParams(argc, argv, &cmdData);
-    init_header(&header, cmd, cmdData);
 
-    //Prepare the request packet based on the type of the command
     switch(cmd){
         case CMD_CLASS_INFO:
-            prepare_req_packet(&header, 0, 0, send_buffer, sizeof(send_buffer));
-            break;
         case CMD_PING_PONG:
-            //add the +1 to send the null byte this way we can treat as a 
-            //c string
-            prepare_req_packet(&header,(uint8_t *)cmdData, strlen(cmdData)+1, 
-                send_buffer, sizeof(send_buffer));
+            start_client(cmd, cmdData);
+            break;
+        case CMD_BATCH_INFO:
+            start_batch_client(cmdData);
             break;
         default:
             perror("usage requires zero or one parameter");
             exit(EXIT_FAILURE);
     }
-
-    //start the client
-    start_client(&header, send_buffer);
-}
\ No newline at end of file
+}
@@ -3,5 +3,5 @@
 #include "cs472-proto.h"
 
 static int initParams(int argc, char *argv[], char **p);
-static void start_client(cs472_proto_header_t *header, uint8_t *packet_buff);
-static void init_header(cs472_proto_header_t *packet, int req_type, char *req_data);
+static void start_client(int req_cmd, char *req_data);
+static void start_batch_client(char *course_list);
@@ -0,0 +1,439 @@
+#include "cs472-conn.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+/*
+ *  Opens a TCP connection to the server and resets the connection state.
+ *  Returns 0 on success or -1 if the server could not be reached
+ */
+int cs472_conn_open(cs472_conn_t *conn, const char *addr, int port){
+    struct sockaddr_in server_addr;
+
+    memset(conn, 0, sizeof(cs472_conn_t));
+    conn->ver = PROTO_VER_1;
+
+    conn->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->sock == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(addr);
+    server_addr.sin_port = htons(port);
+
+    if (connect(conn->sock, (const struct sockaddr *) &server_addr,
+                sizeof(struct sockaddr_in)) == -1) {
+        perror("connect");
+        close(conn->sock);
+        conn->sock = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ *  Closes the connection, any replies that were not read are dropped
+ */
+void cs472_conn_close(cs472_conn_t *conn){
+    if (conn->sock != -1)
+        close(conn->sock);
+    conn->sock = -1;
+    conn->outstanding = 0;
+}
+
+/*
+ *  Writes everything that is queued in the send buffer to the socket.
+ *  Returns 0 on success or -1 on a socket error
+ */
+int cs472_conn_flush(cs472_conn_t *conn){
+    if (conn->send_len == 0)
+        return 0;
+
+    if (cs472_send_all(conn->sock, conn->send_buff, conn->send_len) == -1) {
+        perror("send");
+        return -1;
+    }
+    conn->send_len = 0;
+    return 0;
+}
+
+/*
+ *  Builds the request packet for a command into packet.  The packet is
+ *  framed using the version agreed with the server, and hdr_ver is what
+ *  goes in the VER field.  These are only different while negotiating.
+ *  For a ping the message carries its null terminator so the server can
+ *  treat it as a C string.  Returns the packet size or -1 if it does not fit
+ */
+static int build_request(cs472_conn_t *conn, int req_cmd, const char *req_data,
+            int hdr_ver, uint8_t *packet, uint32_t packet_len){
+    cs472_proto_header_t header;
+    uint32_t msg_len = 0;
+    int hdr_sz;
+
+    memset(&header, 0, sizeof(cs472_proto_header_t));
+    header.proto = PROTO_CS_FUN;
+    header.ver = hdr_ver;
+    header.cmd = req_cmd;
+    header.dir = DIR_SEND;
+    header.atm = TERM_FALL;
+    header.ay = CURRENT_AY;
+
+    switch(req_cmd){
+        case CMD_PING_PONG:
+            strncpy(header.course, "NONE", sizeof(header.course));
+            msg_len = strlen(req_data) + 1;
+            break;
+        case CMD_CLASS_INFO:
+            strncpy(header.course, req_data, sizeof(header.course));
+            break;
+        default:
+            return -1;
+    }
+
+    if (conn->ver < PROTO_VER_2) {
+        //LEN is 8 bits and counts the header as well
+        if (CS472_HDR_WIRE_SZ + msg_len > UINT8_MAX)
+            return -1;
+        return (int16_t)prepare_req_packet(&header, (uint8_t *)req_data, msg_len,
+            packet, packet_len);
+    }
+
+    hdr_sz = prepare_hdr_v2(&header, msg_len, packet, packet_len);
+    if (hdr_sz == -1 || hdr_sz + msg_len > packet_len)
+        return -1;
+    memcpy(packet + hdr_sz, req_data, msg_len);
+    return hdr_sz + msg_len;
+}
+
+/*
+ *  Adds a request to the send buffer and to the FIFO of requests that
+ *  are waiting for a reply
+ */
+static int queue_request(cs472_conn_t *conn, int req_cmd, const char *req_data,
+            int hdr_ver){
+    int packet_sz;
+
+    if (conn->outstanding == CS472_PIPELINE_DEPTH)
+        return -1;
+    if (req_cmd == CMD_PING_PONG && strlen(req_data) > CS472_MAX_QUEUED_MSG)
+        return -1;
+
+    //make sure the worst case packet fits, otherwise write out what we have
+    if (conn->send_len + CS472_HDR_V2_WIRE_SZ + CS472_MAX_QUEUED_MSG + 1 >
+            sizeof(conn->send_buff)) {
+        if (cs472_conn_flush(conn) == -1)
+            return -1;
+    }
+
+    packet_sz = build_request(conn, req_cmd, req_data, hdr_ver,
+        conn->send_buff + conn->send_len, sizeof(conn->send_buff) - conn->send_len);
+    if (packet_sz < 0)
+        return -1;
+    conn->send_len += packet_sz;
+
+    int tail = (conn->pending_head + conn->outstanding) % CS472_PIPELINE_DEPTH;
+    conn->pending[tail] = req_cmd;
+    conn->outstanding++;
+    return 0;
+}
+
+/*
+ *  Queues a request on the connection.  Nothing is written to the socket
+ *  until the send buffer fills up or cs472_conn_flush() is called, which
+ *  is what lets many small requests go out in a single send.  If the
+ *  pipeline is full the caller has to read a reply first.  Ping messages
+ *  longer than CS472_MAX_QUEUED_MSG have to use cs472_conn_ping_stream()
+ *
+ *  Returns 0 on success or -1 on error
+ */
+int cs472_conn_queue(cs472_conn_t *conn, int req_cmd, const char *req_data){
+    return queue_request(conn, req_cmd, req_data,
+        conn->probing ? PROTO_VER_MAX : conn->ver);
+}
+
+/*
+ *  Makes sure the receive buffer holds at least need bytes starting at
+ *  rd_pos, reading from the socket as needed.  Before reading, whatever
+ *  is buffered is slid to the front of the buffer to make room.
+ *  Returns 0 on success or -1 on an error or closed connection
+ */
+static int conn_fill(cs472_conn_t *conn, int need){
+    int avail = conn->wr_pos - conn->rd_pos;
+
+    if (need > sizeof(conn->recv_buff))
+        return -1;
+
+    while (avail < need) {
+        if (conn->rd_pos > 0) {
+            memmove(conn->recv_buff, conn->recv_buff + conn->rd_pos, avail);
+            conn->rd_pos = 0;
+            conn->wr_pos = avail;
+        }
+        int ret = recv(conn->sock, conn->recv_buff + conn->wr_pos,
+            sizeof(conn->recv_buff) - conn->wr_pos, 0);
+        if (ret == -1) {
+            perror("recv");
+            return -1;
+        }
+        if (ret == 0) {
+            fprintf(stderr, "Server closed the connection\n");
+            return -1;
+        }
+        conn->wr_pos += ret;
+        avail += ret;
+    }
+    return 0;
+}
+
+/*
+ *  Pops the oldest outstanding request and checks that the reply is
+ *  the answer to it.  Returns 1 if it matches or -1 if it does not
+ */
+static int match_reply(cs472_conn_t *conn, cs472_reply_t *reply){
+    reply->req_cmd = conn->pending[conn->pending_head];
+    conn->pending_head = (conn->pending_head + 1) % CS472_PIPELINE_DEPTH;
+    conn->outstanding--;
+
+    if (reply->header.cmd != reply->req_cmd || reply->header.dir != DIR_RECV) {
+        fprintf(stderr, "Reply does not match the outstanding request\n");
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ *  Receives the next reply from the server.  Replies come back in the
+ *  same order the requests were sent, so the reply is matched with the
+ *  oldest request that is still outstanding.  A single recv() can bring
+ *  in many replies, so we only go back to the socket when the buffer
+ *  does not already hold a complete packet.
+ *
+ *  Returns 1 if a reply was received, 0 if no requests are outstanding
+ *  and -1 on error, a closed connection, or a reply that does not match
+ */
+int cs472_conn_recv(cs472_conn_t *conn, cs472_reply_t *reply){
+    uint8_t *packet;
+    int hdr_sz;
+
+    if (conn->outstanding == 0)
+        return 0;
+
+    //make sure anything queued is on its way, otherwise we wait forever
+    if (cs472_conn_flush(conn) == -1)
+        return -1;
+
+    //first the version 1 header, its LEN tells us if this is a version 2
+    //header, and then the whole packet
+    if (conn_fill(conn, CS472_HDR_WIRE_SZ) == -1)
+        return -1;
+    hdr_sz = CS472_WIRE_HDR_SZ(conn->recv_buff + conn->rd_pos);
+    if (conn_fill(conn, hdr_sz) == -1)
+        return -1;
+    reply->pkt_len = cs472_packet_len(conn->recv_buff + conn->rd_pos);
+    if (reply->pkt_len < hdr_sz || conn_fill(conn, reply->pkt_len) == -1) {
+        fprintf(stderr, "Bad packet length %u from server\n", reply->pkt_len);
+        return -1;
+    }
+    packet = conn->recv_buff + conn->rd_pos;
+
+    cs472_hdr_decode(packet, &reply->header);
+    reply->msg = packet + hdr_sz;
+    reply->msg_len = reply->pkt_len - hdr_sz;
+    conn->rd_pos += reply->pkt_len;
+
+    //the first reply after cs472_conn_probe() tells us the version, the
+    //server answers with the highest version both sides speak
+    if (conn->probing) {
+        conn->probing = 0;
+        if (reply->header.ver >= PROTO_VER_2)
+            conn->ver = PROTO_VER_2;
+    }
+
+    return match_reply(conn, reply);
+}
+
+/*
+ *  Starts negotiating the protocol version without waiting for it.  Until
+ *  the first reply comes back requests are framed as version 1, so any
+ *  server can read them, with VER set to the highest version we speak.
+ *  The first reply sets the version for the rest of the connection, so a
+ *  batch of requests pays no extra round trip to negotiate.  Requests
+ *  queued before then are limited to what fits in a version 1 packet.
+ *  Returns 0 on success or -1 if requests are already outstanding
+ */
+int cs472_conn_probe(cs472_conn_t *conn){
+    if (conn->outstanding != 0)
+        return -1;
+
+    conn->ver = PROTO_VER_1;
+    conn->probing = 1;
+    return 0;
+}
+
+/*
+ *  Asks the server which protocol version to use and waits for the
+ *  answer.  The probe is a ping sent through cs472_conn_probe().
+ *  Returns the version agreed on or -1 on an error
+ */
+int cs472_conn_negotiate(cs472_conn_t *conn){
+    cs472_reply_t reply;
+
+    if (cs472_conn_probe(conn) == -1)
+        return -1;
+    if (cs472_conn_queue(conn, CMD_PING_PONG, "VER") == -1)
+        return -1;
+    if (cs472_conn_recv(conn, &reply) != 1)
+        return -1;
+    return conn->ver;
+}
+
+/*
+ *  Sends a ping with a message of any size up to MAX_PING_MSG_V2 and
+ *  writes the reply message to out as it arrives.  Neither the request
+ *  nor the reply has to fit in memory.  The server starts streaming the
+ *  reply back before it has read all of the request, so we cannot send
+ *  everything and then read, with big messages both sides would block on
+ *  full socket buffers.  Instead poll() tells us when we can write more
+ *  of the request and when more of the reply is ready.
+ *
+ *  This needs version 2 and an empty pipeline.  reply gets the header
+ *  and lengths, its msg pointer is NULL since the message went to out.
+ *  Returns 1 on success or -1 on error
+ */
+int cs472_conn_ping_stream(cs472_conn_t *conn, const char *msg, FILE *out,
+            cs472_reply_t *reply){
+    cs472_proto_header_t header;
+    uint32_t msg_len = strlen(msg) + 1;
+    int      hdr_len;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    int      hdr_sz = 0;
+    struct pollfd pfd;
+
+    if (conn->ver < PROTO_VER_2 || conn->outstanding != 0 || conn->send_len != 0 ||
+            conn->rd_pos != conn->wr_pos)
+        return -1;
+    conn->rd_pos = conn->wr_pos = 0;
+
+    memset(&header, 0, sizeof(cs472_proto_header_t));
+    header.proto = PROTO_CS_FUN;
+    header.ver = conn->ver;
+    header.cmd = CMD_PING_PONG;
+    header.dir = DIR_SEND;
+    header.atm = TERM_FALL;
+    header.ay = CURRENT_AY;
+    strncpy(header.course, "NONE", sizeof(header.course));
+    hdr_len = prepare_hdr_v2(&header, msg_len, conn->send_buff, sizeof(conn->send_buff));
+    if (hdr_len == -1)
+        return -1;
+
+    conn->pending[conn->pending_head] = CMD_PING_PONG;
+    conn->outstanding = 1;
+    reply->msg = NULL;
+    reply->pkt_len = 0;
+
+    pfd.fd = conn->sock;
+    while (reply->pkt_len == 0 || received < reply->pkt_len) {
+        pfd.events = POLLIN | (sent < hdr_len + msg_len ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) == -1) {
+            perror("poll");
+            return -1;
+        }
+
+        if (pfd.revents & POLLOUT) {
+            //the header first, then the message straight from the caller
+            int ret;
+            if (sent < hdr_len)
+                ret = send(conn->sock, conn->send_buff + sent, hdr_len - sent, 0);
+            else
+                ret = send(conn->sock, msg + (sent - hdr_len), hdr_len + msg_len - sent, 0);
+            if (ret == -1) {
+                perror("send");
+                return -1;
+            }
+            sent += ret;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            //collect the reply header in the receive buffer, after that
+            //every chunk of message goes straight to out
+            int want = reply->pkt_len == 0 ? CS472_HDR_V2_WIRE_SZ - conn->wr_pos
+                                           : sizeof(conn->recv_buff);
+            if (reply->pkt_len != 0 && want > reply->pkt_len - received)
+                want = reply->pkt_len - received;
+            int ret = recv(conn->sock, conn->recv_buff + (reply->pkt_len ? 0 : conn->wr_pos),
+                want, 0);
+            if (ret <= 0) {
+                fprintf(stderr, "Server closed the connection\n");
+                return -1;
+            }
+
+            if (reply->pkt_len != 0) {
+                fwrite(conn->recv_buff, 1, ret, out);
+                received += ret;
+                continue;
+            }
+
+            conn->wr_pos += ret;
+            if (conn->wr_pos < CS472_HDR_WIRE_SZ)
+                continue;
+            hdr_sz = CS472_WIRE_HDR_SZ(conn->recv_buff);
+            if (conn->wr_pos < hdr_sz)
+                continue;
+            cs472_hdr_decode(conn->recv_buff, &reply->header);
+            reply->pkt_len = cs472_packet_len(conn->recv_buff);
+            if (reply->pkt_len < hdr_sz) {
+                fprintf(stderr, "Bad packet length %u from server\n", reply->pkt_len);
+                return -1;
+            }
+            //anything we read past the header is already message data
+            received = conn->wr_pos;
+            fwrite(conn->recv_buff + hdr_sz, 1, conn->wr_pos - hdr_sz, out);
+            conn->rd_pos = conn->wr_pos = 0;
+        }
+    }
+
+    reply->msg_len = reply->pkt_len - hdr_sz;
+    return match_reply(conn, reply);
+}
+
+/*
+ *  Looks up a batch of courses over one connection.  Requests are queued
+ *  back to back so they go out in as few sends as possible, and we only
+ *  stop to read replies when the pipeline is full.  For a batch that fits
+ *  in the pipeline this is a single round trip to the server.
+ *
+ *  Each reply is handed to cb as it arrives, with the index of the course
+ *  in course_ids it answers, so a version 2 description comes through
+ *  whole instead of being copied into a fixed size buffer.  Returns the
+ *  number of replies received, which is less than count on an error
+ */
+int cs472_class_info_batch(cs472_conn_t *conn, char *course_ids[], int count,
+            cs472_batch_cb cb, void *arg){
+    cs472_reply_t reply;
+    int sent = 0;
+    int received = 0;
+
+    while (received < count) {
+        while (sent < count && conn->outstanding < CS472_PIPELINE_DEPTH) {
+            if (cs472_conn_queue(conn, CMD_CLASS_INFO, course_ids[sent]) == -1)
+                return received;
+            sent++;
+        }
+
+        if (cs472_conn_recv(conn, &reply) != 1)
+            return received;
+
+        cb(received, &reply, arg);
+        received++;
+    }
+    return received;
+}
@@ -0,0 +1,100 @@
+/*
+ *  cs472-conn.h
+ *
+ *  A small client library for the CS472-FUN protocol that keeps a single
+ *  TCP connection open and pipelines requests over it.  The original
+ *  client opened a connection, sent one packet, read one reply and then
+ *  closed the connection.  That means every course lookup pays for a TCP
+ *  handshake and a full round trip.
+ *
+ *  With this library requests are queued into a send buffer and written
+ *  to the server together.  The server answers requests in the order it
+ *  receives them, so replies are matched to requests in FIFO order.  A
+ *  connection allows up to CS472_PIPELINE_DEPTH requests to be in flight
+ *  before we stop and read replies, this keeps both sides from blocking
+ *  on full socket buffers.
+ *
+ *  After connecting, cs472_conn_probe() asks the server if it speaks
+ *  protocol version 2 in the requests themselves, and the first reply
+ *  answers, so negotiating costs no extra round trip.  From then on, if it
+ *  does, requests and replies use the 32 bit length and messages can be
+ *  bigger than 255 bytes.  cs472_conn_negotiate() does the same but waits
+ *  for the answer, for when a request needs version 2 up front.  Messages
+ *  too big for the connection buffers are sent with
+ *  cs472_conn_ping_stream(), which streams the request out and the reply
+ *  back at the same time.
+ *
+ *  Typical usage:
+ *
+ *      cs472_conn_t conn;
+ *      cs472_conn_open(&conn, "127.0.0.1", PORT_NUM);
+ *      cs472_conn_probe(&conn);
+ *      cs472_conn_queue(&conn, CMD_CLASS_INFO, "cs472");
+ *      cs472_conn_queue(&conn, CMD_PING_PONG, "hello");
+ *      cs472_conn_flush(&conn);
+ *      cs472_conn_recv(&conn, &reply);     //reply to cs472
+ *      cs472_conn_recv(&conn, &reply);     //reply to hello
+ *      cs472_conn_close(&conn);
+ */
+#ifndef CS472CONN_H_INCLUDED
+#define CS472CONN_H_INCLUDED
+
+#include "cs472-proto.h"
+
+#include <stdio.h>
+
+#define CS472_PIPELINE_DEPTH    64      //Max requests outstanding on a connection
+#define CS472_CONN_BUFF_SZ      4096    //Size of the send and receive buffers
+
+//Biggest message cs472_conn_queue() takes, the reply has to fit in the
+//receive buffer.  Bigger ones go through cs472_conn_ping_stream()
+#define CS472_MAX_QUEUED_MSG    (CS472_CONN_BUFF_SZ / 2)
+
+//A reply that has been received and matched to its request.  The msg
+//pointer points into the connection receive buffer and is only valid
+//until the next call to cs472_conn_recv()
+typedef struct cs472_reply_t {
+    cs472_proto_header_t header;
+    uint32_t pkt_len;
+    uint8_t *msg;
+    uint32_t msg_len;
+    int     req_cmd;            //The command of the request this answers
+} cs472_reply_t;
+
+//Gets each reply of cs472_class_info_batch() as it arrives, index is the
+//course it answers.  reply->msg is only valid during the call
+typedef void (*cs472_batch_cb)(int index, const cs472_reply_t *reply, void *arg);
+
+typedef struct cs472_conn_t {
+    int      sock;
+    int      ver;               //Protocol version agreed with the server
+    int      probing;           //Set until the first reply says which version
+
+    //Requests waiting to be written to the socket
+    uint8_t  send_buff[CS472_CONN_BUFF_SZ];
+    int      send_len;
+
+    //Bytes read from the socket, rd_pos is where the next reply starts
+    uint8_t  recv_buff[CS472_CONN_BUFF_SZ];
+    int      rd_pos;
+    int      wr_pos;
+
+    //FIFO of the commands that are waiting for a reply
+    uint8_t  pending[CS472_PIPELINE_DEPTH];
+    int      pending_head;
+    int      outstanding;
+} cs472_conn_t;
+
+int  cs472_conn_open(cs472_conn_t *conn, const char *addr, int port);
+void cs472_conn_close(cs472_conn_t *conn);
+int  cs472_conn_probe(cs472_conn_t *conn);
+int  cs472_conn_negotiate(cs472_conn_t *conn);
+int  cs472_conn_queue(cs472_conn_t *conn, int req_cmd, const char *req_data);
+int  cs472_conn_flush(cs472_conn_t *conn);
+int  cs472_conn_recv(cs472_conn_t *conn, cs472_reply_t *reply);
+int  cs472_conn_ping_stream(cs472_conn_t *conn, const char *msg, FILE *out,
+            cs472_reply_t *reply);
+int  cs472_class_info_batch(cs472_conn_t *conn, char *course_ids[], int count,
+            cs472_batch_cb cb, void *arg);
+
+#endif
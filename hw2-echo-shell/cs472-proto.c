@@ -1,6 +1,7 @@
 #include "cs472-proto.h"
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 
 /*
  *  This helper prepares the request packet, it takes a number of parameters:
@@ -18,9 +19,10 @@
  * 
  *  Try to follow good coding and make sure the buffer is big enough to
  *  hold the entire packet, return -1 if not, or return the ultimate size
- *  of the packet data.
+ *  of the packet data.  A version 1 packet is at most UINT8_MAX bytes, the
+ *  most LEN can hold, anything bigger also returns -1.
  * 
- *      uint16_t packet_sz = sizeof(cs472_proto_header_t) + pay_length;
+ *      uint16_t packet_sz = CS472_HDR_WIRE_SZ + pay_length;
  *      if ( packet_sz > packet_len)
  *          return -1;
  *  
@@ -29,19 +31,59 @@ uint16_t  prepare_req_packet(cs472_proto_header_t *header,
             uint8_t *payload, uint8_t pay_length, uint8_t *packet,
             uint16_t packet_len ){
 
-    uint16_t packet_sz = sizeof(cs472_proto_header_t) + pay_length;
+    uint16_t packet_sz = CS472_HDR_WIRE_SZ + pay_length;
     if ( packet_sz > packet_len)
         return -1;
+
+    //LEN is 8 bits, and a LEN of 0 marks a version 2 header, so a bigger
+    //packet would wrap into something else.  Use prepare_hdr_v2() for those
+    if (packet_sz > UINT8_MAX)
+        return -1;
     
-    bzero(packet, packet_len);
-    memcpy(packet, header, sizeof(cs472_proto_header_t));
-    memcpy(packet + sizeof(cs472_proto_header_t), payload, pay_length);
+    //set the length before the header is encoded so the packet on the
+    //wire carries it, the receiver frames the next packet using this
     header->len = packet_sz;
+    cs472_hdr_encode(header, packet);
+    memcpy(packet + CS472_HDR_WIRE_SZ, payload, pay_length);
 
 
     return packet_sz;
 }
 
+/*
+ *  Version 2 version of prepare_req_packet, this only writes the 16 byte
+ *  extended header into packet.  The payload is left to the caller so
+ *  large messages can be sent straight from where they are, or streamed,
+ *  instead of being copied into the packet buffer.
+ *
+ *  Returns the header size or -1 if the buffer is too small or the
+ *  payload is bigger than a version 2 packet allows
+ */
+int prepare_hdr_v2(cs472_proto_header_t *header, uint32_t pay_length,
+            uint8_t *packet, uint32_t packet_len){
+    if (packet_len < CS472_HDR_V2_WIRE_SZ || pay_length > MAX_MSG_SIZE_V2)
+        return -1;
+
+    header->len = 0;
+    cs472_hdr_encode(header, packet);
+    cs472_put_u32(packet + CS472_WIRE_LEN32_OFF, CS472_HDR_V2_WIRE_SZ + pay_length);
+    return CS472_HDR_V2_WIRE_SZ;
+}
+
+/*
+ *  Returns the total length of the packet whose header is at the front
+ *  of buff, handling both the version 1 and version 2 length fields.
+ *  Only read LEN32 when LEN says it is there, a version 1 packet might
+ *  be all that is in the buffer
+ */
+uint32_t cs472_packet_len(uint8_t *buff){
+    uint8_t len = buff[CS472_WIRE_LEN_OFF];
+
+    if (len != 0)
+        return len;
+    return cs472_get_u32(buff + CS472_WIRE_LEN32_OFF);
+}
+
 /*
  *  This helper processes a packet received and breaks it apart to make
  *  processing a bit easier
@@ -50,17 +92,157 @@ uint16_t  prepare_req_packet(cs472_proto_header_t *header,
 uint8_t  process_recv_packet(cs472_proto_header_t *header, 
             uint8_t *buffer, uint8_t **msg, uint8_t *msgLen ){
 
-    //memcpy(header, buffer, sizeof(cs472_proto_header_t));
-    *msg = buffer + sizeof(cs472_proto_header_t);
-    *msgLen = header->len - sizeof(cs472_proto_header_t);
+    cs472_hdr_decode(buffer, header);
+    *msg = buffer + CS472_HDR_WIRE_SZ;
+    *msgLen = header->len - CS472_HDR_WIRE_SZ;
     return *msgLen;
 }
 
 
+/*
+ *  Helper that keeps calling send() until the entire buffer has been
+ *  handed to the kernel.  A single send() on a TCP socket is allowed
+ *  to send less than what was asked.  Returns the number of bytes sent
+ *  or -1 on an error
+ */
+int cs472_send_all(int sock, uint8_t *buff, int len){
+    int sent = 0;
+
+    while (sent < len){
+        int ret = send(sock, buff + sent, len - sent, 0);
+        if (ret == -1)
+            return -1;
+        sent += ret;
+    }
+    return sent;
+}
+
+/*
+ *  Helper that receives the header of the next packet from a stream
+ *  socket into buff, which must have room for a version 2 header.  TCP
+ *  does not preserve message boundaries, so we first read the fixed size
+ *  header, and then use the length to figure out how much message data
+ *  follows.  This is what allows more than one packet to be sent over
+ *  the same connection.  A LEN of 0 means a version 2 header, so the 32
+ *  bit length is read as well.
+ *
+ *  Returns the header size and sets *pkt_len to the total packet length,
+ *  returns 0 if the other side closed the connection or -1 on an error
+ */
+int cs472_recv_header(int sock, uint8_t *buff, uint32_t *pkt_len){
+    int hdr_sz;
+    int ret;
+
+    ret = recv(sock, buff, CS472_HDR_WIRE_SZ, MSG_WAITALL);
+    if (ret <= 0)
+        return ret;
+    if (ret != CS472_HDR_WIRE_SZ)
+        return -1;
+
+    hdr_sz = CS472_WIRE_HDR_SZ(buff);
+    if (hdr_sz > CS472_HDR_WIRE_SZ) {
+        int extra = hdr_sz - CS472_HDR_WIRE_SZ;
+        ret = recv(sock, buff + CS472_HDR_WIRE_SZ, extra, MSG_WAITALL);
+        if (ret != extra)
+            return -1;
+    }
+
+    *pkt_len = cs472_packet_len(buff);
+    if (*pkt_len < hdr_sz || *pkt_len - hdr_sz > MAX_MSG_SIZE_V2)
+        return -1;
+    return hdr_sz;
+}
+
+/*
+ *  Helper that receives exactly one packet from a stream socket into
+ *  buff, see cs472_recv_header() for how the packet is framed.
+ *
+ *  Returns the packet size, 0 if the other side closed the connection
+ *  or -1 on an error or if the packet does not fit in buff
+ */
+int cs472_recv_packet(int sock, uint8_t *buff, uint32_t buff_sz){
+    uint32_t pkt_len;
+    int hdr_sz;
+    int ret;
+
+    if (buff_sz < CS472_HDR_V2_WIRE_SZ)
+        return -1;
+
+    hdr_sz = cs472_recv_header(sock, buff, &pkt_len);
+    if (hdr_sz <= 0)
+        return hdr_sz;
+    if (pkt_len > buff_sz)
+        return -1;
+
+    int msg_len = pkt_len - hdr_sz;
+    if (msg_len > 0){
+        ret = recv(sock, buff + hdr_sz, msg_len, MSG_WAITALL);
+        if (ret != msg_len)
+            return -1;
+    }
+    return pkt_len;
+}
+
+/*
+ *  Sets up a reader for payload_len bytes of message data.  The first
+ *  pre_len bytes come from pre (data that was already read off the
+ *  socket), the rest is read from sock as the caller asks for it
+ */
+void cs472_payload_reader_init(cs472_payload_reader_t *r, int sock,
+            uint8_t *pre, uint32_t pre_len, uint32_t payload_len){
+    r->sock = sock;
+    r->pre = pre;
+    r->pre_len = pre_len < payload_len ? pre_len : payload_len;
+    r->remaining = payload_len;
+}
+
+/*
+ *  Reads the next chunk of the payload into buff, up to buff_sz bytes.
+ *  Returns the number of bytes read, 0 when the whole payload has been
+ *  read, or -1 on an error or if the connection closed early
+ */
+int cs472_payload_read(cs472_payload_reader_t *r, uint8_t *buff, uint32_t buff_sz){
+    uint32_t want = r->remaining < buff_sz ? r->remaining : buff_sz;
+    int ret;
+
+    if (want == 0)
+        return 0;
+
+    if (r->pre_len > 0) {
+        if (want > r->pre_len)
+            want = r->pre_len;
+        memcpy(buff, r->pre, want);
+        r->pre += want;
+        r->pre_len -= want;
+        r->remaining -= want;
+        return want;
+    }
+
+    ret = recv(r->sock, buff, want, 0);
+    if (ret <= 0)
+        return -1;
+    r->remaining -= ret;
+    return ret;
+}
+
+/*
+ *  Reads and throws away whatever is left of the payload, this keeps the
+ *  stream in sync when we are not interested in the message data.
+ *  Returns 0 on success or -1 on an error
+ */
+int cs472_payload_skip(cs472_payload_reader_t *r){
+    uint8_t scratch[512];
+    int ret;
+
+    while ((ret = cs472_payload_read(r, scratch, sizeof(scratch))) > 0)
+        ;
+    return ret;
+}
+
 /*
  * Utility to print the header
  */
-void print_proto_header(cs472_proto_header_t *h) {
+void print_proto_header(cs472_proto_header_t *h, uint32_t pkt_len) {
     static char proto_def[16];
     static char proto_ver[16];
     static char proto_cmd[16];
@@ -74,6 +256,8 @@ void print_proto_header(cs472_proto_header_t *h) {
 
     if (h->ver == PROTO_VER_1)
         sprintf(proto_ver, "VERSION_1");
+    else if (h->ver == PROTO_VER_2)
+        sprintf(proto_ver, "VERSION_2");
     else    
         sprintf(proto_ver,"BAD_VER: %d", h->ver);
 
@@ -124,7 +308,7 @@ void print_proto_header(cs472_proto_header_t *h) {
     "  Direction:\t %s\n"
     "  Term:\t\t %s \n"
     "  Course:\t %s\n"
-    "  Pkt Len:\t %d\n"
+    "  Pkt Len:\t %u\n"
     "\n"
-    , proto_def, proto_ver, proto_cmd, proto_dir, proto_atm, h->course, h->len);
+    , proto_def, proto_ver, proto_cmd, proto_dir, proto_atm, h->course, pkt_len);
 }
\ No newline at end of file
@@ -34,6 +34,29 @@ LEN    The length of the message that follows the header in bytes, up to
        characters resulting in a max of 255 characters. We will leave space
        for the null to help with C strings thus a total of 256 max
 
+Version 2 - Extended Length
+---------------------------
+The 8 bit LEN field limits a packet to 255 bytes.  Version 2 adds a 32 bit
+length after the header.  A version 2 packet sets LEN to 0, which can never
+happen in version 1 because LEN always counts the header, and is followed by:
+
+    0                   1                   2                   3
+    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |        LEN32: Packet Length (network byte order)              |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |                     MSG: Message Data*                        |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+LEN32  The total packet length including the 16 byte version 2 header, the
+       message can be up to MAX_MSG_SIZE_V2 bytes
+
+Negotiation: the server always answers in the highest version that both
+sides speak, min(VER of the request, 2), and version 1 requests (or old
+clients that leave VER at 0) get version 1 replies.  A client that wants
+version 2 frames its first requests as version 1 with VER set to 2.  If a
+reply has VER 2 the rest of the connection can use version 2 packets.
+
 */
 
 #ifndef CS472PROTO_H_INCLUDED
@@ -48,6 +71,8 @@ LEN    The length of the message that follows the header in bytes, up to
 
 #define PROTO_CS_FUN    0x1
 #define PROTO_VER_1     0x1
+#define PROTO_VER_2     0x2
+#define PROTO_VER_MAX   PROTO_VER_2
 #define CMD_CLASS_INFO  0x0
 #define CMD_PING_PONG   0x1
 #define DIR_SEND        0x0
@@ -56,9 +81,16 @@ LEN    The length of the message that follows the header in bytes, up to
 #define TERM_WINTER     0x1
 #define TERM_SPRING     0x2
 #define TERM_SUMMER     0x3
+#define CURRENT_AY      2022
 
 #define MAX_MSG_SIZE    250
 #define MAX_MSG_BUFFER  256
+#define MAX_MSG_SIZE_V2 (64 * 1024)
+
+//A pong is the ping message with PONG_PREFIX in front, so the longest
+//ping (not counting its null) leaves room for both in a version 2 reply
+#define PONG_PREFIX     "PONG: "
+#define MAX_PING_MSG_V2 (MAX_MSG_SIZE_V2 - (sizeof(PONG_PREFIX) - 1) - 1)
 
 //This is the header data structure, if you have never seen
 //something like this before in C, read up on bit-fields
@@ -74,12 +106,129 @@ typedef struct cs472_proto_header_t{
     uint8_t len;
 } cs472_proto_header_t;
 
+//The struct above is only how we hold a header in memory, it is never
+//sent as is.  Bit-field order, padding and byte order are all up to the
+//compiler, so two machines could lay it out differently.  On the wire the
+//header is exactly the 12 bytes in the diagram above, in network byte
+//order, and cs472_hdr_encode() / cs472_hdr_decode() convert between the
+//two with shifts and masks.  A version 2 header is the 12 byte header
+//with LEN set to 0 followed by the 32 bit packet length.
+#define CS472_HDR_WIRE_SZ       12
+#define CS472_HDR_V2_WIRE_SZ    (CS472_HDR_WIRE_SZ + 4)
+#define CS472_WIRE_COURSE_OFF   4
+#define CS472_WIRE_LEN_OFF      11
+#define CS472_WIRE_LEN32_OFF    12
+
+//Where each field sits in the first 32 bit word, and how wide it is
+#define CS472_PROTO_SHIFT   28
+#define CS472_VER_SHIFT     24
+#define CS472_CMD_SHIFT     20
+#define CS472_DIR_SHIFT     18
+#define CS472_ATM_SHIFT     16
+#define CS472_AY_SHIFT      0
+#define CS472_PROTO_MASK    0xFu
+#define CS472_VER_MASK      0xFu
+#define CS472_CMD_MASK      0xFu
+#define CS472_DIR_MASK      0x3u
+#define CS472_ATM_MASK      0x3u
+#define CS472_AY_MASK       0xFFFFu
+
+//Catch a layout mistake at compile time rather than on the wire.  The
+//fields have to tile the first word exactly, and the course code and
+//LEN have to fill the rest of the 12 bytes
+_Static_assert(((CS472_PROTO_MASK << CS472_PROTO_SHIFT) ^ (CS472_VER_MASK << CS472_VER_SHIFT) ^
+                (CS472_CMD_MASK << CS472_CMD_SHIFT) ^ (CS472_DIR_MASK << CS472_DIR_SHIFT) ^
+                (CS472_ATM_MASK << CS472_ATM_SHIFT) ^ (CS472_AY_MASK << CS472_AY_SHIFT))
+               == 0xFFFFFFFFu &&
+               ((CS472_PROTO_MASK << CS472_PROTO_SHIFT) & (CS472_VER_MASK << CS472_VER_SHIFT)) == 0 &&
+               ((CS472_VER_MASK << CS472_VER_SHIFT) & (CS472_CMD_MASK << CS472_CMD_SHIFT)) == 0 &&
+               ((CS472_CMD_MASK << CS472_CMD_SHIFT) & (CS472_DIR_MASK << CS472_DIR_SHIFT)) == 0 &&
+               ((CS472_DIR_MASK << CS472_DIR_SHIFT) & (CS472_ATM_MASK << CS472_ATM_SHIFT)) == 0 &&
+               ((CS472_ATM_MASK << CS472_ATM_SHIFT) & (CS472_AY_MASK << CS472_AY_SHIFT)) == 0,
+               "header fields must exactly fill the first 32 bit word");
+_Static_assert(CS472_WIRE_COURSE_OFF + sizeof(((cs472_proto_header_t *)0)->course)
+               == CS472_WIRE_LEN_OFF, "course code must end where LEN starts");
+_Static_assert(CS472_WIRE_LEN_OFF + 1 == CS472_HDR_WIRE_SZ, "LEN is the last header byte");
+_Static_assert(CS472_WIRE_LEN32_OFF + 4 == CS472_HDR_V2_WIRE_SZ, "LEN32 follows the header");
+
+//string.h comes after the NULL above, it replaces it with its own
+#include <string.h>
+
+//Big endian loads and stores.  Written out byte by byte so they work on
+//any machine and any alignment, compilers turn these into a single
+//load or store plus a byte swap
+static inline void cs472_put_u32(uint8_t *p, uint32_t v){
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline uint32_t cs472_get_u32(const uint8_t *p){
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8  | (uint32_t)p[3];
+}
+
+//Packs header into the 12 byte wire format at wire.  There are no
+//branches, every field is shifted into place, so this costs the same
+//for every header
+static inline void cs472_hdr_encode(const cs472_proto_header_t *h, uint8_t *wire){
+    uint32_t word = ((uint32_t)h->proto & CS472_PROTO_MASK) << CS472_PROTO_SHIFT |
+                    ((uint32_t)h->ver   & CS472_VER_MASK)   << CS472_VER_SHIFT   |
+                    ((uint32_t)h->cmd   & CS472_CMD_MASK)   << CS472_CMD_SHIFT   |
+                    ((uint32_t)h->dir   & CS472_DIR_MASK)   << CS472_DIR_SHIFT   |
+                    ((uint32_t)h->atm   & CS472_ATM_MASK)   << CS472_ATM_SHIFT   |
+                    ((uint32_t)h->ay    & CS472_AY_MASK)    << CS472_AY_SHIFT;
+
+    cs472_put_u32(wire, word);
+    memcpy(wire + CS472_WIRE_COURSE_OFF, h->course, sizeof(h->course));
+    wire[CS472_WIRE_LEN_OFF] = h->len;
+}
+
+//Unpacks the 12 byte wire format at wire into header
+static inline void cs472_hdr_decode(const uint8_t *wire, cs472_proto_header_t *h){
+    uint32_t word = cs472_get_u32(wire);
+
+    h->proto = (word >> CS472_PROTO_SHIFT) & CS472_PROTO_MASK;
+    h->ver   = (word >> CS472_VER_SHIFT)   & CS472_VER_MASK;
+    h->cmd   = (word >> CS472_CMD_SHIFT)   & CS472_CMD_MASK;
+    h->dir   = (word >> CS472_DIR_SHIFT)   & CS472_DIR_MASK;
+    h->atm   = (word >> CS472_ATM_SHIFT)   & CS472_ATM_MASK;
+    h->ay    = (word >> CS472_AY_SHIFT)    & CS472_AY_MASK;
+    memcpy(h->course, wire + CS472_WIRE_COURSE_OFF, sizeof(h->course));
+    h->len = wire[CS472_WIRE_LEN_OFF];
+}
+
+//Size of the header at the front of wire, LEN of 0 means version 2
+#define CS472_WIRE_HDR_SZ(wire) \
+    (CS472_HDR_WIRE_SZ + 4 * ((wire)[CS472_WIRE_LEN_OFF] == 0))
+
+//Reads the payload of a packet in chunks, so the whole message never has
+//to fit in memory.  Some of the payload might already be sitting in a
+//buffer from an earlier read, pre points to those bytes.
+typedef struct cs472_payload_reader_t{
+    int      sock;
+    uint8_t  *pre;
+    uint32_t pre_len;
+    uint32_t remaining;         //payload bytes left, including pre_len
+} cs472_payload_reader_t;
+
 //Prototypes for the helper functions
 //
-void print_proto_header(cs472_proto_header_t *h);
+void print_proto_header(cs472_proto_header_t *h, uint32_t pkt_len);
 uint16_t  prepare_req_packet(cs472_proto_header_t *header, 
             uint8_t *payload, uint8_t pay_length, uint8_t *packet,
             uint16_t packet_len );
+int prepare_hdr_v2(cs472_proto_header_t *header, uint32_t pay_length,
+            uint8_t *packet, uint32_t packet_len);
 uint8_t  process_recv_packet(cs472_proto_header_t *header, 
             uint8_t *buffer, uint8_t **msg, uint8_t *msgLen );
+int cs472_send_all(int sock, uint8_t *buff, int len);
+int cs472_recv_header(int sock, uint8_t *buff, uint32_t *pkt_len);
+int cs472_recv_packet(int sock, uint8_t *buff, uint32_t buff_sz);
+uint32_t cs472_packet_len(uint8_t *buff);
+void cs472_payload_reader_init(cs472_payload_reader_t *r, int sock,
+            uint8_t *pre, uint32_t pre_len, uint32_t payload_len);
+int cs472_payload_read(cs472_payload_reader_t *r, uint8_t *buff, uint32_t buff_sz);
+int cs472_payload_skip(cs472_payload_reader_t *r);
 #endif
\ No newline at end of file
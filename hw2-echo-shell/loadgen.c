@@ -0,0 +1,537 @@
+/*
+ *  loadgen.c
+ *
+ *  Load generator for the CS472-FUN server.  It opens a number of
+ *  connections, spread over a few threads, and keeps them busy with a mix
+ *  of CLASS_INFO and PING_PONG requests for a fixed amount of time.  At
+ *  the end it reports requests per second and latency percentiles.
+ *
+ *  There are two ways to drive the load:
+ *
+ *      closed loop (default)  every connection has one request in flight
+ *                             and sends the next one as soon as the reply
+ *                             comes back, this finds the peak throughput
+ *      open loop (-r RATE)    requests go out on a fixed schedule no matter
+ *                             how fast the server answers, latency is
+ *                             measured from when a request was supposed to
+ *                             go out, so a slow server cannot hide its
+ *                             queueing delay
+ *
+ *  Every thread runs its own ppoll() loop with deadlines, a request that
+ *  is not answered within the timeout counts as a timeout and its
+ *  connection is opened again.  If that fails it is tried again every
+ *  LG_RETRY_MS, and the report says how many connections were still down
+ *  at the end.  A server that only serves one connection at a time shows
+ *  up as timeouts on all the others.
+ *
+ *  The exit status is EXIT_FAILURE if any request timed out or failed,
+ *  so this can be used as a pass/fail check on the server.
+ */
+#define _GNU_SOURCE                     //For ppoll()
+#include "cs472-proto.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#define SERVER_ADDR         "127.0.0.1"
+#define LG_BUFF_SZ          8192        //Per connection send and receive buffers
+#define LG_MAX_INFLIGHT     64          //Open loop requests queued per connection
+#define LG_MAX_THREADS      64
+#define LG_MAX_CONNS        1024
+#define NS_PER_SEC          1000000000ULL
+#define NS_PER_MS           1000000ULL
+#define LG_RETRY_MS         100         //Wait before opening a lost connection again
+
+//Longest ping we send, requests are version 1 and the 8 bit LEN has to
+//hold the header, the message and its null
+#define LG_MAX_PING         (UINT8_MAX - CS472_HDR_WIRE_SZ - 1)
+
+//One connection to the server and the requests waiting on it
+typedef struct lg_conn_t {
+    int      sock;
+    uint8_t  out[LG_BUFF_SZ];           //Requests not yet written
+    int      out_len;
+    int      out_sent;
+    uint8_t  in[LG_BUFF_SZ];            //Reply bytes not yet parsed
+    int      in_len;
+    uint64_t start[LG_MAX_INFLIGHT];    //When each outstanding request was due
+    uint8_t  cmd[LG_MAX_INFLIGHT];
+    int      head;
+    int      inflight;
+    uint64_t next_send;                 //Open loop schedule
+    uint64_t retry_at;                  //When to open it again if it is down
+} lg_conn_t;
+
+//Work and results for one thread
+typedef struct lg_thread_t {
+    pthread_t   tid;
+    lg_conn_t   *conns;
+    int         num_conns;
+    unsigned    seed;
+    uint64_t    interval;               //Open loop ns between requests per connection
+    uint64_t    completed;
+    uint64_t    class_info;
+    uint64_t    pings;
+    uint64_t    timeouts;
+    uint64_t    errors;
+    uint64_t    dropped;                //Open loop requests with no room to queue
+    uint64_t    connect_failures;       //Times a lost connection could not be opened again
+    uint64_t    *samples;               //Latency of every completed request, ns
+    uint64_t    num_samples;
+    uint64_t    max_samples;
+} lg_thread_t;
+
+//Settings, filled in from the command line
+static char     *server_addr = SERVER_ADDR;
+static int      num_threads = 1;
+static int      num_conns = 1;
+static int      duration = 5;           //seconds
+static int      class_info_pct = 80;
+static int      ping_size = 32;
+static double   rate = 0;               //requests per second, 0 is closed loop
+static int      timeout_ms = 1000;
+
+static uint64_t start_time;
+static uint64_t end_time;
+
+static const char *courses[] = {"cs472", "cs281", "cs575", "cs577", "cs610", "cs999"};
+static char ping_msg[LG_MAX_PING + 1];
+
+static uint64_t now_ns(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ *  Opens a non blocking connection to the server.  The connect itself
+ *  blocks, it finishes as soon as the server kernel accepts it into the
+ *  backlog even if the server has not called accept() yet.
+ *  Returns 0 on success or -1 on an error, with errno set
+ */
+static int lg_connect(lg_conn_t *conn){
+    struct sockaddr_in addr;
+    int err;
+
+    memset(conn, 0, sizeof(lg_conn_t));
+    conn->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->sock == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(server_addr);
+    addr.sin_port = htons(PORT_NUM);
+    if (connect(conn->sock, (const struct sockaddr *) &addr,
+                sizeof(struct sockaddr_in)) == -1) {
+        err = errno;
+        close(conn->sock);
+        conn->sock = -1;
+        errno = err;
+        return -1;
+    }
+
+    fcntl(conn->sock, F_SETFL, fcntl(conn->sock, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+/*
+ *  Throws away a connection that failed or timed out and opens a new one,
+ *  every request still outstanding on it is lost and added to counter.
+ *  If it cannot be opened it stays down and the thread loop tries again
+ *  after LG_RETRY_MS
+ */
+static void lg_reconnect(lg_thread_t *t, lg_conn_t *conn, uint64_t *counter){
+    uint64_t next_send = conn->next_send;
+
+    *counter += conn->inflight;
+    if (conn->sock != -1)
+        close(conn->sock);
+    if (lg_connect(conn) == -1) {
+        t->connect_failures++;
+        conn->retry_at = now_ns() + LG_RETRY_MS * NS_PER_MS;
+    }
+    conn->next_send = next_send;
+}
+
+/*
+ *  Adds the next request of the mix to the connection, due is the time
+ *  its latency is measured from.  Returns 0 or -1 if there is no room
+ */
+static int lg_queue_request(lg_thread_t *t, lg_conn_t *conn, uint64_t due){
+    cs472_proto_header_t header;
+    uint8_t *payload = NULL;
+    uint8_t pay_length = 0;
+    int num_courses = sizeof(courses) / sizeof(courses[0]);
+    int packet_sz;
+
+    if (conn->sock == -1 || conn->inflight == LG_MAX_INFLIGHT)
+        return -1;
+
+    memset(&header, 0, sizeof(cs472_proto_header_t));
+    header.proto = PROTO_CS_FUN;
+    header.ver = PROTO_VER_1;
+    header.dir = DIR_SEND;
+    header.atm = TERM_FALL;
+    header.ay = CURRENT_AY;
+
+    if (rand_r(&t->seed) % 100 < class_info_pct) {
+        header.cmd = CMD_CLASS_INFO;
+        strncpy(header.course, courses[rand_r(&t->seed) % num_courses],
+            sizeof(header.course));
+    } else {
+        header.cmd = CMD_PING_PONG;
+        strncpy(header.course, "NONE", sizeof(header.course));
+        payload = (uint8_t *)ping_msg;
+        pay_length = ping_size + 1;
+    }
+
+    packet_sz = (int16_t)prepare_req_packet(&header, payload, pay_length,
+        conn->out + conn->out_len, sizeof(conn->out) - conn->out_len);
+    if (packet_sz < 0)
+        return -1;
+    conn->out_len += packet_sz;
+
+    int tail = (conn->head + conn->inflight) % LG_MAX_INFLIGHT;
+    conn->start[tail] = due;
+    conn->cmd[tail] = header.cmd;
+    conn->inflight++;
+    return 0;
+}
+
+//Keeps a latency sample, the array doubles when it fills up
+static void lg_record(lg_thread_t *t, uint64_t latency){
+    if (t->num_samples == t->max_samples) {
+        uint64_t new_max = t->max_samples ? t->max_samples * 2 : 4096;
+        uint64_t *grown = realloc(t->samples, new_max * sizeof(uint64_t));
+        if (grown == NULL)
+            return;
+        t->samples = grown;
+        t->max_samples = new_max;
+    }
+    t->samples[t->num_samples++] = latency;
+}
+
+/*
+ *  Reads what the server sent and matches every complete reply with the
+ *  oldest outstanding request.  Returns 0 or -1 if the connection failed
+ */
+static int lg_read_replies(lg_thread_t *t, lg_conn_t *conn){
+    cs472_proto_header_t header;
+    int ret;
+
+    ret = recv(conn->sock, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (ret <= 0)
+        return -1;
+    conn->in_len += ret;
+
+    uint64_t now = now_ns();
+    int pos = 0;
+    while (conn->in_len - pos >= CS472_HDR_WIRE_SZ) {
+        uint8_t *packet = conn->in + pos;
+        int hdr_sz = CS472_WIRE_HDR_SZ(packet);
+        if (conn->in_len - pos < hdr_sz)
+            break;
+        uint32_t pkt_len = cs472_packet_len(packet);
+        if (pkt_len < hdr_sz || pkt_len > sizeof(conn->in))
+            return -1;
+        if (conn->in_len - pos < pkt_len)
+            break;
+
+        //the request it should answer is counted by lg_reconnect() along
+        //with the rest of the outstanding ones, a reply to nothing is not
+        cs472_hdr_decode(packet, &header);
+        if (conn->inflight == 0 || header.cmd != conn->cmd[conn->head] ||
+            header.dir != DIR_RECV) {
+            if (conn->inflight == 0)
+                t->errors++;
+            return -1;
+        }
+        lg_record(t, now - conn->start[conn->head]);
+        if (header.cmd == CMD_CLASS_INFO)
+            t->class_info++;
+        else
+            t->pings++;
+        t->completed++;
+        conn->head = (conn->head + 1) % LG_MAX_INFLIGHT;
+        conn->inflight--;
+        pos += pkt_len;
+    }
+
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return 0;
+}
+
+//Writes as much of the queued requests as the socket takes
+static int lg_write_requests(lg_conn_t *conn){
+    int ret = send(conn->sock, conn->out + conn->out_sent,
+        conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+    if (ret == -1)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    conn->out_sent += ret;
+    if (conn->out_sent == conn->out_len)
+        conn->out_sent = conn->out_len = 0;
+    return 0;
+}
+
+/*
+ *  The loop for one thread.  Each pass queues whatever requests are due,
+ *  then sleeps in ppoll() until a socket is ready or the next deadline,
+ *  which is the next scheduled request, the oldest request timing out or
+ *  the end of the test, whichever comes first.
+ */
+static void *lg_thread(void *arg){
+    lg_thread_t *t = arg;
+    struct pollfd pfds[LG_MAX_CONNS];
+    uint64_t timeout_ns = timeout_ms * NS_PER_MS;
+    uint64_t now;
+
+    while ((now = now_ns()) < end_time) {
+        uint64_t deadline = end_time;
+
+        for (int i = 0; i < t->num_conns; i++) {
+            lg_conn_t *conn = &t->conns[i];
+
+            //a connection we could not open again is retried until it
+            //comes back, nothing to send on it in the meantime
+            pfds[i].fd = -1;
+            if (conn->sock == -1 && conn->retry_at <= now)
+                lg_reconnect(t, conn, &t->errors);
+            if (conn->sock == -1) {
+                if (conn->retry_at < deadline)
+                    deadline = conn->retry_at;
+                continue;
+            }
+            if (rate == 0) {
+                if (conn->inflight == 0)
+                    lg_queue_request(t, conn, now);
+            } else {
+                while (conn->next_send <= now) {
+                    if (lg_queue_request(t, conn, conn->next_send) == -1)
+                        t->dropped++;
+                    conn->next_send += t->interval;
+                }
+                if (conn->next_send < deadline)
+                    deadline = conn->next_send;
+            }
+            if (conn->inflight > 0 && conn->start[conn->head] + timeout_ns < deadline)
+                deadline = conn->start[conn->head] + timeout_ns;
+
+            pfds[i].fd = conn->sock;
+            pfds[i].events = POLLIN | (conn->out_sent < conn->out_len ? POLLOUT : 0);
+            pfds[i].revents = 0;
+        }
+
+        //ppoll() rather than poll() so open loop requests are not held
+        //back by rounding the wait up to a whole millisecond
+        uint64_t wait_ns = deadline > now ? deadline - now : 0;
+        struct timespec wait = { wait_ns / NS_PER_SEC, wait_ns % NS_PER_SEC };
+        if (ppoll(pfds, t->num_conns, &wait, NULL) == -1 && errno != EINTR) {
+            perror("ppoll");
+            exit(EXIT_FAILURE);
+        }
+
+        now = now_ns();
+        for (int i = 0; i < t->num_conns; i++) {
+            lg_conn_t *conn = &t->conns[i];
+
+            if (conn->sock == -1 || pfds[i].fd != conn->sock)
+                continue;
+            if ((pfds[i].revents & POLLOUT) && lg_write_requests(conn) == -1) {
+                lg_reconnect(t, conn, &t->errors);
+                continue;
+            }
+            if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                lg_read_replies(t, conn) == -1) {
+                lg_reconnect(t, conn, &t->errors);
+                continue;
+            }
+            if (conn->inflight > 0 && now - conn->start[conn->head] > timeout_ns)
+                lg_reconnect(t, conn, &t->timeouts);
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+//Latency at percentile pct of the sorted samples, in microseconds
+static double percentile_us(uint64_t *sorted, uint64_t count, double pct){
+    uint64_t idx = (uint64_t)(pct / 100.0 * (count - 1) + 0.5);
+
+    return sorted[idx] / 1000.0;
+}
+
+static void usage(char *prog){
+    fprintf(stderr,
+        "usage: %s [-a ADDR] [-t THREADS] [-c CONNECTIONS] [-d SECONDS]\n"
+        "          [-m CLASS_INFO_PCT] [-s PING_SIZE] [-r RATE] [-T TIMEOUT_MS]\n"
+        "  -s PING_SIZE is 0 to %d bytes, the most a version 1 packet holds\n"
+        "  -r RATE runs open loop at RATE requests/sec in total,\n"
+        "  without it every connection runs closed loop\n", prog, LG_MAX_PING);
+    exit(EXIT_FAILURE);
+}
+
+static void initParams(int argc, char *argv[]){
+    int option;
+
+    while ((option = getopt(argc, argv, "a:t:c:d:m:s:r:T:")) != -1){
+        switch(option) {
+            case 'a': server_addr = optarg; break;
+            case 't': num_threads = atoi(optarg); break;
+            case 'c': num_conns = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'm': class_info_pct = atoi(optarg); break;
+            case 's': ping_size = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'T': timeout_ms = atoi(optarg); break;
+            default:  usage(argv[0]);
+        }
+    }
+
+    if (num_threads < 1 || num_threads > LG_MAX_THREADS || num_conns < 1 ||
+        num_conns > LG_MAX_CONNS || duration < 1 || class_info_pct < 0 ||
+        class_info_pct > 100 || ping_size < 0 || ping_size > LG_MAX_PING ||
+        rate < 0 || timeout_ms < 1)
+        usage(argv[0]);
+    if (num_threads > num_conns)
+        num_threads = num_conns;
+}
+
+int main(int argc, char *argv[]){
+    static lg_thread_t threads[LG_MAX_THREADS];
+    lg_conn_t *conns;
+    uint64_t completed = 0, class_info = 0, pings = 0;
+    uint64_t timeouts = 0, errors = 0, dropped = 0, num_samples = 0;
+    uint64_t connect_failures = 0;
+    int down = 0;
+
+    initParams(argc, argv);
+    memset(ping_msg, 'x', ping_size);
+
+    conns = calloc(num_conns, sizeof(lg_conn_t));
+    if (conns == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_conns; i++) {
+        if (lg_connect(&conns[i]) == -1) {
+            perror("connect");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    start_time = now_ns();
+    end_time = start_time + duration * NS_PER_SEC;
+
+    //hand out the connections as evenly as we can, in open loop mode
+    //each connection gets an equal share of the rate, with the start
+    //times staggered so the requests do not all go out together
+    int next_conn = 0;
+    for (int i = 0; i < num_threads; i++) {
+        lg_thread_t *t = &threads[i];
+        t->conns = &conns[next_conn];
+        t->num_conns = num_conns / num_threads + (i < num_conns % num_threads);
+        t->seed = 472 + i;
+        if (rate > 0) {
+            t->interval = (uint64_t)(NS_PER_SEC * num_conns / rate);
+            for (int j = 0; j < t->num_conns; j++)
+                t->conns[j].next_send = start_time +
+                    t->interval * (next_conn + j) / num_conns;
+        }
+        next_conn += t->num_conns;
+
+        if (pthread_create(&t->tid, NULL, lg_thread, t) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        completed += threads[i].completed;
+        class_info += threads[i].class_info;
+        pings += threads[i].pings;
+        timeouts += threads[i].timeouts;
+        errors += threads[i].errors;
+        dropped += threads[i].dropped;
+        connect_failures += threads[i].connect_failures;
+        num_samples += threads[i].num_samples;
+    }
+    double elapsed = (now_ns() - start_time) / (double)NS_PER_SEC;
+
+    //merge every thread's samples and sort them for the percentiles
+    uint64_t *samples = malloc((num_samples ? num_samples : 1) * sizeof(uint64_t));
+    if (samples == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t n = 0;
+    for (int i = 0; i < num_threads; i++) {
+        memcpy(samples + n, threads[i].samples, threads[i].num_samples * sizeof(uint64_t));
+        n += threads[i].num_samples;
+        free(threads[i].samples);
+    }
+    qsort(samples, num_samples, sizeof(uint64_t), cmp_u64);
+
+    printf("LOAD TEST RESULTS\n");
+    if (rate > 0)
+        printf("  Mode:\t\t open loop at %.0f req/s\n", rate);
+    else
+        printf("  Mode:\t\t closed loop\n");
+    printf("  Connections:\t %d over %d threads\n", num_conns, num_threads);
+    printf("  Mix:\t\t %d%% CLASS_INFO, %d%% PING_PONG (%d bytes)\n",
+        class_info_pct, 100 - class_info_pct, ping_size);
+    printf("  Duration:\t %.2f s\n", elapsed);
+    printf("  Completed:\t %llu (class info %llu, ping %llu)\n",
+        (unsigned long long)completed, (unsigned long long)class_info,
+        (unsigned long long)pings);
+    printf("  Timeouts:\t %llu\n", (unsigned long long)timeouts);
+    printf("  Errors:\t %llu\n", (unsigned long long)errors);
+    if (rate > 0)
+        printf("  Dropped:\t %llu\n", (unsigned long long)dropped);
+    for (int i = 0; i < num_conns; i++)
+        down += conns[i].sock == -1;
+    if (connect_failures > 0)
+        printf("  Reconnects:\t %llu failed, %d connections down at the end\n",
+            (unsigned long long)connect_failures, down);
+    printf("  Throughput:\t %.0f req/s\n", completed / elapsed);
+    if (num_samples > 0) {
+        printf("  Latency (us):\t p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+            percentile_us(samples, num_samples, 50),
+            percentile_us(samples, num_samples, 90),
+            percentile_us(samples, num_samples, 99),
+            percentile_us(samples, num_samples, 99.9),
+            samples[num_samples - 1] / 1000.0);
+    }
+
+    free(samples);
+    for (int i = 0; i < num_conns; i++) {
+        if (conns[i].sock != -1)
+            close(conns[i].sock);
+    }
+    free(conns);
+
+    return (timeouts || errors || connect_failures || completed == 0) ?
+        EXIT_FAILURE : EXIT_SUCCESS;
+}
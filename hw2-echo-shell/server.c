@@ -1,5 +1,6 @@
 #include "server.h"
 #include "cs472-proto.h"
+#include "listener.h"
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -7,11 +8,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/un.h>
 
 #define BUFF_SZ 512
-static uint8_t send_buffer[BUFF_SZ];
-static uint8_t recv_buffer[BUFF_SZ];
+
+//Largest message in a version 1 reply, LEN is 8 bits and covers the header
+#define MAX_V1_MSG      (UINT8_MAX - CS472_HDR_WIRE_SZ)
+
+//Largest ping message we can echo in version 1, leaves room for the
+//"PONG: " prefix and the null terminator
+#define MAX_PONG_MSG    (MAX_V1_MSG - strlen(PONG_PREFIX) - 1)
+
+//Sent back instead of a pong when the ping is over MAX_PING_MSG_V2
+#define PING_TOO_LONG_MSG   "ERROR: ping message is too long"
+
+//Reply cache size, must be a power of 2
+#define REPLY_CACHE_SLOTS   256
+#define MAX_CATALOG_LINE    1024
+#define ACCEPT_BATCH        64      //Most connections taken per wakeup
+
+//Every connection runs on its own thread, so each thread gets its own
+//buffers
+static __thread uint8_t send_buffer[BUFF_SZ];
+static __thread uint8_t recv_buffer[BUFF_SZ];
+
+static int num_listeners = 0;       //0 means one per core
+static int listen_backlog = LISTEN_BACKLOG_DEFAULT;
 
 /*
  *  A very simple database structure for this assignment, yes, i 
@@ -21,23 +46,65 @@ static uint8_t recv_buffer[BUFF_SZ];
  *  would be simulating a hashmap. See the server.h file
  *  for the definition of course_item_t 
  */
-static course_item_t course_db[] = {
+static course_item_t default_course_db[] = {
     {"cs472", "CS472: Welcome to computer networks"},
     {"cs281", "CS281: Hello from computer architecture"},
     {"cs575", "CS575: Software Design is fun"},
-    {"cs577", "CS577: Software architecture is important"}
+    {"cs577", "CS577: Software architecture is important"},
+    {"cs610", "CS610: Advanced computer networks.  This course takes a deep "
+              "look at the protocols that run the Internet, from congestion "
+              "control in TCP to the design of QUIC and HTTP/3, routing with "
+              "BGP and OSPF, software defined networking, data center network "
+              "design and measuring network performance.  Students build and "
+              "benchmark their own protocol implementations.  This description "
+              "is longer than a version 1 packet can carry, version 2 clients "
+              "get all of it."}
 };
 
+//The catalog in use, either the one above or one loaded with -f.  Every
+//time it is loaded catalog_gen goes up, which invalidates cached replies.
+//Connection threads hold catalog_lock for reading while they look at it,
+//a reload takes it for writing to swap in the new one
+static pthread_rwlock_t catalog_lock = PTHREAD_RWLOCK_INITIALIZER;
+static course_item_t *course_db = default_course_db;
+static int course_db_count = sizeof(default_course_db) / sizeof(default_course_db[0]);
+static uint32_t catalog_gen = 1;
+static char *catalog_file = NULL;
+static volatile sig_atomic_t reload_requested = 0;
+
+/*
+ *  CLASS_INFO replies only depend on the catalog and on a few header
+ *  fields, so the finished packets are kept here and sent as is.  The
+ *  cache is direct mapped, a new reply simply replaces whatever was in
+ *  its slot, so it never grows no matter what course ids clients send.
+ *
+ *  The cache is shared by all connection threads.  Each slot has its own
+ *  lock, held only to look at or replace the entry.  Cached packets are
+ *  reference counted so one can be sent without holding the lock, and a
+ *  packet that is replaced while it is being sent is freed by whichever
+ *  thread lets go of it last.
+ */
+static reply_cache_entry_t reply_cache[REPLY_CACHE_SLOTS];
+
+static void reply_hold(cached_reply_t *reply){
+    __atomic_add_fetch(&reply->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void reply_release(cached_reply_t *reply){
+    if (reply != NULL && __atomic_sub_fetch(&reply->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(reply);
+}
+
 /*
  *  Helper, given a course_id, returns the item from the course_db[]
  *  array that matches, if no match, returns a default, notice
- *  the static course_item_t for the default 
+ *  the static course_item_t for the default.  The caller holds
+ *  catalog_lock for as long as it uses the item
  */
 course_item_t * lookup_course_by_id(char *course_id) {
     static course_item_t NOT_FOUND_COURSE = {"NONE", "Requested Course Not Found"};
 
-    int count = sizeof(course_db) / sizeof(course_db[0]);
-    for (int i = 0; i < count; i++){
+    for (int i = 0; i < course_db_count; i++){
         if (strcasecmp(course_db[i].id, course_id) == 0)
             return &course_db[i];
     }
@@ -45,140 +112,488 @@ course_item_t * lookup_course_by_id(char *course_id) {
 }
 
 /*
- *  This function accepts a socket and processes requests from clients
- *  the server runs until stopped manually with a CTRL+C
+ *  Loads the course catalog from a file.  Each line is a course id
+ *  followed by whitespace and the description, blank lines and lines
+ *  starting with # are skipped.  The new catalog replaces the old one
+ *  only if the whole file loads, and cached replies built from the old
+ *  catalog are dropped.  Returns 0 on success or -1 on an error
  */
-static void process_requests(int listen_socket){
-    cs472_proto_header_t header;
-    char msg_in_buffer[MAX_MSG_SIZE];
-    char msg_out_buffer[MAX_MSG_BUFFER];
-    int data_socket;
+static int load_catalog(const char *path){
+    char line[MAX_CATALOG_LINE];
+    course_item_t *db = NULL;
+    int count = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("catalog");
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *id = strtok(line, " \t");
+        if (id == NULL || id[0] == '#')
+            continue;
+        char *description = strtok(NULL, "");
+        if (description == NULL)
+            description = "";
+        description += strspn(description, " \t");
+
+        course_item_t *grown = realloc(db, (count + 1) * sizeof(course_item_t));
+        if (grown == NULL) {
+            perror("catalog");
+            break;
+        }
+        db = grown;
+        db[count].id = strdup(id);
+        db[count].description = strdup(description);
+        count++;
+    }
+    fclose(fp);
+
+    if (count == 0) {
+        fprintf(stderr, "No courses loaded from %s\n", path);
+        free(db);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&catalog_lock);
+    course_item_t *old_db = course_db;
+    int old_count = course_db_count;
+    course_db = db;
+    course_db_count = count;
+    __atomic_add_fetch(&catalog_gen, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&catalog_lock);
+
+    if (old_db != default_course_db) {
+        for (int i = 0; i < old_count; i++) {
+            free(old_db[i].id);
+            free(old_db[i].description);
+        }
+        free(old_db);
+    }
+
+    printf("\t LOADED %d COURSES FROM %s\n", count, path);
+    return 0;
+}
+
+//SIGHUP asks for the catalog to be reloaded, the reload itself happens
+//between requests, in whichever connection thread notices it first
+static void request_reload(int sig){
+    __atomic_store_n(&reload_requested, 1, __ATOMIC_RELEASE);
+}
+
+static void check_reload(){
+    if (!__atomic_load_n(&reload_requested, __ATOMIC_RELAXED) ||
+        !__atomic_exchange_n(&reload_requested, 0, __ATOMIC_ACQ_REL))
+        return;
+    if (load_catalog(catalog_file) == -1)
+        fprintf(stderr, "Catalog reload failed, keeping the old one\n");
+}
+
+/*
+ *  Builds a complete reply packet in its own buffer, framed in the version
+ *  in the header.  A version 1 reply is cut short to fit the 8 bit LEN.
+ *  Returns the reply holding one reference, which the caller releases,
+ *  or NULL if out of memory
+ */
+static cached_reply_t *build_reply_packet(cs472_proto_header_t *header, uint8_t *msg,
+            uint32_t msg_len){
+    cached_reply_t *reply;
+    uint32_t buff_sz;
+    int hdr_sz;
+
+    if (header->ver < PROTO_VER_2 && msg_len > MAX_V1_MSG)
+        msg_len = MAX_V1_MSG;
+    buff_sz = CS472_HDR_V2_WIRE_SZ + msg_len;
+    reply = malloc(sizeof(cached_reply_t) + buff_sz);
+    if (reply == NULL)
+        return NULL;
+    reply->refs = 1;
+
+    if (header->ver < PROTO_VER_2) {
+        reply->pkt_len = prepare_req_packet(header, msg, msg_len, reply->packet, buff_sz);
+        return reply;
+    }
+
+    hdr_sz = prepare_hdr_v2(header, msg_len, reply->packet, buff_sz);
+    if (hdr_sz == -1) {
+        free(reply);
+        return NULL;
+    }
+    memcpy(reply->packet + hdr_sz, msg, msg_len);
+    reply->pkt_len = hdr_sz + msg_len;
+    return reply;
+}
+
+//Picks the cache slot for a reply header, FNV-1a over the key fields
+static reply_cache_entry_t *reply_cache_slot(cs472_proto_header_t *header){
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < sizeof(header->course); i++)
+        hash = (hash ^ (uint8_t)header->course[i]) * 16777619u;
+    hash = (hash ^ header->atm) * 16777619u;
+    hash = (hash ^ (header->ay & 0xFF)) * 16777619u;
+    hash = (hash ^ (header->ay >> 8)) * 16777619u;
+    hash = (hash ^ header->ver) * 16777619u;
+    return &reply_cache[hash & (REPLY_CACHE_SLOTS - 1)];
+}
+
+static int reply_cache_match(reply_cache_entry_t *entry, cs472_proto_header_t *header){
+    return entry->gen == __atomic_load_n(&catalog_gen, __ATOMIC_ACQUIRE) &&
+           memcmp(entry->course, header->course, sizeof(entry->course)) == 0 &&
+           entry->atm == header->atm && entry->ay == header->ay &&
+           entry->ver == header->ver;
+}
+
+/*
+ *  Answers a course lookup.  The reply echoes the course code, term and
+ *  year from the request and is framed in the reply version, so those
+ *  together with the catalog generation are the cache key.  On a hit the
+ *  cached packet goes out in a single send, on a miss the reply is built
+ *  once and kept.  Returns 0 on success or -1 on a socket error
+ */
+static int send_class_info(int sock, cs472_proto_header_t *header){
+    reply_cache_entry_t *entry = reply_cache_slot(header);
+    char course_id[sizeof(header->course) + 1];
     course_item_t *details;
+    cached_reply_t *reply = NULL;
+    cached_reply_t *old;
+    uint32_t gen;
     int ret;
 
-    //again, not the best approach, need ctrl-c to exit
-    while(1){
-        //Do some cleaning to prepare for the next request given
-        //we are looping, lets not get the last request baggage
-        //inside of this request
-        memset(&header,0,sizeof(cs472_proto_header_t));
-        memset(msg_out_buffer,0,sizeof(msg_out_buffer));
-        memset(msg_in_buffer,0,sizeof(msg_in_buffer));
-
-        //Establish a connection
-        data_socket = accept(listen_socket, NULL, NULL);
-        if (data_socket == -1) {
-            perror("accept");
-            exit(EXIT_FAILURE);
+    if (header->proto == PROTO_CS_FUN) {
+        pthread_mutex_lock(&entry->lock);
+        if (entry->reply != NULL && reply_cache_match(entry, header)) {
+            reply = entry->reply;
+            reply_hold(reply);
+        }
+        pthread_mutex_unlock(&entry->lock);
+        if (reply != NULL) {
+            ret = cs472_send_all(sock, reply->packet, reply->pkt_len);
+            reply_release(reply);
+            return ret == -1 ? -1 : 0;
         }
+    }
+
+    //the course code is not null terminated when it uses all 7 bytes
+    memcpy(course_id, header->course, sizeof(header->course));
+    course_id[sizeof(header->course)] = '\0';
+
+    pthread_rwlock_rdlock(&catalog_lock);
+    gen = catalog_gen;
+    details = lookup_course_by_id(course_id);
+    reply = build_reply_packet(header, (uint8_t *)details->description,
+        strlen(details->description));
+    if (reply == NULL) {
+        ret = send_reply(sock, header, (uint8_t *)details->description,
+            strlen(details->description));
+        pthread_rwlock_unlock(&catalog_lock);
+        return ret;
+    }
+    pthread_rwlock_unlock(&catalog_lock);
 
-        printf("\t RECEIVED REQ...\n");
-
-        /*
-         * TODO:  Handle the rest of the loop, basically you need to:
-         *
-         *      call recv() to get the request from the client
-         * 
-         *      Here is some helper code after you receive data from the client.  This
-         *      helps get setup to actually process the client request
-         * 
-         *      cs472_proto_header_t *pcktPointer =  (cs472_proto_header_t *)recv_buffer;
-         *      uint8_t *msgPointer = NULL;
-         *      uint8_t msgLen = 0;
-         *      process_recv_packet(pcktPointer, recv_buffer, &msgPointer, &msgLen);
-         * 
-         */
-
-        //TODO:  DELETE THESE VARIABLES BELOW...
-        //SEE THE COMMENT ABOVE, THESE VARIABLES ARE JUST PUT IN HERE FOR NOW TO MAKE SURE
-        //THE STUB COMPILES
-        cs472_proto_header_t *pcktPointer;
-        uint8_t *msgPointer = NULL;
-        uint8_t msgLen = 0;
+    //not worth caching replies to packets we do not recognize
+    if (header->proto == PROTO_CS_FUN) {
+        reply_hold(reply);                  //the cache's reference
+        pthread_mutex_lock(&entry->lock);
+        old = entry->reply;
+        entry->gen = gen;
+        memcpy(entry->course, header->course, sizeof(entry->course));
+        entry->atm = header->atm;
+        entry->ay = header->ay;
+        entry->ver = header->ver;
+        entry->reply = reply;
+        pthread_mutex_unlock(&entry->lock);
+        reply_release(old);
+    }
+
+    ret = cs472_send_all(sock, reply->packet, reply->pkt_len);
+    reply_release(reply);
+    return ret == -1 ? -1 : 0;
+}
+
+/*
+ *  Sends a reply message back to the client using the version in the
+ *  header.  A version 1 reply has to fit in the 8 bit LEN field so the
+ *  message is cut short if needed, a version 2 reply carries all of it.
+ *  Returns 0 on success or -1 on a socket error
+ */
+static int send_reply(int sock, cs472_proto_header_t *header, uint8_t *msg,
+            uint32_t msg_len){
+    int pkt_sz;
+    int hdr_sz;
+
+    if (header->ver < PROTO_VER_2) {
+        if (msg_len > MAX_V1_MSG)
+            msg_len = MAX_V1_MSG;
+        pkt_sz = prepare_req_packet(header, msg, msg_len, send_buffer, sizeof(send_buffer));
+        return cs472_send_all(sock, send_buffer, pkt_sz) == -1 ? -1 : 0;
+    }
+
+    hdr_sz = prepare_hdr_v2(header, msg_len, send_buffer, sizeof(send_buffer));
+    if (hdr_sz == -1)
+        return -1;
+
+    //small messages go out with the header in one send, big ones are
+    //sent straight from where they live instead of being copied
+    if (hdr_sz + msg_len <= sizeof(send_buffer)) {
+        memcpy(send_buffer + hdr_sz, msg, msg_len);
+        return cs472_send_all(sock, send_buffer, hdr_sz + msg_len) == -1 ? -1 : 0;
+    }
+    if (cs472_send_all(sock, send_buffer, hdr_sz) == -1)
+        return -1;
+    return cs472_send_all(sock, msg, msg_len) == -1 ? -1 : 0;
+}
+
+/*
+ *  Answers a ping, the reply is "PONG: " followed by the message that was
+ *  sent.  For version 2 the message is streamed back through send_buffer
+ *  one chunk at a time, so a large ping never has to fit in memory.  A
+ *  ping too long to echo gets PING_TOO_LONG_MSG back instead.
+ *  Returns 0 on success or -1 on a socket error
+ */
+static int send_pong(int sock, cs472_proto_header_t *header,
+            cs472_payload_reader_t *reader){
+    char msg_out_buffer[MAX_MSG_BUFFER];
+    uint32_t prefix_len = strlen(PONG_PREFIX);
+    int out;
+    int ret;
+
+    if (header->ver < PROTO_VER_2) {
+        //the ping message is limited so the reply still fits in
+        //the 8 bit LEN field, which includes the header
+        memset(msg_out_buffer, 0, sizeof(msg_out_buffer));
+        strcpy(msg_out_buffer, PONG_PREFIX);
+        out = prefix_len;
+        while (out < prefix_len + MAX_PONG_MSG &&
+               (ret = cs472_payload_read(reader, (uint8_t *)msg_out_buffer + out,
+                    prefix_len + MAX_PONG_MSG - out)) > 0)
+            out += ret;
+        if (cs472_payload_skip(reader) == -1)
+            return -1;
+        return send_reply(sock, header, (uint8_t *)msg_out_buffer, 
+            strlen(msg_out_buffer) + 1);
+    }
+
+    //the pong would not fit in a version 2 packet, tell the client so
+    //instead of hanging up on it
+    if (prefix_len + reader->remaining > MAX_MSG_SIZE_V2) {
+        if (cs472_payload_skip(reader) == -1)
+            return -1;
+        return send_reply(sock, header, (uint8_t *)PING_TOO_LONG_MSG,
+            sizeof(PING_TOO_LONG_MSG));
+    }
+    out = prepare_hdr_v2(header, prefix_len + reader->remaining,
+        send_buffer, sizeof(send_buffer));
+    if (out == -1)
+        return -1;
+    memcpy(send_buffer + out, PONG_PREFIX, prefix_len);
+    out += prefix_len;
+
+    do {
+        ret = cs472_payload_read(reader, send_buffer + out, sizeof(send_buffer) - out);
+        if (ret == -1)
+            return -1;
+        out += ret;
+        if ((ret == 0 || out == sizeof(send_buffer)) && out > 0) {
+            if (cs472_send_all(sock, send_buffer, out) == -1)
+                return -1;
+            out = 0;
+        }
+    } while (ret > 0);
+    return 0;
+}
+
+/*
+ *  This function handles all of the requests sent over one connection.
+ *  Clients are allowed to keep the connection open and pipeline many
+ *  requests, so we keep reading packets until the client closes its side.
+ *  Each packet is answered in the order it was received, that is how the
+ *  client matches replies to requests.
+ *
+ *  Only the header is read up front, the message data is read through a
+ *  payload reader so version 2 messages can be bigger than our buffers.
+ */
+static void process_connection(int data_socket){
+    cs472_proto_header_t request;
+    cs472_proto_header_t header;
+    cs472_payload_reader_t reader;
+    uint32_t pkt_len;
+    int hdr_sz;
+    int ret = 0;
+
+    while ((hdr_sz = cs472_recv_header(data_socket, recv_buffer, &pkt_len)) > 0){
+        check_reload();
+        cs472_hdr_decode(recv_buffer, &request);
+        cs472_payload_reader_init(&reader, data_socket, NULL, 0, pkt_len - hdr_sz);
 
         //Now lets setup to process the request and send a reply, create a copy of the header
-        //also switch header direction
-        memcpy(&header, pcktPointer, sizeof(cs472_proto_header_t)); //start building rsp header
+        //also switch header direction.  We answer in the highest version we
+        //both speak, old clients that leave VER at 0 get version 1
+        header = request;   //start building rsp header
         header.dir = DIR_RECV;
+        header.ver = (request.ver >= PROTO_VER_2) ? PROTO_VER_MAX : PROTO_VER_1;
         switch(header.cmd){
             case CMD_CLASS_INFO:
-                // sprintf(msg_out_buffer, class_msg, header.course);
-                details = lookup_course_by_id(header.course);
-                prepare_req_packet(&header,(uint8_t *)details->description, 
-                    strlen(details->description), send_buffer, sizeof(send_buffer));
+                //a lookup has no message, skip anything that was sent
+                if (cs472_payload_skip(&reader) == -1) {
+                    ret = -1;
+                    break;
+                }
+                ret = send_class_info(data_socket, &header);
                 break;
             case CMD_PING_PONG:
-                strcpy(msg_out_buffer,"PONG: ");
-                memcpy(msg_out_buffer + strlen(msg_out_buffer), msgPointer, msgLen);
-                prepare_req_packet(&header,(uint8_t *)msg_out_buffer, 
-                    strlen(msg_out_buffer), send_buffer, sizeof(send_buffer));
+                ret = send_pong(data_socket, &header, &reader);
                 break;
             default:
                 perror("invalid command");
-                close(data_socket);
-                continue;
+                return;
         }
 
-        /*
-         * TODO:  Now that we have processed things, send the response back to the 
-         *        client - hint - its in the send_buffer. also dont forget to close
-         *        the data_socket for the next request.
-         */       
+        if (ret == -1){
+            perror("send");
+            return;
+        }
     }
+    if (hdr_sz == -1)
+        perror("bad request packet");
+}
+
+//Runs one connection on its own thread, then closes it
+static void *connection_thread(void *arg){
+    int data_socket = (int)(intptr_t)arg;
+
+    process_connection(data_socket);
+    close(data_socket);
+    return NULL;
 }
 
 /*
- *  This function starts the server, basically creating the socket
- *  it will listen on INADDR_ANY which is basically all local
- *  interfaces, eg., 0.0.0.0
+ *  This function accepts connections on one listen socket, it runs on its
+ *  own thread for every listener.  Each time the socket wakes us up all
+ *  of the waiting connections are taken, so a burst of clients does not
+ *  fill the backlog, and each one is handed to a thread of its own.  The
+ *  server runs until stopped manually with a CTRL+C
+ */
+static void *process_requests(void *arg){
+    int listen_socket = (int)(intptr_t)arg;
+    int socks[ACCEPT_BATCH];
+    pthread_attr_t attr;
+    pthread_t thread;
+    int count;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    //again, not the best approach, need ctrl-c to exit
+    while(1){
+        if (listener_wait(listen_socket) == -1)
+            exit(EXIT_FAILURE);
+        count = listener_accept_all(listen_socket, socks, ACCEPT_BATCH, 0);
+        if (count == -1)
+            exit(EXIT_FAILURE);
+
+        for (int i = 0; i < count; i++) {
+            printf("\t RECEIVED CONNECTION...\n");
+            if (pthread_create(&thread, &attr, connection_thread,
+                    (void *)(intptr_t)socks[i]) != 0) {
+                perror("could not create connection thread");
+                close(socks[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ *  This function starts the server, it listens on INADDR_ANY which is
+ *  basically all local interfaces, eg., 0.0.0.0.  There is one listen
+ *  socket per core, all bound to the same port with SO_REUSEPORT, each
+ *  with its own accept thread, so the kernel spreads new connections
+ *  over the cores instead of queueing them all behind one accept()
  */
 static void start_server(){
+    pthread_t thread;
     int listen_socket;
-    int ret;
-    
-    struct sockaddr_in addr;
+    struct sigaction sa;
 
-    unlink(SOCKET_NAME);
+    //a client that goes away while we are still sending to it should
+    //only end that connection, not kill the server with SIGPIPE
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
 
-    /* Create socket. */
-    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_socket == -1) {
-        perror("socket");
-        exit(EXIT_FAILURE);
+    //with a catalog file, kill -HUP reloads it
+    if (catalog_file != NULL) {
+        if (load_catalog(catalog_file) == -1)
+            exit(EXIT_FAILURE);
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = request_reload;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGHUP, &sa, NULL);
     }
 
-    /* Bind socket to socket name. */
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(PORT_NUM);
+    for (int i = 0; i < REPLY_CACHE_SLOTS; i++)
+        pthread_mutex_init(&reply_cache[i].lock, NULL);
 
-    ret = bind(listen_socket, (const struct sockaddr *) &addr,
-               sizeof(struct sockaddr_in));
-    if (ret == -1) {
-        perror("accept");
-        exit(EXIT_FAILURE);
-    }
+    unlink(SOCKET_NAME);
+
+    if (num_listeners <= 0)
+        num_listeners = listener_num_cores();
+    printf("\t %d LISTENERS, BACKLOG %d\n", num_listeners, listen_backlog);
+
+    for (int i = 0; i < num_listeners; i++) {
+        listen_socket = listener_open(PORT_NUM, listen_backlog, LISTEN_REUSEPORT);
+        if (listen_socket == -1)
+            exit(EXIT_FAILURE);
 
-    /*
-     * Prepare for accepting connections. The backlog size is set
-     * to 20. So while one request is being processed other requests
-     * can be waiting.
-     */
-    ret = listen(listen_socket, 20);
-    if (ret == -1) {
-        perror("listen");
-        exit(EXIT_FAILURE);
+        //the last listener runs on this thread
+        if (i == num_listeners - 1)
+            break;
+        if (pthread_create(&thread, NULL, process_requests,
+                (void *)(intptr_t)listen_socket) != 0) {
+            perror("could not create listener thread");
+            exit(EXIT_FAILURE);
+        }
     }
 
     //Now process requests, this will never return so its bad coding
     //but ok for purposes of demo
-    process_requests(listen_socket);
+    process_requests((void *)(intptr_t)listen_socket);
 
     close(listen_socket);
 }
 
 int main(int argc, char *argv[])
 {
+    int option;
+
+    //
+    // usage server [-f CATALOG_FILE] [-w LISTENERS] [-b BACKLOG]
+    //
+    while ((option = getopt(argc, argv, ":f:w:b:")) != -1){
+        switch(option) {
+            case 'f':
+                catalog_file = optarg;
+                break;
+            case 'w':
+                num_listeners = atoi(optarg);
+                break;
+            case 'b':
+                listen_backlog = atoi(optarg);
+                break;
+            case ':':
+                perror ("Option missing value");
+                exit(-1);
+            default:
+            case '?':
+                perror ("Unknown option");
+                exit(-1);
+        }
+    }
+
     printf("STARTING SERVER - CTRL+C to EXIT \n");
     start_server();
 }
\ No newline at end of file
@@ -1,9 +1,39 @@
 #pragma once
 
+#include "cs472-proto.h"
+
+#include <pthread.h>
+
 typedef struct course_item_t {
     char *id;
     char *description;
 } course_item_t;
 
+//A finished CLASS_INFO reply packet, freed when the last thread using
+//it lets go
+typedef struct cached_reply_t {
+    int      refs;
+    uint32_t pkt_len;
+    uint8_t  packet[];
+} cached_reply_t;
+
+//A cache slot, the reply and the key it was built for
+typedef struct reply_cache_entry_t {
+    pthread_mutex_t lock;
+    uint32_t gen;               //Catalog generation, 0 means empty
+    char     course[7];
+    uint8_t  atm;
+    uint16_t ay;
+    uint8_t  ver;
+    cached_reply_t *reply;
+} reply_cache_entry_t;
+
 static void start_server();
-static void process_requests(int listen_socket);
\ No newline at end of file
+static void *process_requests(void *arg);
+static void *connection_thread(void *arg);
+static void process_connection(int data_socket);
+static int send_reply(int sock, cs472_proto_header_t *header, uint8_t *msg,
+            uint32_t msg_len);
+static int send_class_info(int sock, cs472_proto_header_t *header);
+static int send_pong(int sock, cs472_proto_header_t *header,
+            cs472_payload_reader_t *reader);
\ No newline at end of file
@@ -0,0 +1,285 @@
+/*
+ *  Benchmark for the tutorial servers.
+ *
+ *  usage: bench-server [-t THREADS] [-d SECONDS] [-m MESSAGE] SERVER...
+ *
+ *  Each SERVER is the path to one of the server programs.  It is started,
+ *  loaded over loopback for a few seconds and stopped again, then the
+ *  next one gets the same load, so the results are comparable.  Every
+ *  thread opens a connection, sends one request the way the client does,
+ *  reads the reply until the server closes the connection and starts
+ *  over.  That is a whole connection per request, which is what these
+ *  servers do, so the result is connections per second and how long
+ *  each one took from connect() to the end of the reply.
+ *
+ *  The message starts with 'A' by default, server2 and server3 answer
+ *  those right away instead of doing 15 seconds of slow work.
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#define PORT_NUM    1090
+#define EOF_CHAR_STR "\x05"   //CTRL+D is EOF in general ASCII 5
+
+#define BUFF_SZ     512
+#define START_WAIT_MS   3000    //How long a server gets to start listening
+
+//What one thread measured
+typedef struct bench_thread_t {
+    pthread_t   thread;
+    uint64_t    *samples;       //Latency of each connection, in ns
+    uint64_t    count;
+    uint64_t    max_count;
+    uint64_t    errors;
+} bench_thread_t;
+
+static int num_threads = 4;
+static int duration_s = 3;
+static char request[BUFF_SZ];
+static int request_len;
+static volatile int running;
+
+static uint64_t now_ns(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ *  Sends one request on a new connection and reads the whole reply.
+ *  Returns 0 on success or -1 if anything failed
+ */
+static int one_request(){
+    struct sockaddr_in addr;
+    char reply[BUFF_SZ];
+    int sock;
+    int sent = 0;
+    int ret;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(PORT_NUM);
+    if (connect(sock, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(sock);
+        return -1;
+    }
+
+    while (sent < request_len) {
+        ret = send(sock, request + sent, request_len - sent, 0);
+        if (ret == -1) {
+            close(sock);
+            return -1;
+        }
+        sent += ret;
+    }
+
+    //the server closes the connection once the reply is out
+    while ((ret = recv(sock, reply, sizeof(reply), 0)) > 0)
+        ;
+    close(sock);
+    return ret;
+}
+
+static void *bench_thread(void *arg){
+    bench_thread_t *bt = arg;
+
+    while (running) {
+        uint64_t start = now_ns();
+        if (one_request() == -1) {
+            bt->errors++;
+            continue;
+        }
+        if (bt->count == bt->max_count) {
+            uint64_t new_max = bt->max_count * 2 + 4096;
+            uint64_t *grown = realloc(bt->samples, new_max * sizeof(uint64_t));
+            if (grown == NULL) {
+                bt->errors++;
+                continue;
+            }
+            bt->samples = grown;
+            bt->max_count = new_max;
+        }
+        bt->samples[bt->count++] = now_ns() - start;
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+//Latency at percentile p of the sorted samples, in microseconds
+static double percentile_us(uint64_t *sorted, uint64_t count, double p){
+    uint64_t i;
+
+    if (count == 0)
+        return 0;
+    i = (uint64_t)(p / 100.0 * (count - 1) + 0.5);
+    return sorted[i] / 1000.0;
+}
+
+/*
+ *  Starts a server with its output thrown away and waits until it takes
+ *  connections.  Returns its pid or -1 if it did not come up
+ */
+static pid_t start_server(char *path){
+    pid_t pid;
+
+    fflush(stdout);         //or the child would print what is buffered
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL ||
+            freopen("/dev/null", "w", stderr) == NULL)
+            _exit(EXIT_FAILURE);
+        execl(path, path, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+
+    for (int waited = 0; waited < START_WAIT_MS; waited += 10) {
+        if (one_request() == 0)
+            return pid;
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            break;
+        usleep(10000);
+    }
+    fprintf(stderr, "%s did not start\n", path);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static void stop_server(pid_t pid){
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+/*
+ *  Runs the load against one server and prints a line of results.
+ *  Returns 0 on success or -1 if the server could not be tested
+ */
+static int bench_server(char *path){
+    bench_thread_t *threads;
+    uint64_t *all;
+    uint64_t total = 0;
+    uint64_t errors = 0;
+    uint64_t start, elapsed;
+    pid_t pid;
+
+    pid = start_server(path);
+    if (pid == -1)
+        return -1;
+
+    threads = calloc(num_threads, sizeof(bench_thread_t));
+    if (threads == NULL) {
+        stop_server(pid);
+        return -1;
+    }
+
+    running = 1;
+    start = now_ns();
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]) != 0) {
+            perror("could not create thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sleep(duration_s);
+    running = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        total += threads[i].count;
+        errors += threads[i].errors;
+    }
+    elapsed = now_ns() - start;
+    stop_server(pid);
+
+    //merge the samples so the percentiles cover every connection
+    all = malloc((total ? total : 1) * sizeof(uint64_t));
+    if (all == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    total = 0;
+    for (int i = 0; i < num_threads; i++) {
+        memcpy(all + total, threads[i].samples, threads[i].count * sizeof(uint64_t));
+        total += threads[i].count;
+        free(threads[i].samples);
+    }
+    qsort(all, total, sizeof(uint64_t), cmp_u64);
+
+    printf("%-12s %10.0f %10.1f %10.1f %10.1f %8lu\n",
+        strrchr(path, '/') ? strrchr(path, '/') + 1 : path,
+        total / (elapsed / 1e9),
+        percentile_us(all, total, 50), percentile_us(all, total, 99),
+        total ? all[total - 1] / 1000.0 : 0, (unsigned long)errors);
+    fflush(stdout);
+
+    free(all);
+    free(threads);
+    return 0;
+}
+
+static void usage(char *prog){
+    fprintf(stderr,
+        "usage: %s [-t THREADS] [-d SECONDS] [-m MESSAGE] SERVER...\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    char *msg = "A bench request";
+    int option;
+    int ret = 0;
+
+    while ((option = getopt(argc, argv, "t:d:m:")) != -1){
+        switch(option) {
+            case 't': num_threads = atoi(optarg); break;
+            case 'd': duration_s = atoi(optarg); break;
+            case 'm': msg = optarg; break;
+            default:  usage(argv[0]);
+        }
+    }
+    if (optind == argc || num_threads < 1 || duration_s < 1)
+        usage(argv[0]);
+
+    //the same request the client sends, the message and an EOF character
+    request_len = snprintf(request, sizeof(request), "%s%s", msg, EOF_CHAR_STR);
+    if (request_len >= sizeof(request))
+        usage(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d threads, %d seconds per server, one request per connection\n",
+        num_threads, duration_s);
+    printf("%-12s %10s %10s %10s %10s %8s\n",
+        "SERVER", "CONN/S", "P50 US", "P99 US", "MAX US", "ERRORS");
+    for (int i = optind; i < argc; i++) {
+        if (bench_server(argv[i]) == -1)
+            ret = EXIT_FAILURE;
+    }
+    return ret;
+}
@@ -0,0 +1,330 @@
+#include "event-loop.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+static uint64_t now_ms(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//The tick we are in right now, counted from when the loop started
+static uint64_t current_tick(ev_loop_t *loop){
+    return (now_ms() - loop->start_ms) / EV_TICK_MS;
+}
+
+/*
+ *  Worker thread, takes jobs off the pending queue, runs them and moves
+ *  them to the done queue.  A byte down the pipe wakes the loop, which
+ *  runs the done callback.
+ */
+static void *ev_worker(void *arg){
+    ev_loop_t *loop = arg;
+    ev_job_t *job;
+
+    while (1) {
+        pthread_mutex_lock(&loop->lock);
+        while (loop->pending_head == NULL)
+            pthread_cond_wait(&loop->work_ready, &loop->lock);
+        job = loop->pending_head;
+        loop->pending_head = job->next;
+        if (loop->pending_head == NULL)
+            loop->pending_tail = NULL;
+        pthread_mutex_unlock(&loop->lock);
+
+        job->work(job->arg);
+
+        pthread_mutex_lock(&loop->lock);
+        int was_empty = loop->done_head == NULL;
+        job->next = NULL;
+        if (loop->done_tail != NULL)
+            loop->done_tail->next = job;
+        else
+            loop->done_head = job;
+        loop->done_tail = job;
+        pthread_mutex_unlock(&loop->lock);
+
+        //one byte per batch is enough, the loop drains the whole queue
+        if (was_empty) {
+            char c = 1;
+            while (write(loop->wake_pipe[1], &c, 1) == -1 && errno == EINTR)
+                ;
+        }
+    }
+    return NULL;
+}
+
+/*
+ *  Runs the done callbacks of finished jobs, called when a worker writes
+ *  to the wake pipe
+ */
+static void ev_run_completions(ev_loop_t *loop, int fd, int revents, void *arg){
+    char drain[64];
+    ev_job_t *job;
+
+    while (read(fd, drain, sizeof(drain)) > 0)
+        ;
+
+    pthread_mutex_lock(&loop->lock);
+    job = loop->done_head;
+    loop->done_head = loop->done_tail = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (job != NULL) {
+        ev_job_t *next = job->next;
+        if (job->done != NULL)
+            job->done(loop, job->arg);
+        free(job);
+        job = next;
+    }
+}
+
+/*
+ *  Sets up a loop, with num_workers threads for ev_offload(), which can
+ *  be 0 if nothing is offloaded.  Returns 0 on success or -1 on an error
+ */
+int ev_loop_init(ev_loop_t *loop, int num_workers){
+    memset(loop, 0, sizeof(ev_loop_t));
+    loop->start_ms = now_ms();
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->work_ready, NULL);
+
+    if (pipe(loop->wake_pipe) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(loop->wake_pipe[0], F_SETFL, O_NONBLOCK);
+    if (ev_io_add(loop, loop->wake_pipe[0], POLLIN, ev_run_completions, NULL) == -1)
+        return -1;
+
+    if (num_workers > 0) {
+        loop->workers = calloc(num_workers, sizeof(pthread_t));
+        if (loop->workers == NULL)
+            return -1;
+        for (int i = 0; i < num_workers; i++) {
+            if (pthread_create(&loop->workers[i], NULL, ev_worker, loop) != 0) {
+                perror("could not create worker thread");
+                return -1;
+            }
+        }
+        loop->num_workers = num_workers;
+    }
+    return 0;
+}
+
+/*
+ *  Starts watching fd for events (POLLIN, POLLOUT), cb runs on the loop
+ *  thread when any of them happen.  Returns 0 on success or -1
+ */
+int ev_io_add(ev_loop_t *loop, int fd, int events, ev_io_cb cb, void *arg){
+    if (fd >= loop->max_fd) {
+        int new_max = fd * 2 + 16;
+        int *grown = realloc(loop->fd_index, new_max * sizeof(int));
+        if (grown == NULL)
+            return -1;
+        for (int i = loop->max_fd; i < new_max; i++)
+            grown[i] = -1;
+        loop->fd_index = grown;
+        loop->max_fd = new_max;
+    }
+    if (loop->num_io == loop->max_io) {
+        int new_max = loop->max_io * 2 + 16;
+        struct pollfd *pfds = realloc(loop->pfds, new_max * sizeof(struct pollfd));
+        if (pfds == NULL)
+            return -1;
+        loop->pfds = pfds;
+        ev_io_t *io = realloc(loop->io, new_max * sizeof(ev_io_t));
+        if (io == NULL)
+            return -1;
+        loop->io = io;
+        loop->max_io = new_max;
+    }
+
+    int i = loop->num_io++;
+    loop->pfds[i].fd = fd;
+    loop->pfds[i].events = events;
+    loop->pfds[i].revents = 0;
+    loop->io[i].cb = cb;
+    loop->io[i].arg = arg;
+    loop->fd_index[fd] = i;
+    return 0;
+}
+
+//Changes the events a watched fd is waiting for
+int ev_io_modify(ev_loop_t *loop, int fd, int events){
+    if (fd >= loop->max_fd || loop->fd_index[fd] == -1)
+        return -1;
+    loop->pfds[loop->fd_index[fd]].events = events;
+    return 0;
+}
+
+/*
+ *  Stops watching fd, call this before closing it.  The last watcher
+ *  moves into the hole, it has already been looked at in this pass of
+ *  the loop, so its revents are cleared to keep it from running twice
+ */
+void ev_io_remove(ev_loop_t *loop, int fd){
+    if (fd >= loop->max_fd || loop->fd_index[fd] == -1)
+        return;
+
+    int i = loop->fd_index[fd];
+    int last = --loop->num_io;
+    if (i != last) {
+        loop->pfds[i] = loop->pfds[last];
+        loop->pfds[i].revents = 0;
+        loop->io[i] = loop->io[last];
+        loop->fd_index[loop->pfds[i].fd] = i;
+    }
+    loop->fd_index[fd] = -1;
+}
+
+/*
+ *  Starts a timer that runs cb after delay_ms, rounded up to the next
+ *  tick.  The slot is the expiry tick modulo the wheel size, timers more
+ *  than one turn of the wheel away share a slot with nearer ones and are
+ *  simply skipped until their turn comes around
+ */
+void ev_timer_start(ev_loop_t *loop, ev_timer_t *timer, uint64_t delay_ms,
+            ev_timer_cb cb, void *arg){
+    uint64_t ticks = (delay_ms + EV_TICK_MS - 1) / EV_TICK_MS;
+
+    if (timer->active)
+        ev_timer_stop(loop, timer);
+
+    timer->expires = current_tick(loop) + (ticks ? ticks : 1);
+    timer->cb = cb;
+    timer->arg = arg;
+    timer->active = 1;
+
+    ev_timer_t **slot = &loop->wheel[timer->expires & (EV_WHEEL_SLOTS - 1)];
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL)
+        (*slot)->prev = timer;
+    *slot = timer;
+    loop->num_timers++;
+}
+
+//Stops a timer that has not gone off yet
+void ev_timer_stop(ev_loop_t *loop, ev_timer_t *timer){
+    if (!timer->active)
+        return;
+
+    if (timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else
+        loop->wheel[timer->expires & (EV_WHEEL_SLOTS - 1)] = timer->next;
+    if (timer->next != NULL)
+        timer->next->prev = timer->prev;
+    timer->active = 0;
+    loop->num_timers--;
+}
+
+/*
+ *  Runs every timer that is due, one slot per tick that has gone by.  A
+ *  callback can stop or free any other timer, the next one in the slot
+ *  included, so after each callback the slot is walked again from the
+ *  start.  Timers started by a callback are due after now, so the walk
+ *  always ends
+ */
+static void ev_run_timers(ev_loop_t *loop){
+    uint64_t now = current_tick(loop);
+
+    while (loop->tick < now && loop->num_timers > 0) {
+        loop->tick++;
+        ev_timer_t **slot = &loop->wheel[loop->tick & (EV_WHEEL_SLOTS - 1)];
+        ev_timer_t *timer = *slot;
+        while (timer != NULL) {
+            if (timer->expires > loop->tick) {
+                timer = timer->next;
+                continue;
+            }
+            ev_timer_stop(loop, timer);
+            timer->cb(loop, timer->arg);
+            timer = *slot;
+        }
+    }
+    //with no timers there is nothing to catch up on
+    if (loop->num_timers == 0)
+        loop->tick = now;
+}
+
+/*
+ *  How long poll() can sleep before the next timer needs to run, found
+ *  by looking for the next slot with anything in it.  -1 means forever
+ */
+static int ev_poll_timeout(ev_loop_t *loop){
+    if (loop->num_timers == 0)
+        return -1;
+
+    uint64_t now = current_tick(loop);
+    for (uint64_t t = loop->tick + 1; t < loop->tick + 1 + EV_WHEEL_SLOTS; t++) {
+        if (loop->wheel[t & (EV_WHEEL_SLOTS - 1)] != NULL) {
+            uint64_t due_ms = loop->start_ms + t * EV_TICK_MS;
+            uint64_t ms = now_ms();
+            return t <= now || due_ms <= ms ? 0 : (int)(due_ms - ms);
+        }
+    }
+    return 0;
+}
+
+/*
+ *  Hands work to a worker thread, done runs on the loop thread once it
+ *  has finished.  Returns 0 on success or -1 on an error
+ */
+int ev_offload(ev_loop_t *loop, ev_work_cb work, ev_done_cb done, void *arg){
+    ev_job_t *job;
+
+    if (loop->num_workers == 0)
+        return -1;
+    job = malloc(sizeof(ev_job_t));
+    if (job == NULL)
+        return -1;
+    job->work = work;
+    job->done = done;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&loop->lock);
+    if (loop->pending_tail != NULL)
+        loop->pending_tail->next = job;
+    else
+        loop->pending_head = job;
+    loop->pending_tail = job;
+    pthread_cond_signal(&loop->work_ready);
+    pthread_mutex_unlock(&loop->lock);
+    return 0;
+}
+
+/*
+ *  Runs the loop, this never returns.  Each pass sleeps in poll() until
+ *  a watched fd is ready or the next timer is due, then runs the
+ *  callbacks.  Watchers are walked from the end so one that is removed
+ *  by a callback can not make us skip another
+ */
+void ev_loop_run(ev_loop_t *loop){
+    while (1) {
+        int ret = poll(loop->pfds, loop->num_io, ev_poll_timeout(loop));
+        if (ret == -1 && errno != EINTR) {
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = loop->num_io - 1; ret > 0 && i >= 0; i--) {
+            if (i >= loop->num_io || loop->pfds[i].revents == 0)
+                continue;
+            int revents = loop->pfds[i].revents;
+            loop->pfds[i].revents = 0;
+            loop->io[i].cb(loop, loop->pfds[i].fd, revents, loop->io[i].arg);
+        }
+
+        ev_run_timers(loop);
+    }
+}
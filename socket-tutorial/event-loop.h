@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+ *  A small single threaded event loop.
+ *
+ *  The first servers in this tutorial block: in recv() waiting for a
+ *  request, and in sleep() pretending to do slow work.  A blocked thread
+ *  can not do anything else, so to have many requests in progress we
+ *  needed many threads.  An event loop turns that around.  One thread
+ *  waits for anything that can happen, a socket becoming readable, a
+ *  timer going off or some background work finishing, and runs a
+ *  callback for it.  Callbacks never block, so thousands of requests can
+ *  be waiting at the same time without a thread for each one.
+ *
+ *  The loop has three parts:
+ *
+ *      io watchers     callbacks for sockets, using poll() so this also
+ *                      builds on the Mac
+ *      timer wheel     callbacks after a delay.  Timers are hashed into a
+ *                      ring of slots by the tick they expire on, so
+ *                      starting and stopping one is O(1) no matter how
+ *                      many are pending
+ *      completions     work that really has to block is handed to a small
+ *                      pool of worker threads with ev_offload(), when it
+ *                      is done its callback runs back on the loop thread.
+ *                      Workers wake the loop through a pipe
+ *
+ *  Everything except ev_offload() work functions runs on the loop thread,
+ *  so callbacks do not need any locking.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+
+#define EV_TICK_MS          10      //Timer resolution
+#define EV_WHEEL_SLOTS      512     //Timer wheel size, power of 2
+
+typedef struct ev_loop_t ev_loop_t;
+
+typedef void (*ev_io_cb)(ev_loop_t *loop, int fd, int revents, void *arg);
+typedef void (*ev_timer_cb)(ev_loop_t *loop, void *arg);
+typedef void (*ev_work_cb)(void *arg);
+typedef void (*ev_done_cb)(ev_loop_t *loop, void *arg);
+
+//A timer, the caller owns the memory and it has to stay put while the
+//timer is running
+typedef struct ev_timer_t {
+    struct ev_timer_t *next;
+    struct ev_timer_t *prev;
+    uint64_t    expires;            //Tick it goes off on
+    ev_timer_cb cb;
+    void        *arg;
+    int         active;
+} ev_timer_t;
+
+//A piece of offloaded work, on the pending queue or the done queue
+typedef struct ev_job_t {
+    struct ev_job_t *next;
+    ev_work_cb  work;
+    ev_done_cb  done;
+    void        *arg;
+} ev_job_t;
+
+typedef struct ev_io_t {
+    ev_io_cb    cb;
+    void        *arg;
+} ev_io_t;
+
+struct ev_loop_t {
+    //io watchers, pfds[i] goes with io[i], fd_index maps an fd to i
+    struct pollfd *pfds;
+    ev_io_t     *io;
+    int         num_io;
+    int         max_io;
+    int         *fd_index;
+    int         max_fd;
+
+    //timer wheel
+    ev_timer_t  *wheel[EV_WHEEL_SLOTS];
+    uint64_t    start_ms;
+    uint64_t    tick;               //Last tick that has been run
+    int         num_timers;
+
+    //worker pool and completion queue
+    pthread_t   *workers;
+    int         num_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t  work_ready;
+    ev_job_t    *pending_head;
+    ev_job_t    *pending_tail;
+    ev_job_t    *done_head;
+    ev_job_t    *done_tail;
+    int         wake_pipe[2];
+};
+
+int  ev_loop_init(ev_loop_t *loop, int num_workers);
+void ev_loop_run(ev_loop_t *loop);
+
+int  ev_io_add(ev_loop_t *loop, int fd, int events, ev_io_cb cb, void *arg);
+int  ev_io_modify(ev_loop_t *loop, int fd, int events);
+void ev_io_remove(ev_loop_t *loop, int fd);
+
+void ev_timer_start(ev_loop_t *loop, ev_timer_t *timer, uint64_t delay_ms,
+            ev_timer_cb cb, void *arg);
+void ev_timer_stop(ev_loop_t *loop, ev_timer_t *timer);
+
+int  ev_offload(ev_loop_t *loop, ev_work_cb work, ev_done_cb done, void *arg);
@@ -0,0 +1,139 @@
+#ifdef __linux__
+#define _GNU_SOURCE         //for accept4()
+#endif
+
+#include "listener.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+/*
+ *  Creates a TCP socket listening on port on all local interfaces.  The
+ *  listen socket itself is non blocking so it can be drained with
+ *  listener_accept_all().  With LISTEN_REUSEPORT in flags other sockets
+ *  can listen on the same port.  Returns the socket or -1 on an error
+ */
+int listener_open(uint16_t port, int backlog, int flags){
+    struct sockaddr_in addr;
+    int listen_socket;
+    int on = 1;
+
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_socket == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    //lets the server restart right away instead of waiting for old
+    //connections to leave TIME_WAIT
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((flags & LISTEN_REUSEPORT) &&
+        setsockopt(listen_socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        perror("SO_REUSEPORT");
+        close(listen_socket);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_socket, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror("bind");
+        close(listen_socket);
+        return -1;
+    }
+
+    if (listen(listen_socket, backlog > 0 ? backlog : LISTEN_BACKLOG_DEFAULT) == -1) {
+        perror("listen");
+        close(listen_socket);
+        return -1;
+    }
+
+    fcntl(listen_socket, F_SETFL, fcntl(listen_socket, F_GETFL) | O_NONBLOCK);
+    fcntl(listen_socket, F_SETFD, FD_CLOEXEC);
+    return listen_socket;
+}
+
+//Takes one waiting connection, see listener_accept_all()
+static int listener_accept(int listen_socket, int flags){
+    int sock;
+
+#ifdef __linux__
+    do {
+        sock = accept4(listen_socket, NULL, NULL,
+            SOCK_CLOEXEC | ((flags & ACCEPT_NONBLOCK) ? SOCK_NONBLOCK : 0));
+    } while (sock == -1 && errno == EINTR);
+#else
+    do {
+        sock = accept(listen_socket, NULL, NULL);
+    } while (sock == -1 && errno == EINTR);
+    if (sock == -1)
+        return -1;
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    //BSD sockets inherit O_NONBLOCK from the listen socket, Linux does not
+    if (flags & ACCEPT_NONBLOCK)
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    else
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+#endif
+    return sock;
+}
+
+/*
+ *  Accepts every connection that is waiting, up to max_socks of them, and
+ *  puts the new sockets in socks.  They are close on exec, and non
+ *  blocking with ACCEPT_NONBLOCK in flags.  Connections that fail before
+ *  we get to them are skipped.  Returns how many were accepted, 0 once
+ *  the backlog is empty, or -1 on an error
+ */
+int listener_accept_all(int listen_socket, int *socks, int max_socks, int flags){
+    int count = 0;
+
+    while (count < max_socks) {
+        int sock = listener_accept(listen_socket, flags);
+        if (sock != -1) {
+            socks[count++] = sock;
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        //the client gave up while it was in the backlog, try the next one
+        if (errno == ECONNABORTED || errno == EPROTO)
+            continue;
+        if (count > 0)
+            break;          //report it next time, after these are handled
+        perror("accept");
+        return -1;
+    }
+    return count;
+}
+
+/*
+ *  Blocks until the listen socket has a connection waiting, for servers
+ *  that have nothing else to wait on.  Returns 0, or -1 on an error
+ */
+int listener_wait(int listen_socket){
+    struct pollfd pfd = {.fd = listen_socket, .events = POLLIN};
+
+    while (poll(&pfd, 1, -1) == -1) {
+        if (errno != EINTR) {
+            perror("poll");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//How many cores are online, a good number of listeners to run
+int listener_num_cores(){
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cores > 0 ? (int)cores : 1;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ *  Helpers for the listening side of a TCP server.
+ *
+ *  A server that takes one connection per accept() call, from a backlog
+ *  of 20, falls behind quickly when many clients connect at once.  Once
+ *  the backlog is full the kernel drops new SYNs and those clients sit
+ *  through a retransmit timeout, a second or more, before trying again.
+ *  This module helps in three ways:
+ *
+ *      backlog         is set by the caller, the default is SOMAXCONN,
+ *                      which the kernel caps at its own limit anyway
+ *      batching        listener_accept_all() takes every connection that
+ *                      is waiting each time the listen socket wakes us up,
+ *                      using accept4() so each new socket is already non
+ *                      blocking and close on exec without more calls
+ *      reuseport       several sockets can listen on the same port with
+ *                      SO_REUSEPORT, one per thread, and on Linux the
+ *                      kernel spreads new connections across them
+ *
+ *  accept4() is Linux only, other systems such as the Mac fall back to
+ *  accept() followed by fcntl().
+ */
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define LISTEN_BACKLOG_DEFAULT  SOMAXCONN
+
+#define LISTEN_REUSEPORT    1       //listener_open() flags
+#define ACCEPT_NONBLOCK     1       //listener_accept_all() flags
+
+int listener_open(uint16_t port, int backlog, int flags);
+int listener_accept_all(int listen_socket, int *socks, int max_socks, int flags);
+int listener_wait(int listen_socket);
+int listener_num_cores();
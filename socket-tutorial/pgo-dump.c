@@ -0,0 +1,28 @@
+/*
+ *  Only linked in for PGO=GENERATE builds, see CMakeLists.txt.
+ *
+ *  The servers run until they are killed, so they never get to exit()
+ *  where the profile is normally written.  This catches the SIGTERM
+ *  bench-server stops them with and writes the profile first.
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+extern void __gcov_dump(void);
+
+static void dump_profile(int sig){
+    __gcov_dump();
+    _exit(0);
+}
+
+__attribute__((constructor))
+static void install_dump_handler(){
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_profile;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+}
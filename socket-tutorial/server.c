@@ -4,6 +4,8 @@
  */
  
 #include "server.h"
+#include "frame-reader.h"
+#include "listener.h"
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -15,11 +17,14 @@
 #include <sys/un.h>
 
 #define BUFF_SZ 512
+#define EOF_CHAR '\x05'   //CTRL+D is EOF in general ASCII 5
 
 #define PORT_NUM    1090
+#define LISTEN_BACKLOG  LISTEN_BACKLOG_DEFAULT
+#define ACCEPT_BATCH    64  //Most connections taken per wakeup
 
 static uint8_t send_buffer[BUFF_SZ];
-static uint8_t recv_buffer[BUFF_SZ];
+static frame_reader_t reader;
 
 
 /*
@@ -27,38 +32,52 @@ static uint8_t recv_buffer[BUFF_SZ];
  *  the server runs until stopped manually with a CTRL+C
  */
 static void process_requests(int listen_socket){
+    int socks[ACCEPT_BATCH];
     int data_socket;
+    uint8_t *msg;
+    uint32_t msg_len;
+    int count;
     int ret;
 
     //again, not the best approach, need ctrl-c to exit
     while(1){
-        //Do some cleaning
-        memset(send_buffer,0,sizeof(send_buffer));
-        memset(recv_buffer,0,sizeof(recv_buffer));
-
-        //Establish a connection
-        data_socket = accept(listen_socket, NULL, NULL);
-        if (data_socket == -1) {
-            perror("accept");
+        //Wait for connections, then take all of them at once so the
+        //backlog is empty again while we answer them one at a time
+        if (listener_wait(listen_socket) == -1)
             exit(EXIT_FAILURE);
-        }
-
-        printf("\t RECEIVED REQ...\n");
-
-        /* Wait for next data packet. */
-        ret = recv(data_socket, recv_buffer, sizeof(recv_buffer),0);
-        if (ret == -1) {
-            perror("read error");
+        count = listener_accept_all(listen_socket, socks, ACCEPT_BATCH, 0);
+        if (count == -1)
             exit(EXIT_FAILURE);
-        }
- 
-        int buff_len = snprintf((char *)send_buffer, 
-                sizeof(send_buffer), "THANK YOU -> %s", recv_buffer);
-
-        //now string out buffer has the length
-        send (data_socket, send_buffer, buff_len, 0);
 
-        close(data_socket);
+        for (int i = 0; i < count; i++) {
+            data_socket = socks[i];
+
+            //Do some cleaning
+            memset(send_buffer,0,sizeof(send_buffer));
+
+            printf("\t RECEIVED REQ...\n");
+
+            /* Wait for next data packet, the client ends it with EOF_CHAR */
+            frame_reader_init(&reader, data_socket, FRAME_DELIM, EOF_CHAR);
+            ret = frame_reader_next(&reader, &msg, &msg_len);
+            if (ret == -1) {
+                perror("read error");
+                close(data_socket);
+                continue;
+            }
+            if (ret == 0)
+                msg_len = 0;
+     
+            int buff_len = snprintf((char *)send_buffer, 
+                    sizeof(send_buffer), "THANK YOU -> %.*s", (int)msg_len, (char *)msg);
+            if (buff_len >= sizeof(send_buffer))
+                buff_len = sizeof(send_buffer) - 1;
+
+            //now string out buffer has the length
+            send (data_socket, send_buffer, buff_len, 0);
+
+            close(data_socket);
+        }
     }
 }
 
@@ -69,39 +88,10 @@ static void process_requests(int listen_socket){
  */
 static void start_server(){
     int listen_socket;
-    int ret;
-    
-    struct sockaddr_in addr;
 
-    /* Create local socket. */
-    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_socket == -1) {
-        perror("socket");
+    listen_socket = listener_open(PORT_NUM, LISTEN_BACKLOG, 0);
+    if (listen_socket == -1)
         exit(EXIT_FAILURE);
-    }
-
-    /* Bind socket to socket name. */
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(PORT_NUM);
-
-    ret = bind(listen_socket, (const struct sockaddr *) &addr,
-               sizeof(struct sockaddr_in));
-    if (ret == -1) {
-        perror("accept");
-        exit(EXIT_FAILURE);
-    }
-
-    /*
-     * Prepare for accepting connections. The backlog size is set
-     * to 20. So while one request is being processed other requests
-     * can be waiting.
-     */
-    ret = listen(listen_socket, 20);
-    if (ret == -1) {
-        perror("listen");
-        exit(EXIT_FAILURE);
-    }
 
     //Now process requests, this will never return so its bad coding
     //but ok for purposes of demo
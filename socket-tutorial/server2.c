@@ -4,6 +4,7 @@
  */
  
 #include "server2.h"
+#include "listener.h"
 
 #include <sys/socket.h>
 #include <stdint.h>
@@ -12,76 +13,155 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/un.h>
 
-#define BUFF_SZ 512
 #define EOF_CHAR '\x05'   //CTRL+D is EOF in general ASCII 5
+#define LISTEN_BACKLOG  LISTEN_BACKLOG_DEFAULT
+#define ACCEPT_BATCH    64  //Most connections taken per wakeup
+#define SLOW_WORK_MS 15000  //How long a request that is not 'A' takes
 
 #define PORT_NUM    1090
 
 
-static uint8_t send_buffer[BUFF_SZ];
-static uint8_t recv_buffer[BUFF_SZ];
-
+/*
+ *  Every connection is handled by the event loop in event-loop.c instead
+ *  of a blocking loop.  Nothing here ever waits: reading a request is a
+ *  callback that runs when data shows up, and the slow work that used to
+ *  be a sleep(15) is a timer.  While one request waits on its timer the
+ *  loop goes on serving everyone else, fast 'A' requests are answered
+ *  right away no matter how many slow ones are outstanding.
+ */
+static ev_loop_t loop;
+
+//Closes the connection and frees everything that goes with it
+static void close_connection(conn_t *conn){
+    ev_timer_stop(&loop, &conn->timer);
+    ev_io_remove(&loop, conn->sock);
+    close(conn->sock);
+    free(conn);
+}
 
 /*
- *  This function accepts a socket and processes requests from clients
- *  the server runs until stopped manually with a CTRL+C
+ *  Writes as much of the reply as the socket takes, if it does not all
+ *  fit we wait for the socket to be writable and try again.  Once the
+ *  whole reply is out the connection is closed
  */
-static void process_requests(int listen_socket){
-    int data_socket;
+static void send_reply(ev_loop_t *loop, int fd, int revents, void *arg){
+    conn_t *conn = arg;
     int ret;
 
-    //again, not the best approach, need ctrl-c to exit
-    while(1){
-        //Do some cleaning
-        memset(send_buffer,0,sizeof(send_buffer));
-        memset(recv_buffer,0,sizeof(recv_buffer));
-
-        //Establish a connection
-        data_socket = accept(listen_socket, NULL, NULL);
-        if (data_socket == -1) {
-            perror("accept");
-            exit(EXIT_FAILURE);
-        }
+    ret = send(conn->sock, conn->send_buffer + conn->sent, 
+        conn->send_len - conn->sent, 0);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        ev_io_modify(loop, conn->sock, POLLOUT);
+        return;
+    }
+    if (ret == -1) {
+        perror("send");
+        close_connection(conn);
+        return;
+    }
+    conn->sent += ret;
+    if (conn->sent < conn->send_len) {
+        ev_io_modify(loop, conn->sock, POLLOUT);
+        return;
+    }
+    close_connection(conn);
+}
 
-        printf("\t RECEIVED REQ...\n");
+//The slow work is done, time to answer
+static void slow_work_done(ev_loop_t *loop, void *arg){
+    conn_t *conn = arg;
 
-        uint8_t small_buff[8];
-        uint16_t buffer_offset = 0;
+    if (ev_io_add(loop, conn->sock, 0, send_reply, conn) == -1) {
+        close_connection(conn);
+        return;
+    }
+    send_reply(loop, conn->sock, 0, conn);
+}
 
-        /* Wait for next data packet. */
-        while ((ret = recv(data_socket, small_buff, sizeof(small_buff),0)) > 0){
-            if ((buffer_offset + ret) > sizeof(recv_buffer)){
-                //overflow condition, just ignore the extra
-                break;
-                // char zz = MSG_EOF;
-            }
-            printf("\t\tRead %d bytes\n", ret);
-            memcpy((recv_buffer + buffer_offset), small_buff, ret);
-            buffer_offset += ret;   //point to next read start point
+/*
+ *  Runs when there is data on a connection.  The reader hands back the
+ *  request once all of it, up to EOF_CHAR, has arrived.  Until then it
+ *  fails with EAGAIN and we wait for more
+ */
+static void read_request(ev_loop_t *loop, int fd, int revents, void *arg){
+    conn_t *conn = arg;
+    uint8_t *msg;
+    uint32_t msg_len;
+    int ret;
 
-            //See if we hit the end of the buffer
-            if (small_buff[ret-1] == EOF_CHAR)
-                break;
-        }
-        if (ret == -1) {
-            perror("read error");
-            exit(EXIT_FAILURE);
+    ret = frame_reader_next(&conn->reader, &msg, &msg_len);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (ret == -1) {
+        perror("read error");
+        close_connection(conn);
+        return;
+    }
+    if (ret == 0)
+        msg_len = 0;
+    printf("\t\tRead %u byte request\n", msg_len);
+
+    conn->send_len = snprintf((char *)conn->send_buffer, 
+        sizeof(conn->send_buffer), "THANK YOU -> %.*s", (int)msg_len, (char *)msg);
+    if (conn->send_len >= sizeof(conn->send_buffer))
+        conn->send_len = sizeof(conn->send_buffer) - 1;
+
+    //we are done reading, stop watching the socket until the reply is ready
+    ev_io_remove(loop, conn->sock);
+    if (msg_len > 0 && *msg == 'A')
+        slow_work_done(loop, conn);
+    else
+        ev_timer_start(loop, &conn->timer, SLOW_WORK_MS, slow_work_done, conn);
+}
+
+/*
+ *  Runs when the listen socket has connections waiting.  Takes all of
+ *  them, each one gets its own state and starts out waiting for a request
+ */
+static void accept_connections(ev_loop_t *loop, int listen_socket, int revents, void *arg){
+    int socks[ACCEPT_BATCH];
+    int count;
+
+    do {
+        count = listener_accept_all(listen_socket, socks, ACCEPT_BATCH, ACCEPT_NONBLOCK);
+        for (int i = 0; i < count; i++) {
+            printf("\t RECEIVED REQ...\n");
+
+            conn_t *conn = calloc(1, sizeof(conn_t));
+            if (conn == NULL) {
+                close(socks[i]);
+                continue;
+            }
+            conn->sock = socks[i];
+            frame_reader_init(&conn->reader, socks[i], FRAME_DELIM, EOF_CHAR);
+            if (ev_io_add(loop, socks[i], POLLIN, read_request, conn) == -1) {
+                close(socks[i]);
+                free(conn);
+            }
         }
+    } while (count == ACCEPT_BATCH);
+}
 
-        if (*recv_buffer == 'A')
-            sleep(0);
-        else
-            sleep(15);
- 
-        int buff_len = snprintf((char *)send_buffer, 
-            sizeof(send_buffer), "THANK YOU -> %s", recv_buffer);
+/*
+ *  This function accepts a socket and processes requests from clients
+ *  the server runs until stopped manually with a CTRL+C
+ */
+static void process_requests(int listen_socket){
+    if (ev_loop_init(&loop, 0) == -1)
+        exit(EXIT_FAILURE);
 
-        //now string out buffer has the length
-        send (data_socket, send_buffer, buff_len, 0);
-        close(data_socket);
-    }
+    if (ev_io_add(&loop, listen_socket, POLLIN, accept_connections, NULL) == -1)
+        exit(EXIT_FAILURE);
+
+    //a client that leaves before its reply should not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    //again, not the best approach, need ctrl-c to exit
+    ev_loop_run(&loop);
 }
 
 /*
@@ -91,39 +171,10 @@ static void process_requests(int listen_socket){
  */
 static void start_server(){
     int listen_socket;
-    int ret;
-    
-    struct sockaddr_in addr;
 
-    /* Create local socket. */
-    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_socket == -1) {
-        perror("socket");
+    listen_socket = listener_open(PORT_NUM, LISTEN_BACKLOG, 0);
+    if (listen_socket == -1)
         exit(EXIT_FAILURE);
-    }
-
-    /* Bind socket to socket name. */
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(PORT_NUM);
-
-    ret = bind(listen_socket, (const struct sockaddr *) &addr,
-               sizeof(struct sockaddr_in));
-    if (ret == -1) {
-        perror("accept");
-        exit(EXIT_FAILURE);
-    }
-
-    /*
-     * Prepare for accepting connections. The backlog size is set
-     * to 20. So while one request is being processed other requests
-     * can be waiting.
-     */
-    ret = listen(listen_socket, 20);
-    if (ret == -1) {
-        perror("listen");
-        exit(EXIT_FAILURE);
-    }
 
     //Now process requests, this will never return so its bad coding
     //but ok for purposes of demo
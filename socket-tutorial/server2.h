@@ -1,4 +1,26 @@
 #pragma once
 
+#include "event-loop.h"
+#include "frame-reader.h"
+
+#include <stdint.h>
+
+#define BUFF_SZ 512
+
+//State for one client connection
+typedef struct conn_t {
+    int             sock;
+    frame_reader_t  reader;
+    ev_timer_t      timer;          //The slow work
+    uint8_t         send_buffer[BUFF_SZ];
+    int             send_len;
+    int             sent;
+} conn_t;
+
 static void start_server();
-static void process_requests(int listen_socket);
\ No newline at end of file
+static void process_requests(int listen_socket);
+static void close_connection(conn_t *conn);
+static void send_reply(ev_loop_t *loop, int fd, int revents, void *arg);
+static void slow_work_done(ev_loop_t *loop, void *arg);
+static void read_request(ev_loop_t *loop, int fd, int revents, void *arg);
+static void accept_connections(ev_loop_t *loop, int listen_socket, int revents, void *arg);
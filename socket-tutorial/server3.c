@@ -4,6 +4,7 @@
  */
  
 #include "server3.h"
+#include "listener.h"
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -12,10 +13,15 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/un.h>
-#include <pthread.h>
 
-#define BUFF_SZ 512
+#define EOF_CHAR '\x05'   //CTRL+D is EOF in general ASCII 5
+#define LISTEN_BACKLOG  LISTEN_BACKLOG_DEFAULT
+#define ACCEPT_BATCH    64  //Most connections taken per wakeup
+#define SLOW_WORK_MS 15000  //How long a request that is not 'A' takes
+#define NUM_WORKERS  4      //Threads that process requests
 
 #define PORT_NUM    1090
 
@@ -23,65 +29,159 @@
 
 
 /*
- * This function processes individual requests in threads
+ *  Like server2 this runs on the event loop in event-loop.c, but the
+ *  requests themselves are still processed on threads.  Instead of a new
+ *  thread per connection that sits in sleep(15), a small fixed pool of
+ *  worker threads builds the replies.  The slow part is a timer on the
+ *  loop, so a worker is only busy while there is real work to do and
+ *  thousands of slow requests can be outstanding with just NUM_WORKERS
+ *  threads.  Fast 'A' requests go to a worker right away.
  */
-void *connection_handler(void *socket_handle){
-    int sock = *((int *)socket_handle);
-    int ret = 0;
-
-    // some thread local buffers for the messages - this has to be local to the thread
-    uint8_t send_buffer[BUFF_SZ] = {0};
-    uint8_t recv_buffer[BUFF_SZ] = {0};
-
-    printf("\t\tHello from socket handler thread\n");
-    ret = recv(sock, recv_buffer, sizeof(recv_buffer),0);
-        if (ret == -1) {
-            perror("read error");
-            exit(EXIT_FAILURE);
-        }
-        if (*recv_buffer == 'A')
-            sleep(0);
-        else
-            sleep(15);
- 
-        int buff_len = snprintf((char *)send_buffer, 
-            sizeof(send_buffer), "THANK YOU -> %s", recv_buffer);
+static ev_loop_t loop;
+
+//Closes the connection and frees everything that goes with it
+static void close_connection(conn_t *conn){
+    ev_timer_stop(&loop, &conn->timer);
+    ev_io_remove(&loop, conn->sock);
+    close(conn->sock);
+    free(conn);
+}
+
+/*
+ *  Writes as much of the reply as the socket takes, if it does not all
+ *  fit we wait for the socket to be writable and try again.  Once the
+ *  whole reply is out the connection is closed
+ */
+static void send_reply(ev_loop_t *loop, int fd, int revents, void *arg){
+    conn_t *conn = arg;
+    int ret;
 
-        //now string out buffer has the length
-        send (sock, send_buffer, buff_len, 0);
-        close(sock);
+    ret = send(conn->sock, conn->send_buffer + conn->sent, 
+        conn->send_len - conn->sent, 0);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        ev_io_modify(loop, conn->sock, POLLOUT);
+        return;
+    }
+    if (ret == -1) {
+        perror("send");
+        close_connection(conn);
+        return;
+    }
+    conn->sent += ret;
+    if (conn->sent < conn->send_len) {
+        ev_io_modify(loop, conn->sock, POLLOUT);
+        return;
+    }
+    close_connection(conn);
+}
 
-        return 0;
+/*
+ * This function processes individual requests in the worker threads, it
+ * only touches the connection it was given, which the loop leaves alone
+ * until request_done() runs
+ */
+static void process_request(void *arg){
+    conn_t *conn = arg;
+
+    printf("\t\tHello from worker thread\n");
+    conn->send_len = snprintf((char *)conn->send_buffer, 
+        sizeof(conn->send_buffer), "THANK YOU -> %.*s", (int)conn->msg_len, 
+        (char *)conn->msg);
+    if (conn->send_len >= sizeof(conn->send_buffer))
+        conn->send_len = sizeof(conn->send_buffer) - 1;
 }
 
+//Back on the loop thread, the reply is ready to go
+static void request_done(ev_loop_t *loop, void *arg){
+    conn_t *conn = arg;
+
+    if (ev_io_add(loop, conn->sock, 0, send_reply, conn) == -1) {
+        close_connection(conn);
+        return;
+    }
+    send_reply(loop, conn->sock, 0, conn);
+}
+
+//The slow part is over, hand the request to a worker
+static void slow_work_done(ev_loop_t *loop, void *arg){
+    conn_t *conn = arg;
+
+    if (ev_offload(loop, process_request, request_done, conn) == -1)
+        close_connection(conn);
+}
+
+/*
+ *  Runs when there is data on a connection.  The reader hands back the
+ *  request once all of it, up to EOF_CHAR, has arrived.  Until then it
+ *  fails with EAGAIN and we wait for more
+ */
+static void read_request(ev_loop_t *loop, int fd, int revents, void *arg){
+    conn_t *conn = arg;
+    int ret;
+
+    ret = frame_reader_next(&conn->reader, &conn->msg, &conn->msg_len);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (ret == -1) {
+        perror("read error");
+        close_connection(conn);
+        return;
+    }
+    if (ret == 0)
+        conn->msg_len = 0;
+
+    //we are done reading, stop watching the socket until the reply is ready
+    ev_io_remove(loop, conn->sock);
+    if (conn->msg_len > 0 && *conn->msg == 'A')
+        slow_work_done(loop, conn);
+    else
+        ev_timer_start(loop, &conn->timer, SLOW_WORK_MS, slow_work_done, conn);
+}
+
+/*
+ *  Runs when the listen socket has connections waiting.  Takes all of
+ *  them, each one gets its own state and starts out waiting for a request
+ */
+static void accept_connections(ev_loop_t *loop, int listen_socket, int revents, void *arg){
+    int socks[ACCEPT_BATCH];
+    int count;
+
+    do {
+        count = listener_accept_all(listen_socket, socks, ACCEPT_BATCH, ACCEPT_NONBLOCK);
+        for (int i = 0; i < count; i++) {
+            printf("\t RECEIVED REQ...\n");
+
+            conn_t *conn = calloc(1, sizeof(conn_t));
+            if (conn == NULL) {
+                close(socks[i]);
+                continue;
+            }
+            conn->sock = socks[i];
+            frame_reader_init(&conn->reader, socks[i], FRAME_DELIM, EOF_CHAR);
+            if (ev_io_add(loop, socks[i], POLLIN, read_request, conn) == -1) {
+                close(socks[i]);
+                free(conn);
+            }
+        }
+    } while (count == ACCEPT_BATCH);
+}
 
 /*
  *  This function accepts a socket and processes requests from clients
  *  the server runs until stopped manually with a CTRL+C
  */
 static void process_requests(int listen_socket){
-    int data_socket;
-    int ret;
+    if (ev_loop_init(&loop, NUM_WORKERS) == -1)
+        exit(EXIT_FAILURE);
 
-    //again, not the best approach, need ctrl-c to exit
-    while(1){
-        //Do some cleaning
-        
-
-        //Establish a connection
-        data_socket = accept(listen_socket, NULL, NULL);
-        if (data_socket == -1) {
-            perror("accept");
-            exit(EXIT_FAILURE);
-        }
+    if (ev_io_add(&loop, listen_socket, POLLIN, accept_connections, NULL) == -1)
+        exit(EXIT_FAILURE);
 
-        printf("\t RECEIVED REQ...\n");
-        pthread_t thread_id;
-        if(pthread_create( &thread_id, NULL, connection_handler, (void*)&data_socket) < 0) {
-            perror("could not create thread");
-            exit(EXIT_FAILURE);
-        }
-    }
+    //a client that leaves before its reply should not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    //again, not the best approach, need ctrl-c to exit
+    ev_loop_run(&loop);
 }
 
 /*
@@ -91,39 +191,10 @@ static void process_requests(int listen_socket){
  */
 static void start_server(){
     int listen_socket;
-    int ret;
-    
-    struct sockaddr_in addr;
 
-    /* Create local socket. */
-    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_socket == -1) {
-        perror("socket");
+    listen_socket = listener_open(PORT_NUM, LISTEN_BACKLOG, 0);
+    if (listen_socket == -1)
         exit(EXIT_FAILURE);
-    }
-
-    /* Bind socket to socket name. */
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(PORT_NUM);
-
-    ret = bind(listen_socket, (const struct sockaddr *) &addr,
-               sizeof(struct sockaddr_in));
-    if (ret == -1) {
-        perror("accept");
-        exit(EXIT_FAILURE);
-    }
-
-    /*
-     * Prepare for accepting connections. The backlog size is set
-     * to 20. So while one request is being processed other requests
-     * can be waiting.
-     */
-    ret = listen(listen_socket, 20);
-    if (ret == -1) {
-        perror("listen");
-        exit(EXIT_FAILURE);
-    }
 
     //Now process requests, this will never return so its bad coding
     //but ok for purposes of demo
@@ -1,5 +1,30 @@
 #pragma once
 
+#include "event-loop.h"
+#include "frame-reader.h"
+
+#include <stdint.h>
+
+#define BUFF_SZ 512
+
+//State for one client connection
+typedef struct conn_t {
+    int             sock;
+    frame_reader_t  reader;
+    uint8_t         *msg;           //The request, inside the reader
+    uint32_t        msg_len;
+    ev_timer_t      timer;          //The slow work
+    uint8_t         send_buffer[BUFF_SZ];
+    int             send_len;
+    int             sent;
+} conn_t;
+
 static void start_server();
 static void process_requests(int listen_socket);
-void *connection_handler(void *);
\ No newline at end of file
+static void close_connection(conn_t *conn);
+static void send_reply(ev_loop_t *loop, int fd, int revents, void *arg);
+static void process_request(void *arg);
+static void request_done(ev_loop_t *loop, void *arg);
+static void slow_work_done(ev_loop_t *loop, void *arg);
+static void read_request(ev_loop_t *loop, int fd, int revents, void *arg);
+static void accept_connections(ev_loop_t *loop, int listen_socket, int revents, void *arg);